@@ -0,0 +1,175 @@
+/*
+===============================================================================
+
+  Module     - BufPool
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Pool of I/O buffers leased per operation.  The walk's copy
+               buffer, each pipeline worker's and each stripe worker's are
+               leased from here and given back when done, so any number of
+               copies and compares can be in flight each with a buffer of
+               its own and buffers are reused rather than allocated and
+               freed per file.
+
+               Every buffer is fit for unbuffered (direct) I/O: VirtualAlloc
+               aligns to the allocation granularity, well beyond any sector
+               size, and sizes are kept multiples of the larger cluster size
+               of the source and target volumes.  With /hugepages buffers
+               come from large pages when the lock memory privilege can be
+               had, and with /pinbuf they are locked into the working set,
+               so the copy's buffers are never paged out under the memory
+               pressure a bulk copy creates.
+  Updates -
+
+===============================================================================
+*/
+
+#include "netditto.hpp"
+#include "Security.hpp"
+#include "util32.hpp"
+
+struct BufNode                            // buffer allocated by the pool
+{
+   BufNode                 * next;
+   BYTE                    * data;        // buffer
+   DWORD                     cb;          // size leased as
+   SIZE_T                    cbAlloc;     // size allocated
+   bool                      inUse;       // leased
+};
+
+static BufNode             * nodes;       // all buffers allocated
+static DWORD                 cbAlign;     // buffer size multiple
+static SIZE_T                cbLargePage; // large page size, 0=not used
+static TCriticalSection      csPool;      // serializes leases
+static bool                  lockBuf;     // buffers locked, under csPool once leasing
+
+
+// Locks a buffer into memory, growing the working set to make room for it.
+// csPool is held, so working set growths don't race.
+static void
+   BufLock(
+      BufNode              * node         // i/o-buffer to lock
+   )
+{
+   SIZE_T                    wsMin,
+                             wsMax;
+   DWORD                     rc;
+
+   if ( !GetProcessWorkingSetSize(GetCurrentProcess(), &wsMin, &wsMax)
+     || !SetProcessWorkingSetSize(GetCurrentProcess(), wsMin + node->cbAlloc,
+                                  wsMax + node->cbAlloc)
+     || !VirtualLock(node->data, node->cbAlloc) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(10901, rc, L"VirtualLock(%Iu)=%ld, buffers not locked ",
+                             node->cbAlloc, rc);
+      lockBuf = false;
+   }
+}
+
+
+// Sets the buffer size multiple and, with /hugepages, enables the lock
+// memory privilege.  Called before the first lease.
+void _stdcall
+   BufPoolInit(
+   )
+{
+   cbAlign = max(gOptions.source.cbCluster, gOptions.target.cbCluster);
+   if ( cbAlign < 4096 )
+      cbAlign = 4096;
+   lockBuf = (gOptions.global & OPT_GlobalLockBuf) != 0;
+
+   if ( gOptions.global & OPT_GlobalLargePages )
+   {
+      if ( !(cbLargePage = GetLargePageMinimum()) )
+         err.MsgWrite(10902, L"Large pages not supported, normal pages used");
+      else if ( !PriviledgeEnable(1, NULL, SE_LOCK_MEMORY_NAME) )
+      {
+         err.MsgWrite(10903, L"Lock memory privilege not held, normal pages used");
+         cbLargePage = 0;
+      }
+   }
+}
+
+
+// Leases a buffer of at least cb bytes, rounded up to the buffer size
+// multiple.  Returns NULL if it can't be allocated.
+BYTE * _stdcall
+   BufLease(
+      DWORD                  cb           // in -buffer size
+   )
+{
+   BufNode                 * node;
+   BYTE                    * data = NULL;
+   SIZE_T                    cbAlloc;
+   bool                      large = false;
+
+   cb = (cb + cbAlign - 1) / cbAlign * cbAlign;
+
+   csPool.Enter();
+   for ( node = nodes;  node  &&  (node->inUse  ||  node->cb != cb);  node = node->next );
+   if ( node )
+   {
+      node->inUse = true;
+      csPool.Leave();
+      return node->data;
+   }
+   csPool.Leave();
+
+   if ( cbLargePage )
+   {
+      cbAlloc = (cb + cbLargePage - 1) / cbLargePage * cbLargePage;
+      data = (BYTE *)VirtualAlloc(NULL, cbAlloc, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES,
+                                  PAGE_READWRITE);
+      if ( !data )                        // large pages fragmented or exhausted
+         err.SysMsgWrite(10904, GetLastError(), L"Large page VirtualAlloc(%Iu)=%ld, "
+                                L"normal pages used ", cbAlloc, GetLastError());
+      else
+         large = true;
+   }
+   if ( !data )
+   {
+      cbAlloc = cb;
+      data = (BYTE *)VirtualAlloc(NULL, cbAlloc, MEM_COMMIT, PAGE_READWRITE);
+      if ( !data )
+         return NULL;
+   }
+
+   if ( !(node = (BufNode *)malloc(sizeof *node)) )
+   {
+      VirtualFree(data, 0, MEM_RELEASE);
+      return NULL;
+   }
+   node->data    = data;
+   node->cb      = cb;
+   node->cbAlloc = cbAlloc;
+   node->inUse   = true;
+
+   csPool.Enter();
+   // large pages are never paged out anyway
+   if ( lockBuf  &&  !large )
+      BufLock(node);
+   node->next = nodes;
+   nodes = node;
+   csPool.Leave();
+   return data;
+}
+
+
+// Gives back a leased buffer for reuse
+void _stdcall
+   BufReturn(
+      BYTE                 * data         // in -buffer from BufLease, may be NULL
+   )
+{
+   BufNode                 * node;
+
+   if ( !data )
+      return;
+   csPool.Enter();
+   for ( node = nodes;  node  &&  node->data != data;  node = node->next );
+   if ( node )
+      node->inUse = false;
+   csPool.Leave();
+}
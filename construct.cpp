@@ -9,6 +9,8 @@
                the system.
   Updates -
   95/08/14 RED Change method of initializing the directory buffer and index.
+  26/10/19 TPB Copy buffer leased from the buffer pool and kept a multiple
+               of two clusters so compares can split it for direct I/O.
 
 ===============================================================================
 */
@@ -54,12 +56,19 @@ void _stdcall                             // ret-0=success
                      | FILE_ATTRIBUTE_HIDDEN    | FILE_ATTRIBUTE_DIRECTORY
                      | FILE_ATTRIBUTE_ARCHIVE;
 
-   gOptions.copyBuffer = (PBYTE)VirtualAlloc(NULL,
-                                             gOptions.sizeBuffer = COPYBUFFSIZE,
-                                             MEM_COMMIT,
-                                             PAGE_READWRITE);
+   // /tune needs room in the copy buffer to try larger blocks and depths.
+   // Unbuffered I/O is in whole clusters at least (see IoTuneInit) and
+   // compares split the buffer in two, so it's never under two of them.
+   gOptions.sizeBuffer = gOptions.global & OPT_GlobalIoTune ? IOTUNE_BufferSize : COPYBUFFSIZE;
+   gOptions.sizeBuffer = max(gOptions.sizeBuffer,
+                             2 * max(gOptions.source.cbCluster, gOptions.target.cbCluster));
+   BufPoolInit();
+   gOptions.copyBuffer = BufLease(gOptions.sizeBuffer);
    if ( !gOptions.copyBuffer )
       err.SysMsgWrite(50998, GetLastError(), L"CopyBuffer LocalAlloc(%u)=%ld ",
                              gOptions.sizeBuffer, GetLastError());
+
+   IoTuneInit(&gOptions.source);
+   IoTuneInit(&gOptions.target);
 }
 
@@ -18,6 +18,14 @@
                compare routine no longer relied on a static, be made reentrant
                and so could be multithreaded.
   95/08/14 RED Use multiple buffers for directory entries and indexes.
+  26/10/19 TPB Sort by natural runs with DirSort rather than qsort, or leave
+               the sort to the caller so it can overlap another DirGet.
+  26/10/19 TPB Take a directory's entries from its ScanAhead listing when
+               it was read ahead of the walk.
+  26/10/19 TPB Return DIRGET_Spill for a directory over /spill= and let
+               Spill add to the DirBuffer and build its index too.
+  26/10/19 TPB Also spill a directory whose entries would need DirBlocks
+               allocated past /scanmem=.
 ===============================================================================
 */
 #include "netditto.hpp"
@@ -25,22 +33,104 @@
 
 BufferOffset                 bufferMax = 0;// high water mark for lifo DirBuffer
 
-// Sort compare function used to sort the DirBuffer index so that source and
-// target filenames can be matched (sort/merged) for difference detection.
-static int _cdecl                         // ret-compare result
-   SortCompare(
-      DirEntry const      ** i1          ,// in -index 1 address
-      DirEntry const      ** i2           // in -index 2 address
+// Takes room for an entry of a given length from a DirBuffer, chaining to
+// the next DirBlock when the current one is full
+DirEntry * _stdcall                       // ret-entry to be filled in
+   DirBufferAdd(
+      DirOptions           * dir         ,// i/o-directory data and options
+      size_t                 cbDirEntry   // in -length of the entry
    )
 {
-   return _wcsicmp( (*i1)->cFileName, (*i2)->cFileName );
+   DirBlock                * newBlock;   // allocated DirBlock
+   DirEntry                * entry;
+
+   if ( cbDirEntry > dir->dirBuffer.currBlock->avail )
+   {
+      // Buffer full - chain to new buffer.
+      if ( (void *) dir->dirBuffer.currBlock->chain.fwd == (void *) &dir->dirBuffer.block )
+      {                                  // need to allocate a new buffer
+         newBlock = (DirBlock *) new byte[gOptions.sizeDirBuff];
+         BdQueueAddEnd( &dir->dirBuffer.block, &newBlock->chain );
+         bufferMax += gOptions.sizeDirBuff;
+      }
+      dir->dirBuffer.currBlock = (DirBlock *) dir->dirBuffer.currBlock->chain.fwd;
+      dir->dirBuffer.currBlock->hwmEntry = &dir->dirBuffer.currBlock->firstEntry;
+      dir->dirBuffer.currBlock->avail = gOptions.sizeDirBuff - offsetof(DirBlock,firstEntry);
+   }
+
+   // Update directory block
+   entry = dir->dirBuffer.currBlock->hwmEntry;
+   dir->dirBuffer.currBlock->hwmEntry = (DirEntry *) (((byte *) entry) + cbDirEntry);
+   dir->dirBuffer.currBlock->avail -= (DWORD)cbDirEntry;
+   return entry;
+}
+
+
+// Makes the next DirIndex of a DirBuffer the index of the entries added
+// from a starting position
+DirEntry ** _stdcall                      // ret-array of DirEntry pointers
+   DirIndexBuild(
+      DirOptions           * dir         ,// i/o-directory data and options
+      DirBlock             * orgCurrBlock,// in -block of the first entry
+      DirEntry             * orgHwm      ,// in -first entry, or where it would have been
+      DWORD                  dirCount     // in -entries added
+   )
+{
+   DirIndex                * newIndex;   // new index
+   size_t                    newIndexLen;// length of new index
+   size_t                    oldIndexLen;// length of old index
+   DirEntry               ** ptrDirEntry;// ptr to index array element
+
+   // if necessary, allocate a new index
+   if ( (void *) dir->dirBuffer.currIndex->chain.fwd == (void *) &dir->dirBuffer.index )
+   {                                      // need to allocate a new index
+      newIndexLen = LEN_DirIndex + (dirCount * sizeof (DirEntry *));
+      newIndexLen = max( newIndexLen, gOptions.sizeDirIndex );
+      newIndex = (DirIndex *) new char[newIndexLen];
+      newIndex->availSlots = (DWORD)((newIndexLen - LEN_DirIndex) / sizeof (DirEntry *));
+      BdQueueAddEnd( &dir->dirBuffer.index, &newIndex->chain );
+      bufferMax += (BufferOffset)newIndexLen;
+   }
+   // if next index is not big enough, allocate a bigger one
+   dir->dirBuffer.currIndex = (DirIndex *) dir->dirBuffer.currIndex->chain.fwd;
+   if ( dirCount > dir->dirBuffer.currIndex->availSlots )
+   {
+      oldIndexLen = LEN_DirIndex + dir->dirBuffer.currIndex->availSlots * sizeof (DirEntry *);
+      newIndexLen = LEN_DirIndex + dirCount * sizeof (DirEntry *);
+      newIndex = (DirIndex *) new char[newIndexLen];
+      memcpy( newIndex, dir->dirBuffer.currIndex, oldIndexLen );
+      newIndex->availSlots = (BufferOffset)((newIndexLen - LEN_DirIndex) / sizeof (DirEntry *));
+      BdQueueInsAft( &dir->dirBuffer.index, &newIndex->chain, &dir->dirBuffer.currIndex->chain );
+      bufferMax += (BufferOffset)newIndexLen;
+      BdQueueDel( &dir->dirBuffer.index, &dir->dirBuffer.currIndex->chain );
+      bufferMax -= (BufferOffset)oldIndexLen;
+      delete[] dir->dirBuffer.currIndex;
+      dir->dirBuffer.currIndex = newIndex;
+   }
+   // now build the index array
+   dir->dirBuffer.currIndex->usedSlots = dirCount;
+   for ( ptrDirEntry = dir->dirBuffer.currIndex->dirArray; dirCount; dirCount-- )
+   {
+      if ( orgHwm >= orgCurrBlock->hwmEntry )
+      {
+         orgCurrBlock = (DirBlock *) orgCurrBlock->chain.fwd;
+         orgHwm = &orgCurrBlock->firstEntry;
+      }
+      *(ptrDirEntry++) = orgHwm;
+      orgHwm = (DirEntry *) ((byte *) orgHwm + CB_DirEntry(wcslen(orgHwm->cFileName)));
+   }
+   return dir->dirBuffer.currIndex->dirArray;
 }
 
-DWORD _stdcall                            // ret-0=success -1=overflow +=error
+
+DWORD _stdcall                            // ret-0=success -1=overflow
+                                          //    DIRGET_Spill=too big +=error
    DirGet(
       DirOptions           * dir         ,// i/o-directory data and options
       StatsCommon          * stats       ,// i/o-dir level statistics
-      DirEntry           *** dirArray     // out-array of DirEntry pointers
+      DirEntry           *** dirArray    ,// out-array of DirEntry pointers
+      BOOL                 * unsorted     // out-array left for the caller to sort,
+                                          //     NULL=sorted here
    )
 {
    wchar_t                 * appendPath = dir->path + wcslen(dir->path);
@@ -52,31 +142,34 @@ DWORD _stdcall                            // ret-0=success -1=overflow +=error
                              cbDirEntry;             // length of buff dir entry
    HANDLE                    hDir;
    WIN32_FIND_DATA           findEntry;              // result of Find*File API
+   ScanDir                 * ahead;      // listing read ahead, NULL if none
    DirEntry                * dirPrev;    // previous directory entry
    DirEntry                  dirWork;    // work directory entry
-   DirBlock                * newBlock;   // allocated DirBlock
    // Starting position in DirBlock - used to build index array
    DirBlock                * orgCurrBlock = dir->dirBuffer.currBlock;
    DirEntry                * orgHwm       = orgCurrBlock->hwmEntry;
-   size_t                    orgAvail     = orgCurrBlock->avail;
-   // Workareas for building index array
-   DirIndex                * newIndex;   // new index
-   size_t                    newIndexLen;// length of new index
-   size_t                    oldIndexLen;// length of old index
-   DirEntry               ** ptrDirEntry;// ptr to index array element
+   DWORD                     orgAvail     = orgCurrBlock->avail;
+   StatsCommon               orgStats     = *stats; // restored for a spill
+   size_t                    cbDir = 0;  // memory the directory takes
 
    memset( &dirWork, '\0', sizeof dirWork);
    dirPrev = &dirWork;                    // previous directory entry for sort test
+   if ( unsorted )
+      *unsorted = FALSE;
 
    stats->dirFiltered++;                  // dirs currently always filtered
    stats->dirFound++;                     // count current directory
 
+   // a listing read ahead of the walk stands in for Find*File
+   if ( ahead = ScanAheadTake(dir) )
+      hDir = INVALID_HANDLE_VALUE;
    wcscpy(appendPath, L"\\*");            // set path to include wildcard for Find*File
    // iterate through directory entries and stuff them in DirBuffer
-   for ( bRc = ((hDir = FindFirstFile(dir->apipath, &findEntry)) != INVALID_HANDLE_VALUE),
+   for ( bRc = ahead ? ScanAheadNext(ahead, &findEntry)
+                     : ((hDir = FindFirstFile(dir->apipath, &findEntry)) != INVALID_HANDLE_VALUE),
                appendPath[0] = L'\0';     // restore path -- remove \*.* append
          bRc;
-         bRc = FindNextFile(hDir, &findEntry) )
+         bRc = ahead ? ScanAheadNext(ahead, &findEntry) : FindNextFile(hDir, &findEntry) )
    {
       if ( findEntry.cFileName[0] == L'.' )
          if ( findEntry.cFileName[1] == L'\0'
@@ -93,18 +186,19 @@ DWORD _stdcall                            // ret-0=success -1=overflow +=error
 
       lenFileName = wcslen(findEntry.cFileName);
       cbDirEntry = CB_DirEntry(lenFileName);
-      if ( cbDirEntry > dir->dirBuffer.currBlock->avail )
+
+      // a directory too big to hold, or that would grow the DirBuffer past
+      // /scanmem=, is left to be spilled
+      cbDir += cbDirEntry + sizeof (DirEntry *);
+      if ( gOptions.cbSpillMin
+        && !(gOptions.fState & FLAG_Sweep)   // a sweep may stop part way
+        && (cbDir > gOptions.cbSpillMin
+         || (cbDirEntry > dir->dirBuffer.currBlock->avail
+          && (void *) dir->dirBuffer.currBlock->chain.fwd == (void *) &dir->dirBuffer.block
+          && bufferMax + gOptions.sizeDirBuff > gOptions.cbDirMemMax)) )
       {
-         // Buffer full - chain to new buffer.
-         if ( (void *) dir->dirBuffer.currBlock->chain.fwd == (void *) &dir->dirBuffer.block )
-         {                               // need to allocate a new buffer
-            newBlock = (DirBlock *) new byte[gOptions.sizeDirBuff];
-            BdQueueAddEnd( &dir->dirBuffer.block, &newBlock->chain );
-            bufferMax += gOptions.sizeDirBuff;
-         }
-         dir->dirBuffer.currBlock = (DirBlock *) dir->dirBuffer.currBlock->chain.fwd;
-         dir->dirBuffer.currBlock->hwmEntry = &dir->dirBuffer.currBlock->firstEntry;
-         dir->dirBuffer.currBlock->avail = gOptions.sizeDirBuff - offsetof(DirBlock,firstEntry);
+         rc = DIRGET_Spill;
+         break;
       }
 
       if ( !(findEntry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) )  // if it's a file
@@ -118,21 +212,22 @@ DWORD _stdcall                            // ret-0=success -1=overflow +=error
          if ( _wcsicmp(findEntry.cFileName, dirPrev->cFileName) < 0 )
             sorted = 0;
 
-      dirPrev = dir->dirBuffer.currBlock->hwmEntry;
+      dirPrev = DirBufferAdd(dir, cbDirEntry);
       // Create directory buffer entry by copying info from findEntry
       dirPrev->ftimeLastWrite = findEntry.ftLastWriteTime;
       dirPrev->cbFile         = INT64R(findEntry.nFileSizeLow, findEntry.nFileSizeHigh);
       dirPrev->attrFile       = findEntry.dwFileAttributes;
       wcsncpy(dirPrev->cFileName, findEntry.cFileName, lenFileName + 1);
-
-      // Update directory block
-      dir->dirBuffer.currBlock->hwmEntry = (DirEntry *) (((byte *) dir->dirBuffer.currBlock->hwmEntry)
-            + cbDirEntry);
-      dir->dirBuffer.currBlock->avail -= (DWORD)cbDirEntry;
       dirCount++;
    }
 
-   if ( rc != (DWORD)-1 )
+   if ( ahead )
+   {
+      ScanAheadFree(ahead);
+      if ( rc != DIRGET_Spill )
+         rc = ERROR_NO_MORE_FILES;
+   }
+   else if ( rc != (DWORD)-1  &&  rc != DIRGET_Spill )
       rc = GetLastError();
 
    if ( hDir != INVALID_HANDLE_VALUE )
@@ -149,6 +244,12 @@ DWORD _stdcall                            // ret-0=success -1=overflow +=error
       case -1:                           // buffer full
          err.MsgWrite(50101, L"Buffer full" );
          break;
+      case DIRGET_Spill:                 // as though never read, for Spill to read
+         dir->dirBuffer.currBlock = orgCurrBlock;
+         orgCurrBlock->hwmEntry   = orgHwm;
+         orgCurrBlock->avail      = orgAvail;
+         *stats = orgStats;
+         break;
       case ERROR_PATH_NOT_FOUND:
          err.MsgWrite(50102, L"Invalid path '%s'", dir->path);
          break;
@@ -158,52 +259,15 @@ DWORD _stdcall                            // ret-0=success -1=overflow +=error
 
    if ( !rc )
    {
-      // if necessary, allocate a new index
-      if ( (void *) dir->dirBuffer.currIndex->chain.fwd == (void *) &dir->dirBuffer.index )
-      {                                   // need to allocate a new index
-         newIndexLen = LEN_DirIndex + (dirCount * sizeof (DirEntry *));
-         newIndexLen = max( newIndexLen, gOptions.sizeDirIndex );
-         newIndex = (DirIndex *) new char[newIndexLen];
-         newIndex->availSlots = (DWORD)((newIndexLen - LEN_DirIndex) / sizeof (DirEntry *));
-         BdQueueAddEnd( &dir->dirBuffer.index, &newIndex->chain );
-         bufferMax += (BufferOffset)newIndexLen;
-      }
-      // if next index is not big enough, allocate a bigger one
-      dir->dirBuffer.currIndex = (DirIndex *) dir->dirBuffer.currIndex->chain.fwd;
-      if ( dirCount > dir->dirBuffer.currIndex->availSlots )
-      {
-         oldIndexLen = LEN_DirIndex + dir->dirBuffer.currIndex->availSlots * sizeof (DirEntry *);
-         newIndexLen = LEN_DirIndex + dirCount * sizeof (DirEntry *);
-         newIndex = (DirIndex *) new char[newIndexLen];
-         memcpy( newIndex, dir->dirBuffer.currIndex, oldIndexLen );
-         newIndex->availSlots = (BufferOffset)((newIndexLen - LEN_DirIndex) / sizeof (DirEntry *));
-         BdQueueInsAft( &dir->dirBuffer.index, &newIndex->chain, &dir->dirBuffer.currIndex->chain );
-         bufferMax += (BufferOffset)newIndexLen;
-         BdQueueDel( &dir->dirBuffer.index, &dir->dirBuffer.currIndex->chain );
-         bufferMax -= (BufferOffset)oldIndexLen;
-         delete[] dir->dirBuffer.currIndex;
-         dir->dirBuffer.currIndex = newIndex;
-      }
-      // now build the index array
-      dir->dirBuffer.currIndex->usedSlots = dirCount;
-      for ( ptrDirEntry = dir->dirBuffer.currIndex->dirArray; dirCount; dirCount-- )
-      {
-         if ( orgHwm >= orgCurrBlock->hwmEntry )
-         {
-            orgCurrBlock = (DirBlock *) orgCurrBlock->chain.fwd;
-            orgHwm = &orgCurrBlock->firstEntry;
-         }
-         *(ptrDirEntry++) = orgHwm;
-         orgHwm = (DirEntry *) ((byte *) orgHwm + CB_DirEntry(wcslen(orgHwm->cFileName)));
-      }
-      *dirArray = dir->dirBuffer.currIndex->dirArray;
+      *dirArray = DirIndexBuild(dir, orgCurrBlock, orgHwm, dirCount);
 
       if ( !sorted )                      // if not sorted, sort the indexes
       {
-         qsort(dir->dirBuffer.currIndex->dirArray,
-               dir->dirBuffer.currIndex->usedSlots,
-               sizeof dir->dirBuffer.currIndex->dirArray[0],
-               (int(__cdecl *)(const void*,const void*))SortCompare );
+         if ( unsorted )
+            *unsorted = TRUE;
+         else
+            DirSort(dir->dirBuffer.currIndex->dirArray,
+                    dir->dirBuffer.currIndex->usedSlots);
       }
    }
    return rc;
@@ -0,0 +1,387 @@
+/*
+===============================================================================
+
+  Module     - DirSort
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Sorts a DirIndex by name for the match.  Find*File mostly
+               returns names in order or in long ordered runs, NTFS from its
+               B-tree and others as files were added, yet when the order was
+               broken anywhere DirGet sorted the whole index with qsort from
+               scratch on the walk thread.
+
+               The sort here takes the runs as they are, turning descending
+               ones around and extending short ones to DIRSORT_MinRun by
+               binary insertion, then merges neighbouring runs pass by pass,
+               as timsort does, so a nearly sorted index costs little more
+               than a look over it.  From DIRSORT_ParallelMin entries the
+               index is cut into DIRSORT_Threads parts sorted at once, which
+               are then merged pairwise, each merge shared out among the
+               threads by cutting it at matching points of its two halves.
+
+               MatchEntries has the source index sorted by another thread
+               while it reads the target directory, then sorts the target's,
+               so the two overlap.
+  Updates -
+
+===============================================================================
+*/
+
+#include <process.h>
+
+#include "netditto.hpp"
+
+#define DIRSORT_Threads      8            // threads sorting a large index
+#define DIRSORT_ParallelMin  32768        // smaller indexes are sorted by one thread
+#define DIRSORT_MinRun       32           // shorter runs are extended by insertion
+
+struct DirSortTask                        // part sort or merge
+{
+   DirEntry               ** a;           // part to sort, or first half to merge
+   DirEntry               ** aEnd;
+   DirEntry               ** b;           // second half to merge, NULL to sort
+   DirEntry               ** bEnd;
+   DirEntry               ** out;         // merge output, or sort work area
+};
+
+struct DirSortJob                         // tasks done by any of the threads
+{
+   DirSortTask             * task;
+   long                      nTask;
+   long volatile             next;        // next task to take
+};
+
+struct DirSortAsync                       // index sorted by another thread
+{
+   DirEntry               ** index;
+   DWORD                     n;
+};
+
+
+// qsort form of DirSortCmp, for when there is no memory to merge with
+static int _cdecl
+   DirSortQCmp(
+      DirEntry const      ** i1          ,// in -index 1 address
+      DirEntry const      ** i2           // in -index 2 address
+   )
+{
+   return _wcsicmp((*i1)->cFileName, (*i2)->cFileName);
+}
+
+
+static inline int
+   DirSortCmp(
+      DirEntry const       * e1          ,// in -entry
+      DirEntry const       * e2           // in -entry
+   )
+{
+   return _wcsicmp(e1->cFileName, e2->cFileName);
+}
+
+
+// Merges two sorted ranges into another, taking the first's on equal names
+static void
+   DirSortMerge(
+      DirEntry            ** a           ,// in -first range
+      DirEntry            ** aEnd        ,
+      DirEntry            ** b           ,// in -second range
+      DirEntry            ** bEnd        ,
+      DirEntry            ** out          // out-merged entries
+   )
+{
+   while ( a < aEnd  &&  b < bEnd )
+      *out++ = DirSortCmp(*b, *a) < 0 ? *b++ : *a++;
+   memcpy(out, a, (aEnd - a) * sizeof *a);
+   memcpy(out + (aEnd - a), b, (bEnd - b) * sizeof *b);
+}
+
+
+// Sorts a range by its natural runs, using a work area of the same size
+static void
+   DirSortRuns(
+      DirEntry            ** a           ,// i/o-range sorted
+      DWORD                  n           ,// in -entries
+      DirEntry            ** work         // i/o-work area of n entries
+   )
+{
+   DWORD                   * run,         // run starts, then n
+                             nRun = 0,
+                             i, j, lo, hi, mid;
+   DirEntry                * e,
+                          ** src = a,
+                          ** dst = work,
+                          ** swap;
+
+   if ( n < 2 )
+      return;
+   if ( !(run = (DWORD *)malloc((n / DIRSORT_MinRun + 2) * sizeof *run)) )
+   {
+      qsort(a, n, sizeof *a, (int(__cdecl *)(const void*,const void*))DirSortQCmp);
+      return;
+   }
+
+   // find the runs, turning descending ones around and extending short ones
+   for ( i = 0;  i < n;  i = j )
+   {
+      run[nRun++] = i;
+      j = i + 1;
+      if ( j < n  &&  DirSortCmp(a[j], a[i]) < 0 )
+      {
+         while ( j + 1 < n  &&  DirSortCmp(a[j+1], a[j]) < 0 )
+            j++;
+         for ( lo = i, hi = j;  lo < hi;  lo++, hi-- )
+         {
+            e = a[lo];  a[lo] = a[hi];  a[hi] = e;
+         }
+         j++;
+      }
+      else
+         while ( j < n  &&  DirSortCmp(a[j], a[j-1]) >= 0 )
+            j++;
+      for ( ;  j < n  &&  j - i < DIRSORT_MinRun;  j++ )
+      {
+         // binary insertion of a[j] into a[i..j)
+         e = a[j];
+         for ( lo = i, hi = j;  lo < hi; )
+         {
+            mid = lo + (hi - lo) / 2;
+            if ( DirSortCmp(e, a[mid]) < 0 )
+               hi = mid;
+            else
+               lo = mid + 1;
+         }
+         memmove(a + lo + 1, a + lo, (j - lo) * sizeof *a);
+         a[lo] = e;
+      }
+   }
+   run[nRun] = n;
+
+   // merge neighbouring runs pass by pass between the range and the work area
+   while ( nRun > 1 )
+   {
+      for ( i = j = 0;  i < nRun;  i += 2, j++ )
+      {
+         if ( i + 1 < nRun )
+            DirSortMerge(src + run[i], src + run[i+1], src + run[i+1], src + run[i+2],
+                         dst + run[i]);
+         else
+            memcpy(dst + run[i], src + run[i], (run[i+1] - run[i]) * sizeof *src);
+         run[j] = run[i];
+      }
+      run[j] = n;
+      nRun = j;
+      swap = src;  src = dst;  dst = swap;
+   }
+   if ( src != a )
+      memcpy(a, src, n * sizeof *a);
+   free(run);
+}
+
+
+// Does tasks of a job until there are none left
+static unsigned __stdcall
+   DirSortThread(
+      void                 * arg          // i/o-DirSortJob
+   )
+{
+   DirSortJob              * job = (DirSortJob *)arg;
+   DirSortTask             * t;
+   long                      n;
+
+   while ( (n = InterlockedIncrement(&job->next) - 1) < job->nTask )
+   {
+      t = &job->task[n];
+      if ( t->b )
+         DirSortMerge(t->a, t->aEnd, t->b, t->bEnd, t->out);
+      else
+         DirSortRuns(t->a, (DWORD)(t->aEnd - t->a), t->out);
+   }
+   return 0;
+}
+
+
+// Does a job's tasks with up to DIRSORT_Threads threads, this one included
+static void
+   DirSortJobRun(
+      DirSortJob           * job          // i/o-job
+   )
+{
+   HANDLE                    hThread[DIRSORT_Threads];
+   int                       nThread = 0;
+
+   job->next = 0;
+   while ( nThread < DIRSORT_Threads - 1  &&  nThread < job->nTask - 1 )
+   {
+      if ( !(hThread[nThread] = (HANDLE)_beginthreadex(NULL, 0, DirSortThread, job, 0, NULL)) )
+         break;                           // this thread does the rest
+      nThread++;
+   }
+   DirSortThread(job);
+   if ( nThread )
+   {
+      WaitForMultipleObjects(nThread, hThread, TRUE, INFINITE);
+      while ( nThread )
+         CloseHandle(hThread[--nThread]);
+   }
+}
+
+
+// Sorts a DirIndex array by name
+void _stdcall
+   DirSort(
+      DirEntry            ** index       ,// i/o-index array
+      DWORD                  n            // in -entries
+   )
+{
+   DirEntry               ** work,
+                          ** src,
+                          ** dst,
+                          ** swap,
+                          ** mid,
+                          ** lo,
+                          ** hi;
+   DirSortTask               task[DIRSORT_Threads];
+   DirSortJob                job;
+   DWORD                     part[DIRSORT_Threads + 1];
+   int                       nPart,
+                             nSplit,
+                             p, s;
+   DirEntry               ** aCut[DIRSORT_Threads + 1],
+                          ** bCut[DIRSORT_Threads + 1];
+
+   if ( n < 2 )
+      return;
+   if ( !(work = (DirEntry **)malloc(n * sizeof *work)) )
+   {
+      qsort(index, n, sizeof *index, (int(__cdecl *)(const void*,const void*))DirSortQCmp);
+      return;
+   }
+   if ( n < DIRSORT_ParallelMin )
+   {
+      DirSortRuns(index, n, work);
+      free(work);
+      return;
+   }
+
+   // sort the parts at once
+   nPart = DIRSORT_Threads;
+   for ( p = 0;  p <= nPart;  p++ )
+      part[p] = (DWORD)((__int64)n * p / nPart);
+   for ( p = 0;  p < nPart;  p++ )
+   {
+      task[p].a    = index + part[p];
+      task[p].aEnd = index + part[p+1];
+      task[p].b    = NULL;
+      task[p].out  = work + part[p];
+   }
+   job.task  = task;
+   job.nTask = nPart;
+   DirSortJobRun(&job);
+
+   // merge them pairwise, cutting each merge into as many pieces as there
+   // are threads to spare for it
+   src = index;
+   dst = work;
+   while ( nPart > 1 )
+   {
+      job.nTask = 0;
+      for ( p = 0;  p < nPart;  p += 2 )
+      {
+         if ( p + 1 == nPart )
+         {
+            memcpy(dst + part[p], src + part[p], (part[p+1] - part[p]) * sizeof *src);
+            continue;
+         }
+         nSplit = DIRSORT_Threads / (nPart / 2);
+         aCut[0] = src + part[p];
+         bCut[0] = src + part[p+1];
+         for ( s = 1;  s < nSplit;  s++ )
+         {
+            // cut the first half evenly and the second where its names pass the cut
+            aCut[s] = src + part[p] + (DWORD)((__int64)(part[p+1] - part[p]) * s / nSplit);
+            for ( lo = max(bCut[s-1], src + part[p+1]), hi = src + part[p+2];  lo < hi; )
+            {
+               mid = lo + (hi - lo) / 2;
+               if ( DirSortCmp(*mid, *aCut[s]) < 0 )
+                  lo = mid + 1;
+               else
+                  hi = mid;
+            }
+            bCut[s] = lo;
+         }
+         aCut[nSplit] = src + part[p+1];
+         bCut[nSplit] = src + part[p+2];
+         for ( s = 0;  s < nSplit;  s++ )
+         {
+            task[job.nTask].a    = aCut[s];
+            task[job.nTask].aEnd = aCut[s+1];
+            task[job.nTask].b    = bCut[s];
+            task[job.nTask].bEnd = bCut[s+1];
+            task[job.nTask].out  = dst + (aCut[s] - (src + part[p])) + (bCut[s] - (src + part[p+1]))
+                                 + part[p];
+            job.nTask++;
+         }
+      }
+      DirSortJobRun(&job);
+      for ( p = 0;  p * 2 < nPart;  p++ )
+         part[p] = part[p * 2];
+      part[p] = n;
+      nPart = p;
+      swap = src;  src = dst;  dst = swap;
+   }
+   if ( src != index )
+      memcpy(index, src, n * sizeof *index);
+   free(work);
+}
+
+
+static unsigned __stdcall
+   DirSortAsyncThread(
+      void                 * arg          // i/o-DirSortAsync, freed
+   )
+{
+   DirSortAsync            * async = (DirSortAsync *)arg;
+
+   DirSort(async->index, async->n);
+   free(async);
+   return 0;
+}
+
+
+// Starts sorting a large index on another thread so the walk can go on to
+// read the other directory.  A small one is sorted now.  Returns the thread
+// to pass to DirSortWait, NULL if already sorted.
+HANDLE _stdcall
+   DirSortStart(
+      DirEntry            ** index       ,// i/o-index array
+      DWORD                  n            // in -entries
+   )
+{
+   DirSortAsync            * async;
+   HANDLE                    hThread;
+
+   if ( n >= DIRSORT_ParallelMin  &&  (async = (DirSortAsync *)malloc(sizeof *async)) )
+   {
+      async->index = index;
+      async->n     = n;
+      if ( hThread = (HANDLE)_beginthreadex(NULL, 0, DirSortAsyncThread, async, 0, NULL) )
+         return hThread;
+      free(async);
+   }
+   DirSort(index, n);
+   return NULL;
+}
+
+
+// Waits for an index sort DirSortStart started
+void _stdcall
+   DirSortWait(
+      HANDLE                 hThread      // in -from DirSortStart, NULL if none
+   )
+{
+   if ( !hThread )
+      return;
+   WaitForSingleObject(hThread, INFINITE);
+   CloseHandle(hThread);
+}
@@ -0,0 +1,162 @@
+/*
+===============================================================================
+
+  Module     - DirTime
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Deferred directory timestamp fixups for /t.  Creating or
+               removing anything in a target directory changes its last
+               write time, so the walk used to open every directory again
+               on its way back up to set it, whether or not anything under
+               it had changed, and the fixups of a deep tree were done one
+               at a time in between the file work.
+
+               MatchEntries now rolls up whether anything changed in each
+               directory's subtree and only a directory that was created,
+               changed underneath or whose time differs from the source gets
+               a fixup.  Its time, along with any attribute change, is
+               queued here rather than applied then.  A compression change,
+               which needs the source, is still made on the way up.  Once the
+               walk is done the queue is sorted deepest first and applied by
+               DIRTIME_Threads threads, each taking the next directory.
+               Setting a directory's time doesn't touch its parent's, so the
+               threads need not wait for a level to finish before the next.
+  Updates -
+
+===============================================================================
+*/
+
+#include <process.h>
+
+#include "netditto.hpp"
+
+#define DIRTIME_Threads      8            // threads applying the fixups
+#define DIRTIME_MinThreaded  64           // fewer fixups are applied inline
+#define DIRTIME_Grow         1024         // queue growth in entries
+
+struct DirTimeFix                         // queued directory fixup
+{
+   MetaChange                change;      // time and other changes
+   int                       depth;       // path components, for deepest first
+   WCHAR                     apiPath[1];  // directory \\?\ path
+};
+
+static DirTimeFix         ** queue;       // queued fixups
+static long                  nQueued,
+                             nAlloc;
+static long volatile         next;        // next fixup to apply
+
+
+// Queues a directory's time fixup, and any attribute change of it, to be
+// applied once the walk is done.  Applied at once if it can't be queued.
+DWORD _stdcall                            // ret-0 or last error
+   DirTimeQueue(
+      MetaChange const     * change      ,// in -changes to apply
+      WCHAR const          * tgtApiPath  ,// in -directory path with \\?\ prefix
+      WCHAR const          * tgtPath      // in -directory path for messages
+   )
+{
+   DirTimeFix              * fix;
+   DirTimeFix             ** grown;
+   size_t                    cchPath = wcslen(tgtApiPath);
+   WCHAR const             * c;
+
+   if ( nQueued == nAlloc )
+   {
+      grown = (DirTimeFix **)realloc(queue, (nAlloc + DIRTIME_Grow) * sizeof *queue);
+      if ( grown )
+      {
+         queue = grown;
+         nAlloc += DIRTIME_Grow;
+      }
+   }
+   fix = nQueued < nAlloc
+       ? (DirTimeFix *)malloc(offsetof(DirTimeFix, apiPath) + (cchPath + 1) * sizeof (WCHAR))
+       : NULL;
+   if ( !fix )
+   {
+      err.MsgWrite(21501, L"Directory time queue allocation failed, set now (%s)", tgtPath);
+      return MetaSet(NULL, change, tgtApiPath, tgtPath);
+   }
+   fix->change = *change;
+   fix->change.fields &= META_Time | META_Attr;
+   fix->change.srcApiPath = NULL;         // the walk has moved on from it
+   wcscpy(fix->apiPath, tgtApiPath);
+   for ( fix->depth = 0, c = tgtPath;  *c;  c++ )
+      if ( *c == L'\\' )
+         fix->depth++;
+   queue[nQueued++] = fix;
+   return 0;
+}
+
+
+// deepest first
+static int __cdecl
+   DirTimeCompare(
+      void const           * v1          ,// in -DirTimeFix **
+      void const           * v2           // in -DirTimeFix **
+   )
+{
+   return (*(DirTimeFix const **)v2)->depth - (*(DirTimeFix const **)v1)->depth;
+}
+
+
+// Applies queued fixups until there are none left
+static unsigned __stdcall
+   DirTimeThread(
+      void                 * arg          // in -not used
+   )
+{
+   DirTimeFix              * fix;
+   long                      n;
+
+   while ( (n = InterlockedIncrement(&next) - 1) < nQueued )
+   {
+      fix = queue[n];
+      MetaSet(NULL, &fix->change, fix->apiPath,
+              fix->apiPath + DIM(gOptions.target.apipath));
+      free(fix);
+   }
+   return 0;
+}
+
+
+// Applies the queued fixups, deepest first, once the walk is done
+void _stdcall
+   DirTimeFixup(
+   )
+{
+   HANDLE                    hThread[DIRTIME_Threads];
+   int                       nThread = 0;
+   DWORD                     tStart = GetTickCount();
+
+   if ( !nQueued )
+      return;
+
+   qsort(queue, nQueued, sizeof *queue, DirTimeCompare);
+   next = 0;
+   if ( nQueued >= DIRTIME_MinThreaded )
+      for ( ;  nThread < DIRTIME_Threads;  nThread++ )
+      {
+         hThread[nThread] = (HANDLE)_beginthreadex(NULL, 0, DirTimeThread, NULL, 0, NULL);
+         if ( !hThread[nThread] )
+         {
+            err.SysMsgWrite(21502, GetLastError(), L"_beginthreadex(DirTimeThread)=%ld ",
+                                   GetLastError());
+            break;
+         }
+      }
+   DirTimeThread(NULL);                   // lends a hand and does any left inline
+   if ( nThread )
+   {
+      WaitForMultipleObjects(nThread, hThread, TRUE, INFINITE);
+      while ( nThread )
+         CloseHandle(hThread[--nThread]);
+   }
+   err.MsgWrite(0, L"Directory times set=%ld in %ldms", nQueued, GetTickCount() - tStart);
+
+   free(queue);
+   queue = NULL;
+   nQueued = nAlloc = 0;
+}
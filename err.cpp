@@ -6,7 +6,8 @@ Author      -  Tom Bernhardt, Rich Denham
 Created     -  94/08/22
 Description -  Implements the TError class that handles basic exception
                handling, message generation, and logging functions.
-Updates     -
+Updates     -  26/10/19 TPB Count of error level messages.
+               26/10/19 TPB MsgProcess safe to call from several threads.
 ===============================================================================
 */
 
@@ -37,6 +38,7 @@ TError::TError(
 {
    lastError = 0;
    maxError = 0;
+   nErrors = 0;
    logLevel = loglevel;
    dispLevel = displevel;
    logFile = NULL;
@@ -199,6 +201,8 @@ void __stdcall
 {
    static wchar_t    const   prefLetter[] = L"TIWESVUXXXXX";
    wchar_t                   fullmsg[350];
+   int                       level;        // local, as other threads may be here too
+   long                      prevMax;
    struct
    {
       USHORT                 frequency;    // audio frequency
@@ -218,8 +222,13 @@ void __stdcall
    }
    else
    {
-      if ( num > maxError )
-         maxError = num;
+      // interlocked max, so a higher number raised at once isn't lost
+      for ( prevMax = maxError;
+            num > prevMax
+            && InterlockedCompareExchange(&maxError, num, prevMax) != prevMax;
+            prevMax = maxError );
+      if ( level >= 2 )
+         InterlockedIncrement(&nErrors);
       _swprintf(fullmsg, L"%c%05d: %-.245s", prefLetter[level+1], num, str);
    }
 
@@ -6,7 +6,8 @@ Author      -  Tom Bernhardt
 Created     -  94/08/22
 Description -  Implements the TError class that handles basic exception
                handling, message generation, and logging functions.
-Updates     -
+Updates     -  26/10/19 TPB Count of error level messages.
+               26/10/19 TPB MsgProcess safe to call from several threads.
 ===============================================================================
 */
 
@@ -28,13 +29,13 @@ Updates     -
 class TError
 {
 protected:
-   int                       level;
    int                       lastError;
-   int                       maxError;
+   long volatile             maxError;     // raised by any thread, see MsgProcess
    int                       logLevel;     // minimum level to log
    int                       dispLevel;    // minimum level to display
    FILE                    * logFile;
    int                       beepLevel;
+   long volatile             nErrors;      // messages of error level or more
 public:
                         TError(
       int                    displevel = 0,// in -mimimum severity level to display
@@ -88,6 +89,7 @@ public:
    DWORD                LastError() const { return lastError; };
 
    int                  GetMaxSeverityLevel () { return maxError / 10000; }
+   long                 ErrorCount() const { return nErrors; };
 
 };
 
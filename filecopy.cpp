@@ -8,6 +8,19 @@
   Description- Functions to replicate file contents and set some attributes.
 
   Updates -
+  26/10/19 TPB Paths, copy buffer and statistics come from the FileAction so
+               copies and compares can run on pipeline workers.
+  26/10/19 TPB /nocache writes the target unbuffered too.
+  26/10/19 TPB Written targets are closed through the /sync= flusher.
+  26/10/19 TPB Medium sized files copied and compared mapped with /mmap.
+  26/10/19 TPB Files copied in the kernel by CopyFile2 with /kcopy.
+  26/10/19 TPB /xor and /crc transforms staged on worker threads.
+  26/10/19 TPB Copied files queued for /verify read-back.
+  26/10/19 TPB Large files copied by way of a checkpointed part file with
+               /resume.
+  26/10/19 TPB Files opened relative to the walk's open directories.
+  26/10/19 TPB Time and attributes applied through the open target by
+               MetaApply.
 
 ===============================================================================
 */
@@ -17,7 +30,6 @@
 
 #define INT64LOW(x)  ( *((DWORD *)&x)     )
 #define INT64HIGH(x) ( *((LONG  *)&x + 1) )
-#define LARGE_FILE_SIZE (256*1024)
 
 // Converts binary attribute mask to string
 WCHAR * _stdcall
@@ -36,40 +48,164 @@ WCHAR * _stdcall
    return retStr;
 }
 
+// Sets the true end of a target written unbuffered, dropping the zero
+// padding of its last write
+DWORD _stdcall
+   FileEndSet(
+      FileAction const     * action      ,// in -file action
+      HANDLE                 hTgt        ,// in -target file handle
+      __int64                cbFile       // in -true file size
+   )
+{
+   FILE_END_OF_FILE_INFO     eof;
+   DWORD                     rc = 0;
+
+   eof.EndOfFile.QuadPart = cbFile;
+   if ( !SetFileInformationByHandle(hTgt, FileEndOfFileInfo, &eof, sizeof eof) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(30110, rc, L"Truncate(%s,%I64d)=%ld ", action->tgtPath, cbFile, rc);
+   }
+   return rc;
+}
+
+// Returns whether a file is copied and compared memory mapped per /mmap
+static BOOL
+   FileMapUse(
+      __int64                cbFile       // in -file size
+   )
+{
+   return gOptions.global & OPT_GlobalMmap
+      && !(gOptions.global & (OPT_GlobalCopyXOR | OPT_GlobalDigest))  // views are read-only
+      && cbFile >= MMAP_Min  &&  cbFile <= MMAP_Max;
+}
+
+// Writes a block to the target.  An unbuffered target takes only sector
+// multiples so the last write is zero padded and the file truncated after.
+static DWORD
+   FileBlockWrite(
+      HANDLE                 hTgt        ,// in -output file handle
+      BYTE                 * buffer      ,// i/o-block, room for the padding
+      DWORD                  nSrc        ,// in -bytes in block
+      __int64              * cbFile       // i/o-bytes written so far
+   )
+{
+   DWORD                     rc,
+                             nTgt,
+                             cbWrite = nSrc;
+
+   if ( gOptions.global & OPT_GlobalNoCache )
+   {
+      cbWrite = (nSrc + NOCACHE_Align - 1) & ~(NOCACHE_Align - 1);
+      memset(buffer + nSrc, 0, cbWrite - nSrc);
+   }
+   if ( !WriteFile(hTgt, buffer, cbWrite, &nTgt, NULL) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(30103, rc, L"WriteFile(%ld,%ld)=%ld, ", cbWrite, nTgt, rc);
+      return rc;
+   }
+   *cbFile += nSrc;
+   InterlockedExchangeAdd64(&gOptions.bWritten, nSrc);
+   return 0;
+}
+
+// Copies the contents with the transforms on worker threads.  The copy buffer
+// is split in two so that while one half is transformed the other is written
+// and then refilled with the next block.
+static DWORD
+   FileCopyContentsStaged(
+      FileAction const     * action      ,// in -file action
+      HANDLE                 hSrc        ,// in -input file handle
+      HANDLE                 hTgt        ,// in -output file handle
+      XformState           * xform       ,// i/o-file's transform state
+      __int64              * cbFile       // i/o-bytes written
+   )
+{
+   DWORD                     rc = 0,
+                             cbHalf = action->sizeBuffer / 2,
+                             n[2] = { 0, 0 }; // bytes in each half not yet written
+   BYTE                    * half[2] = { action->copyBuffer, action->copyBuffer + cbHalf };
+   XformJob                  job;
+   HANDLE                    evDone;
+   int                       cur = 0;     // half read and to be transformed
+   bool                      written = true; // other half written (or empty)
+
+   if ( !(evDone = CreateEvent(NULL, FALSE, FALSE, NULL)) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(30111, rc, L"CreateEvent(transform)=%ld ", rc);
+      return rc;
+   }
+   if ( !ReadFile(hSrc, half[0], cbHalf, &n[0], NULL) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(40104, rc, L"ReadFile(%s)=%ld ", action->srcPath, rc);
+   }
+
+   while ( !rc  &&  (n[cur]  ||  !written) )
+   {
+      if ( n[cur] )
+         XformSubmit(&job, half[cur], n[cur], xform, evDone);
+      if ( !written )
+      {
+         rc = FileBlockWrite(hTgt, half[1-cur], n[1-cur], cbFile);
+         n[1-cur] = 0;                    // stays empty if a short block was the end-of-file
+         written = true;
+      }
+      if ( n[cur] )
+      {
+         if ( !rc  &&  n[cur] == cbHalf
+           && !ReadFile(hSrc, half[1-cur], cbHalf, &n[1-cur], NULL) )
+         {
+            rc = GetLastError();
+            err.SysMsgWrite(40104, rc, L"ReadFile(%s)=%ld ", action->srcPath, rc);
+         }
+         WaitForSingleObject(evDone, INFINITE);
+         written = false;
+      }
+      cur = 1 - cur;
+   }
+   CloseHandle(evDone);
+   return rc;
+}
+
 // copies the contents of the source file to the target given open file handles
 static DWORD _stdcall
    FileCopyContents(
+      FileAction const     * action      ,// in -file action
       HANDLE                 hSrc        ,// in -input file handle
-      HANDLE                 hTgt         // in -output file handle
+      HANDLE                 hTgt        ,// in -output file handle
+      XformState           * xform        // i/o-file's transform state
    )
 {
    DWORD                     rc = 0,
-                             nSrc,
-                             nTgt;                             ;
-   int                     * i;
-   BOOL                      b;
+                             nSrc;
+   BOOL                      b = TRUE;
+   BYTE                    * buffer = action->copyBuffer;
+   __int64                   cbFile = 0;
 
-   while ( b = ReadFile(hSrc, gOptions.copyBuffer, gOptions.sizeBuffer, &nSrc, NULL) )
+   if ( gOptions.fState & FLAG_Xform )
+      rc = FileCopyContentsStaged(action, hSrc, hTgt, xform, &cbFile);
+   else
    {
-      if ( nSrc == 0 )                    // if end-of-file, break while loop
-         break;
-      if ( gOptions.global & OPT_GlobalCopyXOR )   // complement contents option
-         for ( i = (int *)gOptions.copyBuffer;  (BYTE *)i < gOptions.copyBuffer + nSrc;  i++ )
-            *i = ~*i;                              // one's complement buffer
-
-      if ( !WriteFile(hTgt, gOptions.copyBuffer, nSrc, &nTgt, NULL) )
+      while ( b = ReadFile(hSrc, buffer, action->sizeBuffer, &nSrc, NULL) )
       {
-         rc = GetLastError();
-         err.SysMsgWrite(30103, rc, L"WriteFile(%ld,%ld)=%ld, ", nSrc, nTgt, rc);
-         return rc;
+         if ( nSrc == 0 )                 // if end-of-file, break while loop
+            break;
+         XformApply(buffer, nSrc, xform);
+         if ( rc = FileBlockWrite(hTgt, buffer, nSrc, &cbFile) )
+            return rc;
+         if ( nSrc < action->sizeBuffer ) // check EOF again to avoid unnecessary read
+            break;
       }
-      gOptions.bWritten += nTgt;
-      if ( nSrc < gOptions.sizeBuffer )   // check EOF again to avoid unnecessary read
-         break;
+      if ( !b )
+         if ( rc = GetLastError() )
+            err.SysMsgWrite(40104, rc, L"ReadFile(%s)=%ld ", action->srcPath, rc);
    }
-   if ( !b )
-      if ( rc = GetLastError() )
-         err.SysMsgWrite(40104, rc, L"ReadFile(%s)=%ld ", gOptions.source.path, rc);
+
+   if ( !rc  &&  cbFile & (NOCACHE_Align - 1)  &&  gOptions.global & OPT_GlobalNoCache )
+      rc = FileEndSet(action, hTgt, cbFile);
 
    return rc;
 }
@@ -77,16 +213,26 @@ static DWORD _stdcall
 // Copies file contents
 DWORD _stdcall
    FileCopy(
-      DirEntry const       * srcEntry    ,// in -source directory entry
-      DirEntry const       * tgtEntry     // in -target directory entry
+      FileAction const     * action       // in -file action
    )
 {
+   DirEntry const          * srcEntry = action->srcEntry,
+                           * tgtEntry = action->tgtEntry;
    HANDLE                    hSrc,
                              hTgt;
    DWORD                     rc = 0,
-                             overlapped;
+                             overlapped,
+                             nocache;
    WCHAR                     temp[2][10];
-   BOOL                      compressChange;
+   BOOL                      compressChange,
+                             striped,
+                             mapped,
+                             resumable;
+   XformState                xform;
+   ResumeState               resume;
+   MetaChange                meta;
+   FileAction                part;        // action writing the /resume part file
+   FileAction const        * copyAction = action;
 
    // if file R/O and write R/O option, change to R/W
    if ( tgtEntry )
@@ -96,11 +242,11 @@ DWORD _stdcall
          if ( (tgtEntry->attrFile & FILE_ATTRIBUTE_READONLY  &&  gOptions.global & OPT_GlobalReadOnly)
            || (tgtEntry->attrFile & FILE_ATTRIBUTE_HIDDEN    &&  gOptions.global & OPT_GlobalHidden  ) )
          {
-            if ( !SetFileAttributes(gOptions.target.apipath, FILE_ATTRIBUTE_NORMAL) )
+            if ( !RelSetFileAttributes(action->tgtDir, action->tgtApiPath, FILE_ATTRIBUTE_NORMAL) )
             {
                rc = GetLastError();
                err.SysMsgWrite(20103, rc, L"SetFileAttributes(%s,N)=%ld, ",
-                                          gOptions.target.path, rc);
+                                          action->tgtPath, rc);
                return rc;
             }
          }
@@ -112,47 +258,102 @@ DWORD _stdcall
       }
    }
 
+   // if the source and target compression attribute is different and significant
+   if ( tgtEntry )
+      if ( (srcEntry->attrFile ^ tgtEntry->attrFile) & FILE_ATTRIBUTE_COMPRESSED & gOptions.attrSignif )
+         compressChange = TRUE;
+      else
+         compressChange = FALSE;
+   else
+      if ( srcEntry->attrFile & FILE_ATTRIBUTE_COMPRESSED & gOptions.attrSignif )
+         compressChange = TRUE;
+      else
+         compressChange = FALSE;
+
    // if the file is big and the target not on a network, we'll do unbuffered
    // overlapped I/O via I/O completion ports, so set the open attribute accordingly.
-   if ( srcEntry->cbFile >= LARGE_FILE_SIZE )
+   // What is "big" is adapted to the target volume with /tune.  Huge files
+   // may be striped across several workers, always writing unbuffered.  Small
+   // ones that fit the copy buffer go to the small file engine.  With /mmap
+   // medium ones are written from a view of the source instead.  A /crc
+   // or /verify must see the blocks in order, so it keeps the rest sequential.
+   // Those copied resumably are checkpointed by the overlapped engine.
+   resumable = gOptions.global & OPT_GlobalResume  &&  srcEntry->cbFile >= RESUME_Min
+            && !(gOptions.global & OPT_GlobalDigest);
+   striped = gOptions.nStripe > 1  &&  srcEntry->cbFile >= gOptions.cbStripeMin
+          && !(gOptions.global & OPT_GlobalDigest)  &&  !resumable;
+
+   // /kcopy leaves the data to the system's copy engine unless the bytes
+   // themselves must be transformed
+   if ( gOptions.global & OPT_GlobalKernelCopy
+     && !(gOptions.global & (OPT_GlobalCopyXOR | OPT_GlobalDigest))
+     && !striped  &&  !compressChange )
+      return FileCopyKernel(action);
+
+   mapped  = !striped  &&  !resumable  &&  FileMapUse(srcEntry->cbFile);
+   if ( !striped  &&  !mapped  &&  !compressChange
+     && srcEntry->cbFile < gOptions.target.tune.cbLargeFile
+     && srcEntry->cbFile < action->sizeBuffer )
+      return FileCopySmall(action);
+   if ( !mapped  &&  !(gOptions.global & OPT_GlobalDigest)
+     && (srcEntry->cbFile >= gOptions.target.tune.cbLargeFile  ||  striped  ||  resumable) )
    {
       overlapped = FILE_FLAG_OVERLAPPED;
-      if ( gOptions.target.bUNC )
+      if ( gOptions.target.bUNC  ||  striped )
          overlapped |= FILE_FLAG_NO_BUFFERING;
    }
    else
       overlapped = 0;
-   hSrc = CreateFile(gOptions.source.apipath,
-                     GENERIC_READ,
-                     FILE_SHARE_READ | FILE_SHARE_WRITE,
-                     NULL, OPEN_EXISTING,
-                     FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_NO_BUFFERING | overlapped,
-                     0);
+   // the source is read unbuffered unless mapped; /nocache writes the target so too
+   nocache = gOptions.global & OPT_GlobalNoCache ? FILE_FLAG_NO_BUFFERING : 0;
+   hSrc = RelCreateFile(action->srcDir, action->srcApiPath,
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | overlapped
+                        | (mapped ? 0 : FILE_FLAG_NO_BUFFERING));
    if ( hSrc == INVALID_HANDLE_VALUE )
    {
       rc = GetLastError();
       if ( rc == ERROR_SHARING_VIOLATION )
-         err.MsgWrite(20101, L"Source file in use %s", gOptions.source.path );
+         err.MsgWrite(20101, L"Source file in use %s", action->srcPath );
       else
-         err.SysMsgWrite(40101, rc, L"OpenR(%s)=%ld, ", gOptions.source.apipath, rc);
+         err.SysMsgWrite(40101, rc, L"OpenR(%s)=%ld, ", action->srcApiPath, rc);
       return rc;
    }
 
-   hTgt = CreateFile(gOptions.target.apipath,
-                     GENERIC_WRITE | GENERIC_READ, FILE_SHARE_READ,
-                     NULL,
-                     CREATE_ALWAYS,
-                     FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | overlapped,
-                     0);
+   // a resumable copy writes a part file, carrying on with it if checkpointed
+   if ( resumable )
+   {
+      if ( rc = ResumeBegin(action, &resume) )
+      {
+         CloseHandle(hSrc);
+         return rc;
+      }
+      part = *action;
+      part.tgtApiPath = resume.partApiPath;
+      part.tgtPath    = resume.partApiPath + (action->tgtPath - action->tgtApiPath);
+      copyAction = &part;
+   }
+
+   hTgt = RelCreateFile(copyAction->tgtDir, copyAction->tgtApiPath,
+                        GENERIC_WRITE | GENERIC_READ, FILE_SHARE_READ,
+                        resumable  &&  resume.cbDone ? OPEN_EXISTING : CREATE_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | overlapped | nocache);
    if ( hTgt == INVALID_HANDLE_VALUE )
    {
+      if ( resumable )
+      {
+         free(resume.partApiPath);
+         free(resume.ckptApiPath);
+      }
       rc = GetLastError();
       if ( rc == ERROR_SHARING_VIOLATION )
-         err.MsgWrite(20101, L"Target file in use %s", gOptions.target.path );
+         err.MsgWrite(20101, L"Target file in use %s", action->tgtPath );
       else
       {
          err.SysMsgWrite(40102, rc, L"OpenW(%s)=%ld (attr S/T=%s/%s,%x/%x), ",
-                                    gOptions.target.path,
+                                    action->tgtPath,
                                     rc,
                                     srcEntry ? AttrStr(srcEntry->attrFile, temp[0]) : L"-",
                                     tgtEntry ? AttrStr(tgtEntry->attrFile, temp[1]) : L"-",
@@ -163,50 +364,54 @@ DWORD _stdcall
       return rc;
    }
 
-   // if the source and target compression attribute is different and significant
-   if ( tgtEntry )
-      if ( (srcEntry->attrFile ^ tgtEntry->attrFile) & FILE_ATTRIBUTE_COMPRESSED & gOptions.attrSignif )
-         compressChange = TRUE;
-      else
-         compressChange = FALSE;
-   else
-      if ( srcEntry->attrFile & FILE_ATTRIBUTE_COMPRESSED & gOptions.attrSignif )
-         compressChange = TRUE;
-      else
-         compressChange = FALSE;
+   XformInit(&xform);
    if ( compressChange )
    {
-      CompressionSet(hSrc, hTgt, srcEntry->attrFile);
+      // both handles are open; read-only goes with the attributes at the end
+      CompressionSet(hSrc, hTgt, srcEntry->attrFile & ~FILE_ATTRIBUTE_READONLY,
+                     action->srcApiPath, action->tgtApiPath);
    }
 
-   if ( overlapped )
-      rc = FileCopyContentsOverlapped(hSrc, &hTgt);
-   else
-      rc = FileCopyContents(hSrc, hTgt);
+   if ( striped )
+      rc = FileCopyStriped(action, hSrc, hTgt);
+   else if ( overlapped )
+      rc = FileCopyContentsOverlapped(copyAction, hSrc, &hTgt, resumable ? &resume : NULL);
+   else if ( mapped )
+      rc = FileCopyMapped(action, hSrc, hTgt);
+   else if ( !(rc = FileCopyContents(action, hSrc, hTgt, &xform)) )
+      XformReport(action, &xform);
    if ( rc )
       err.SysMsgWrite(104, rc, L"FileCopyContents%s(%s), ",
-                               (overlapped ? L"Overlapped" : L""),
-                               gOptions.target.path);
+                               (striped ? L"Striped" : overlapped ? L"Overlapped"
+                                        : mapped ? L"Mapped" : L""),
+                               action->tgtPath);
    CloseHandle(hSrc);
 
-   if ( !SetFileTime(hTgt, NULL, NULL, &srcEntry->ftimeLastWrite) )
+   // the time and attributes through the open target; a part file isn't
+   // made read-only before it is renamed, so it gets them after
+   meta.attr           = srcEntry->attrFile;
+   meta.ftimeLastWrite = srcEntry->ftimeLastWrite;
+   meta.srcApiPath     = action->srcApiPath;
+   meta.fields         = META_Time;
+   if ( gOptions.file.attr & OPT_PropActionUpdate  &&  !resumable )
+      meta.fields |= META_Attr;
+   MetaApply(hTgt, &meta, copyAction->tgtApiPath, action->tgtPath);
+
+   if ( resumable )
+      rc = ResumeEnd(action, &resume, hTgt, rc);
+   else if ( rc )
+      CloseHandle(hTgt);
+   else
    {
-      rc = GetLastError();
-      err.SysMsgWrite(40110, rc, L"SetFileTime(%s,%02lX)=%ld ",
-                             gOptions.target.path, srcEntry->attrFile, rc);
-      rc = 0;
+      FlushFileClose(action, hTgt);
+      VerifyQueue(action, &xform);        // /verify keeps to the sequential copy
    }
 
-   CloseHandle(hTgt);
-
-   if ( gOptions.file.attr & OPT_PropActionUpdate )
-      if ( !SetFileAttributes(gOptions.target.apipath, srcEntry->attrFile) )
-      {
-         rc = GetLastError();
-         err.SysMsgWrite(20109, rc, L"SetFileAttributes(%s)=%d ",
-                                     gOptions.target.path, rc);
-         return rc;
-      }
+   if ( resumable  &&  !rc  &&  gOptions.file.attr & OPT_PropActionUpdate )
+   {
+      meta.fields = META_Attr;
+      rc = MetaSet(action->tgtDir, &meta, action->tgtApiPath, action->tgtPath);
+   }
 
    return rc;
 }
@@ -215,58 +420,58 @@ DWORD _stdcall
 // Compares file contents on a byte by byte basis
 DWORD _stdcall
    FileContentsCompare(
+      FileAction const     * action       // in -file action
    )
 {
    HANDLE                    hSrc,
                              hTgt;
    DWORD                     rcSrc = 0,
                              rcTgt = 0,
-                             b2 = gOptions.sizeBuffer >> 1, // split buffer
+                             b2 = action->sizeBuffer >> 1, // split buffer
                              cmp = 0,
                              nSrc,
                              nTgt;
    BYTE                    * s,        // source and target for 1's comp compare
                            * t;
    BOOL                      bSrc, bTgt;
+   BYTE                    * buffer = action->copyBuffer;
 
+   if ( FileMapUse(action->srcEntry->cbFile) )
+      return FileContentsCompareMapped(action);
 
-   err.MsgWrite(0, L"Fc %s", gOptions.target.path);
-   hSrc = CreateFile(gOptions.source.apipath,
-                     GENERIC_READ,
-                     FILE_SHARE_READ | FILE_SHARE_WRITE,
-                     NULL,
-                     OPEN_EXISTING,
-                     FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_NO_BUFFERING,
-                     0);
+   err.MsgWrite(0, L"Fc %s", action->tgtPath);
+   hSrc = RelCreateFile(action->srcDir, action->srcApiPath,
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_NO_BUFFERING);
    if ( hSrc == INVALID_HANDLE_VALUE)
    {
       rcSrc = GetLastError();
       if ( rcSrc == ERROR_SHARING_VIOLATION )
-         err.MsgWrite(20101, L"Source file in use %s", gOptions.source.path);
+         err.MsgWrite(20101, L"Source file in use %s", action->srcPath);
       else
-         err.SysMsgWrite(40101, rcSrc, L"OpenRs(%s)=%d ", gOptions.source.path, rcSrc);
+         err.SysMsgWrite(40101, rcSrc, L"OpenRs(%s)=%d ", action->srcPath, rcSrc);
       return rcSrc;
    }
 
-   hTgt = CreateFile(gOptions.target.apipath,
-                     GENERIC_READ,
-                     FILE_SHARE_READ | FILE_SHARE_WRITE,
-                     NULL,
-                     OPEN_EXISTING,
-                     FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_NO_BUFFERING,
-                     0);
+   hTgt = RelCreateFile(action->tgtDir, action->tgtApiPath,
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_NO_BUFFERING);
    if ( hTgt == INVALID_HANDLE_VALUE)
    {
       rcTgt = GetLastError();
       if ( rcTgt == ERROR_SHARING_VIOLATION )
-         err.MsgWrite(20101, L"Target file in use %s", gOptions.target.path);
+         err.MsgWrite(20101, L"Target file in use %s", action->tgtPath);
       else
-         err.SysMsgWrite(40101, rcTgt, L"OpenRt(%s)=%d, ", gOptions.target.path, rcTgt);
+         err.SysMsgWrite(40101, rcTgt, L"OpenRt(%s)=%d, ", action->tgtPath, rcTgt);
       return rcTgt;
    }
 
-   while ( (bSrc = ReadFile(hSrc, gOptions.copyBuffer   , b2, &nSrc, NULL))
-        && (bTgt = ReadFile(hTgt, gOptions.copyBuffer+b2, b2, &nTgt, NULL)) )
+   while ( (bSrc = ReadFile(hSrc, buffer   , b2, &nSrc, NULL))
+        && (bTgt = ReadFile(hTgt, buffer+b2, b2, &nTgt, NULL)) )
    {
       if ( nSrc != nTgt )   // this should never occur but check just in case
       {
@@ -275,8 +480,8 @@ DWORD _stdcall
       }
       if ( gOptions.global & OPT_GlobalCopyXOR )   // complement contents option
       {
-         for ( s = gOptions.copyBuffer, t = gOptions.copyBuffer + b2;
-               s < gOptions.copyBuffer + nSrc;
+         for ( s = buffer, t = buffer + b2;
+               s < buffer + nSrc;
                s++, t++ )
          {
             if ( *s != (byte)~*t )
@@ -288,7 +493,7 @@ DWORD _stdcall
          if ( cmp )
             break;
       }
-      else if ( cmp = memcmp(gOptions.copyBuffer, gOptions.copyBuffer + b2, nSrc) )
+      else if ( cmp = memcmp(buffer, buffer + b2, nSrc) )
          break;
 
       if ( nSrc < b2 )                 // don't issue read just to get EOF
@@ -306,7 +511,7 @@ DWORD _stdcall
 
    if ( rcSrc = max(rcSrc, rcTgt) )
       err.SysMsgWrite(40104, rcSrc, L"ReadFile(%s)=%d",
-          (rcTgt ? gOptions.target.path : gOptions.source.path), rcSrc );
+          (rcTgt ? action->tgtPath : action->srcPath), rcSrc );
 
    return max(cmp, rcSrc);
 }
@@ -466,7 +671,7 @@ DWORD _stdcall
       attr = FILE_ATTRIBUTE_COMPRESSED & gOptions.attrSignif & srcEntry->attrFile;
    if ( attr )
    {
-      CompressionSet(hSrc, hTgt, srcEntry->attrFile);
+      CompressionSet(hSrc, hTgt, srcEntry->attrFile, gOptions.source.apipath, gOptions.target.apipath);
    }
 
    if ( rc = FileBackupContents(hSrc, hTgt) )
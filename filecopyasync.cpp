@@ -10,6 +10,14 @@
                only called with larger files while small ones are still
                handled via buffered and non-overlapped I/O calls.
   Updates -
+  26/10/19 TPB Block size and number of outstanding I/Os come from the
+               target volume's IoTune and the achieved throughput and
+               per-I/O latency are fed back to it.
+  26/10/19 TPB Paths and copy buffer come from the FileAction.
+  26/10/19 TPB With /nocache the buffered last block is written through.
+  26/10/19 TPB /xor applied to blocks as they're read, which it never was.
+  26/10/19 TPB May start part way into the file and checkpoint its progress
+               for /resume.
 
 ===============================================================================
 */
@@ -23,13 +31,13 @@ static DWORD const ReadKey = 0;
 static DWORD const WriteKey = 1;
 static DWORD const pageSize = 4096;
 
-#define COPY_BUFFER_SIZE (32 * 1024)  // normal I/O block size
-#define Buffer(n) (gOptions.copyBuffer + n * COPY_BUFFER_SIZE)
+#define Buffer(n) (action->copyBuffer + (n) * cbBlock)
 
 struct IOControl  // Extended overlapped struct to contain buffer index
 {
    OVERLAPPED                ov;
    int                       nBuff;
+   LARGE_INTEGER             tIssue;      // time I/O was issued for latency
 };
 
 // Copies the contents of the source file to the target given open file handles
@@ -38,18 +46,23 @@ struct IOControl  // Extended overlapped struct to contain buffer index
 // non-page-size multiple block.
 DWORD _stdcall
    FileCopyContentsOverlapped(
+      FileAction const     * action      ,// in -file action
       HANDLE                 hSrc        ,// in -source file handle
-      HANDLE               * hTgt         // i/o-target file handle
+      HANDLE               * hTgt        ,// i/o-target file handle
+      ResumeState          * resume       // i/o-/resume checkpoint state, NULL if none
    )
 {
    DWORD                     rc = 0,
                              nBytes;
    ULONG_PTR                 key;
    BOOL                      success;
-   int                       nBuffer = gOptions.sizeBuffer / COPY_BUFFER_SIZE,
+   DWORD                     cbBlock,     // I/O block size
+                             nDepth;      // I/Os outstanding
+   int                       nBuffer,
+                             nStarted,    // buffers given I/Os
                              nPendingIO = 0,
                              n;
-   IOControl               * ioControl = (IOControl *)_alloca(nBuffer * sizeof (IOControl));
+   IOControl               * ioControl;
    HANDLE                    ioPort;      // I/O completion port handle
    ULARGE_INTEGER            readPointer,
                              tgtSize;
@@ -57,6 +70,17 @@ DWORD _stdcall
                            * lastIO = NULL;
 // DWORD                     s = GetTickCount();
    ULARGE_INTEGER            cbFile;
+   LARGE_INTEGER             tStart,      // tuning measurements
+                             tNow;
+   __int64                   ticksLatency = 0;
+   DWORD                     nIO = 0;
+   __int64                   cbDone,      // written with nothing outstanding before it
+                             cbResumed = resume ? resume->cbDone : 0; // copied by an earlier run
+
+   IoTuneGet(&gOptions.target.tune, &cbBlock, &nDepth);
+   nBuffer = min(nDepth, action->sizeBuffer / cbBlock);
+   ioControl = (IOControl *)_alloca(nBuffer * sizeof (IOControl));
+   QueryPerformanceCounter(&tStart);
 
    // Get file size again since it might have changed since directory scan
    cbFile.LowPart = GetFileSize(hSrc, &cbFile.HighPart);
@@ -112,19 +136,21 @@ DWORD _stdcall
       return rc;
    }
 
-   // kick off enough reads to fill the buffer and get things going
-   for ( readPointer.QuadPart = 0, n = 0;
+   // kick off enough reads to fill the buffer and get things going, from
+   // where a resumed copy left off
+   for ( readPointer.QuadPart = cbResumed, n = 0;
          n < nBuffer  &&  readPointer.QuadPart < cbFile.QuadPart;
-         readPointer.QuadPart += COPY_BUFFER_SIZE, n++ )
+         readPointer.QuadPart += cbBlock, n++ )
    {
       ioControl[n].nBuff = n;
       ioControl[n].ov.Offset = readPointer.LowPart;
       ioControl[n].ov.OffsetHigh = readPointer.HighPart;
       ioControl[n].ov.hEvent = NULL; // not needed
+      QueryPerformanceCounter(&ioControl[n].tIssue);
 
       success = ReadFile(hSrc,
                          Buffer(n),
-                         COPY_BUFFER_SIZE,
+                         cbBlock,
                          &nBytes,
                          &ioControl[n].ov);
       if ( !success )
@@ -140,6 +166,7 @@ DWORD _stdcall
 
       ++nPendingIO;
    }
+   nStarted = n;
 
    // We have started the initial async. reads, enter the main loop.
    // This simply waits until an I/O completes, then issues the next
@@ -171,18 +198,24 @@ DWORD _stdcall
          }
       }
 
+      QueryPerformanceCounter(&tNow);
+      ticksLatency += tNow.QuadPart - ioCompleted->tIssue.QuadPart;
+      nIO++;
+
       if ( key == ReadKey )
       {
+         XformApply(Buffer(ioCompleted->nBuff), nBytes, NULL);  // position independent only
          // If the bytes read is less than that requested, it is the last block.
          // If the target of the last block is a UNC, we want to write it buffered
          // because unbuffered mode requires full block writes.
-         if ( nBytes < COPY_BUFFER_SIZE  &&  !gOptions.target.bUNC )
+         if ( nBytes < cbBlock  &&  !gOptions.target.bUNC )
          {
             lastIO =  ioCompleted;
             nPendingIO--;
          }
          else
          {
+            ioCompleted->tIssue = tNow;
             success = WriteFile(*hTgt,
                                 Buffer(ioCompleted->nBuff),
                                 nBytes,
@@ -199,12 +232,13 @@ DWORD _stdcall
       }
       else if ( key == WriteKey )
       {
-         gOptions.bWritten += nBytes;
+         InterlockedExchangeAdd64(&gOptions.bWritten, nBytes);
          if ( readPointer.QuadPart < cbFile.QuadPart )
          {
             // More data in the file, issue next read
             ioCompleted->ov.Offset = readPointer.LowPart;
             ioCompleted->ov.OffsetHigh = readPointer.HighPart;
+            ioCompleted->tIssue = tNow;
             success = ReadFile(hSrc,
                                Buffer(ioCompleted->nBuff),
                                nBytes,
@@ -217,13 +251,22 @@ DWORD _stdcall
                             INT64R(ioControl->ov.Offset,ioControl->ov.OffsetHigh), rc);
                return rc;
             }
-            readPointer.QuadPart += COPY_BUFFER_SIZE;
+            readPointer.QuadPart += cbBlock;
          }
          else
          {
             // No more reads left to issue, just wait for pending writes to drain
             --nPendingIO;
          }
+
+         // everything before the lowest block any buffer still holds is
+         // written, though maybe not in order; checkpoint it periodically
+         if ( resume )
+         {
+            for ( cbDone = readPointer.QuadPart, n = 0;  n < nStarted;  n++ )
+               cbDone = min(cbDone, INT64R(ioControl[n].ov.Offset, ioControl[n].ov.OffsetHigh));
+            ResumeCheckpoint(action, resume, *hTgt, cbDone);
+         }
       }
    }
    CloseHandle(ioPort);
@@ -232,15 +275,16 @@ DWORD _stdcall
    // when the target is unbuffered because unbuffered I/O requires sector-size
    // writes and this last I/O is smaller.  The file is opened in buffered mode,
    // positioned to the end and the last non-sector-sized block is written.
+   // With /nocache it is written through so as not to be left in the cache.
    if ( lastIO )
    {
       CloseHandle(*hTgt);
-      *hTgt = CreateFile(gOptions.target.apipath,
+      *hTgt = CreateFile(action->tgtApiPath,
                         GENERIC_WRITE | GENERIC_READ,
                         FILE_SHARE_READ | FILE_SHARE_WRITE,
                         NULL,
                         OPEN_EXISTING,
-                        0,
+                        gOptions.global & OPT_GlobalNoCache ? FILE_FLAG_WRITE_THROUGH : 0,
                         NULL);
       if ( *hTgt == INVALID_HANDLE_VALUE )
       {
@@ -261,19 +305,25 @@ DWORD _stdcall
             err.SysMsgWrite(30108, rc, L"Truncate SetFilePointer=%ld", rc);
       }
 
+      // a resumed copy's blocks aren't necessarily aligned to this run's size
       rc = 0;
       if ( !WriteFile(*hTgt,
                       Buffer(lastIO->nBuff),
-                      cbFile.LowPart & ~-(long)COPY_BUFFER_SIZE,
+                      (DWORD)(cbFile.QuadPart - INT64R(lastIO->ov.Offset, lastIO->ov.OffsetHigh)),
                       &nBytes,
                       NULL) )
       {
          rc = GetLastError();
          err.SysMsgWrite(30109, rc, L"Last Write(%s)=%ld ",
-                                    gOptions.target.path, rc);
+                                    action->tgtPath, rc);
       }
-      gOptions.bWritten += nBytes;
+      InterlockedExchangeAdd64(&gOptions.bWritten, nBytes);
    }
+
+   QueryPerformanceCounter(&tNow);
+   // only what this run moved counts toward the throughput
+   IoTuneSample(&gOptions.target.tune, cbFile.QuadPart - cbResumed, tNow.QuadPart - tStart.QuadPart,
+                ticksLatency, nIO);
 // err.MsgWrite(1, "%.2fMB/sec (%s)",
 //        (float)((__int64)tgtSize.QuadPart) / 1000 / (float)(GetTickCount()-s),
 //        gOptions.target.path);
@@ -0,0 +1,122 @@
+/*
+===============================================================================
+
+  Program    - FileCopyKernel
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Copies a file with /kcopy through the system's own copy engine
+               (CopyFile2) so the data moves from source to target entirely
+               in the kernel rather than through the copy buffer.  Between
+               SMB shares on the same server, or volumes that support
+               offloaded data transfer, the data doesn't even pass through
+               this machine.
+
+               CopyFile2 creates the target itself with the source's last
+               write time, attributes and alternate data streams.  NetDitto's
+               attribute action is applied afterwards as with the other copy
+               engines.  Transforms that need the bytes in user space, like
+               /xor, and compression changes stay on the buffered engines.
+  Updates -
+  26/10/19 TPB Large files copied restartably with /resume.
+
+===============================================================================
+*/
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+struct KernelCopy                         // progress callback context
+{
+   __int64                   cbDone;      // bytes counted in bWritten so far
+};
+
+
+// Counts the bytes copied for the statistics display and cancels the copy
+// at shutdown
+static COPYFILE2_MESSAGE_ACTION CALLBACK
+   FileCopyKernelProgress(
+      COPYFILE2_MESSAGE const * msg      ,// in -progress message
+      void                 * context      // i/o-KernelCopy
+   )
+{
+   KernelCopy              * copy = (KernelCopy *)context;
+   __int64                   cbDone;
+
+   if ( msg->Type == COPYFILE2_CALLBACK_CHUNK_FINISHED )
+   {
+      cbDone = msg->Info.ChunkFinished.uliTotalBytesTransferred.QuadPart;
+      InterlockedExchangeAdd64(&gOptions.bWritten, cbDone - copy->cbDone);
+      copy->cbDone = cbDone;
+   }
+   if ( gOptions.fState & FLAG_Shutdown )
+      return COPYFILE2_PROGRESS_CANCEL;
+   return COPYFILE2_PROGRESS_CONTINUE;
+}
+
+
+// Copies a file with CopyFile2.  The caller has already made a read-only
+// target writable if the options allow it.
+DWORD _stdcall
+   FileCopyKernel(
+      FileAction const     * action       // in -file action
+   )
+{
+   DirEntry const          * srcEntry = action->srcEntry;
+   COPYFILE2_EXTENDED_PARAMETERS parms;
+   KernelCopy                copy;
+   HANDLE                    hTgt;
+   HRESULT                   hr;
+   DWORD                     rc = 0;
+
+   memset(&parms, 0, sizeof parms);
+   parms.dwSize             = sizeof parms;
+   parms.dwCopyFlags        = gOptions.global & OPT_GlobalNoCache ? COPY_FILE_NO_BUFFERING : 0;
+   if ( gOptions.global & OPT_GlobalResume  &&  srcEntry->cbFile >= RESUME_Min )
+      parms.dwCopyFlags    |= COPY_FILE_RESTARTABLE;  // the system's own checkpoints
+   parms.pProgressRoutine   = FileCopyKernelProgress;
+   parms.pvCallbackContext  = &copy;
+   copy.cbDone = 0;
+
+   hr = CopyFile2(action->srcApiPath, action->tgtApiPath, &parms);
+   if ( FAILED(hr) )
+   {
+      rc = HRESULT_FACILITY(hr) == FACILITY_WIN32 ? HRESULT_CODE(hr) : hr;
+      if ( rc == ERROR_SHARING_VIOLATION )
+         err.MsgWrite(20101, L"Source or target file in use %s", action->tgtPath);
+      else
+         err.SysMsgWrite(30501, rc, L"CopyFile2(%s)=%lx ", action->tgtPath, hr);
+      return rc;
+   }
+
+   // CopyFile2 leaves no handle to flush, so /sync= gets one of its own,
+   // the read-only attribute that came along first cleared to open for write
+   if ( gOptions.fState & FLAG_Flush )
+   {
+      if ( srcEntry->attrFile & FILE_ATTRIBUTE_READONLY )
+         SetFileAttributes(action->tgtApiPath, FILE_ATTRIBUTE_NORMAL);
+      hTgt = CreateFile(action->tgtApiPath,
+                        GENERIC_WRITE, FILE_SHARE_READ,
+                        NULL, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL,
+                        0);
+      if ( hTgt == INVALID_HANDLE_VALUE )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(20502, rc, L"OpenFlush(%s)=%ld ", action->tgtPath, rc);
+         rc = 0;
+      }
+      else
+         FlushFileClose(action, hTgt);
+   }
+
+   // the source's attributes came along; take them back if not wanted
+   if ( !SetFileAttributes(action->tgtApiPath,
+                           gOptions.file.attr & OPT_PropActionUpdate
+                           ? srcEntry->attrFile : FILE_ATTRIBUTE_NORMAL) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(20109, rc, L"SetFileAttributes(%s)=%d ", action->tgtPath, rc);
+   }
+   return rc;
+}
@@ -0,0 +1,189 @@
+/*
+===============================================================================
+
+  Program    - FileCopySmall
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Copies small files, the bulk of most trees, with as few system
+               calls as possible.  The general FileCopy path loops on reads
+               and writes, sets the time on the handle and then sets the
+               attributes by path after closing it, which costs another full
+               path lookup per file.  Here the whole file is read with one
+               read into the reusable copy buffer, the source handle is
+               closed before the target is even opened, the contents are
+               written with one write and the last write time and the
+               attributes are applied together with one call on the open
+               target handle.  Empty files skip the read and write entirely.
+  Updates -
+  26/10/19 TPB Use the contents from the /prefetch cache when present.
+  26/10/19 TPB /nocache writes the target unbuffered too.
+  26/10/19 TPB Written targets are closed through the /sync= flusher.
+  26/10/19 TPB /xor and /crc through XformApply.
+  26/10/19 TPB Copied files queued for /verify read-back.
+  26/10/19 TPB Files opened relative to the walk's open directories.
+  26/10/19 TPB Time and attributes applied by MetaApply.
+
+===============================================================================
+*/
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+#define SMALL_Align          4096        // unbuffered read size multiple
+
+// Copies a file smaller than the copy buffer.  The caller has already made
+// a read-only target writable if the options allow it.
+DWORD _stdcall
+   FileCopySmall(
+      FileAction const     * action       // in -file action
+   )
+{
+   DirEntry const          * srcEntry = action->srcEntry,
+                           * tgtEntry = action->tgtEntry;
+   HANDLE                    hSrc,
+                             hTgt;
+   DWORD                     rc = 0,
+                             cbRead,
+                             cbWrite,
+                             nSrc = 0,
+                             nTgt;
+   __int64                   cbFile = 0;
+   MetaChange                meta;
+   WCHAR                     temp[2][10];
+   BYTE                    * buffer = action->copyBuffer;
+   PrefetchEntry           * prefetch;
+   XformState                xform;
+
+   // contents already read ahead need no source open or read at all; the
+   // read size is one more than the data so that it reads as end-of-file
+   if ( prefetch = PrefetchTake(action->srcApiPath, &buffer, &nSrc) )
+   {
+      hSrc   = INVALID_HANDLE_VALUE;
+      cbRead = nSrc + 1;
+   }
+   else
+   {
+      hSrc = RelCreateFile(action->srcDir, action->srcApiPath,
+                           GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING);
+      if ( hSrc == INVALID_HANDLE_VALUE )
+      {
+         rc = GetLastError();
+         if ( rc == ERROR_SHARING_VIOLATION )
+            err.MsgWrite(20101, L"Source file in use %s", action->srcPath );
+         else
+            err.SysMsgWrite(40101, rc, L"OpenR(%s)=%ld, ", action->srcApiPath, rc);
+         return rc;
+      }
+
+      // Read one sector beyond the size from the scan so that a short read
+      // is the end-of-file and no second read is needed to find it.  A full
+      // read means the file grew since the scan and is finished below.
+      cbRead = min((DWORD)((srcEntry->cbFile + SMALL_Align) & ~(SMALL_Align - 1)),
+                   action->sizeBuffer);
+      if ( !ReadFile(hSrc, buffer, cbRead, &nSrc, NULL) )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(40104, rc, L"ReadFile(%s)=%ld ", action->srcPath, rc);
+         CloseHandle(hSrc);
+         return rc;
+      }
+      if ( nSrc < cbRead )
+      {
+         CloseHandle(hSrc);
+         hSrc = INVALID_HANDLE_VALUE;
+      }
+   }
+
+   hTgt = RelCreateFile(action->tgtDir, action->tgtApiPath,
+                        GENERIC_WRITE | GENERIC_READ, FILE_SHARE_READ,
+                        CREATE_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL
+                        | (gOptions.global & OPT_GlobalNoCache ? FILE_FLAG_NO_BUFFERING : 0));
+   if ( hTgt == INVALID_HANDLE_VALUE )
+   {
+      rc = GetLastError();
+      if ( rc == ERROR_SHARING_VIOLATION )
+         err.MsgWrite(20101, L"Target file in use %s", action->tgtPath );
+      else
+      {
+         err.SysMsgWrite(40102, rc, L"OpenW(%s)=%ld (attr S/T=%s/%s,%x/%x), ",
+                                    action->tgtPath,
+                                    rc,
+                                    AttrStr(srcEntry->attrFile, temp[0]),
+                                    tgtEntry ? AttrStr(tgtEntry->attrFile, temp[1]) : L"-",
+                                    srcEntry->attrFile,
+                                    tgtEntry ? tgtEntry->attrFile : 0);
+      }
+      if ( hSrc != INVALID_HANDLE_VALUE )
+         CloseHandle(hSrc);
+      if ( prefetch )
+         PrefetchRelease(prefetch);
+      return rc;
+   }
+
+   XformInit(&xform);
+   while ( nSrc )
+   {
+      XformApply(buffer, nSrc, &xform);
+
+      // an unbuffered target takes only sector multiples; the buffer always
+      // has room for the zero padding which is truncated below
+      cbWrite = nSrc;
+      if ( gOptions.global & OPT_GlobalNoCache )
+      {
+         cbWrite = (nSrc + NOCACHE_Align - 1) & ~(NOCACHE_Align - 1);
+         memset(buffer + nSrc, 0, cbWrite - nSrc);
+      }
+      if ( !WriteFile(hTgt, buffer, cbWrite, &nTgt, NULL) )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(30103, rc, L"WriteFile(%ld,%ld)=%ld, ", cbWrite, nTgt, rc);
+         break;
+      }
+      cbFile += nSrc;
+      InterlockedExchangeAdd64(&gOptions.bWritten, nSrc);
+      if ( nSrc < cbRead )                // short read was end-of-file
+         break;
+
+      // file grew since the scan
+      cbRead = action->sizeBuffer;
+      if ( !ReadFile(hSrc, buffer, cbRead, &nSrc, NULL) )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(40104, rc, L"ReadFile(%s)=%ld ", action->srcPath, rc);
+         break;
+      }
+   }
+   if ( hSrc != INVALID_HANDLE_VALUE )
+      CloseHandle(hSrc);
+   if ( !rc  &&  cbFile & (NOCACHE_Align - 1)  &&  gOptions.global & OPT_GlobalNoCache )
+      rc = FileEndSet(action, hTgt, cbFile);
+   if ( rc )
+      err.SysMsgWrite(104, rc, L"FileCopyContentsSmall(%s), ", action->tgtPath);
+   else
+      XformReport(action, &xform);
+
+   // last write time and attributes in one call
+   meta.fields         = META_Time
+                       | (gOptions.file.attr & OPT_PropActionUpdate ? META_Attr : 0);
+   meta.attr           = srcEntry->attrFile;
+   meta.ftimeLastWrite = srcEntry->ftimeLastWrite;
+   meta.srcApiPath     = action->srcApiPath;
+   MetaApply(hTgt, &meta, action->tgtApiPath, action->tgtPath);
+
+   if ( rc )
+      CloseHandle(hTgt);
+   else
+   {
+      FlushFileClose(action, hTgt);
+      VerifyQueue(action, &xform);
+   }
+   if ( prefetch )
+      PrefetchRelease(prefetch);
+
+   return rc;
+}
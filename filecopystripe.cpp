@@ -0,0 +1,242 @@
+/*
+===============================================================================
+
+  Program    - FileCopyStripe
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Copies a single huge file with several worker threads, each
+               moving its own stripe units concurrently through positional
+               (overlapped offset) reads and writes on the shared overlapped
+               source and target handles.  This keeps several streams in
+               flight for striped/parallel file systems and for network
+               targets where one sequential stream can't fill the link.
+
+               The target is pre-sized before the workers start.  Units are
+               handed out in file order from a shared cursor rather than as
+               one fixed range per worker so that writes stay close to the
+               target's valid data length -- NTFS zero-fills the gap in
+               front of any write beyond it, which would serialize the
+               workers behind a huge synchronous zeroing write.
+  Updates -
+  26/10/19 TPB Worker buffers are leased from the buffer pool.
+  26/10/19 TPB /xor through XformApply.
+
+===============================================================================
+*/
+
+#include <process.h>
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+#define STRIPE_Unit          (4*1024*1024) // bytes handed to a worker at a time
+#define STRIPE_Align         4096          // unbuffered write size multiple
+#define STRIPE_MaxWorkers    32            // most concurrent stripe workers
+
+struct StripeCopy                         // state shared by a file's stripe workers
+{
+   FileAction const        * action;      // file being copied
+   HANDLE                    hSrc;        // overlapped source handle
+   HANDLE                    hTgt;        // overlapped target handle
+   __int64                   cbFile;      // source file size
+   LONGLONG volatile         next;        // offset of next unit to hand out
+   LONGLONG volatile         end;         // end of the data written, the target's size
+   LONG volatile             abort;       // set when any worker fails
+};
+
+struct StripeWorker
+{
+   StripeCopy              * copy;        // shared copy state
+   DWORD                     rc;          // worker's completion code
+};
+
+
+// Issues a positional read or write and waits for it to complete
+static DWORD                               // ret-0 or error code
+   StripeIo(
+      BOOL                   bWrite      ,// in -0=read, 1=write
+      HANDLE                 handle      ,// in -overlapped file handle
+      BYTE                 * buffer      ,// i/o-data buffer
+      DWORD                  cbIo        ,// in -bytes to read/write
+      __int64                offset      ,// in -file offset
+      OVERLAPPED           * ov          ,// i/o-overlapped with event
+      DWORD                * nBytes       // out-bytes transferred
+   )
+{
+   BOOL                      b;
+   DWORD                     rc;
+
+   ov->Offset     = (DWORD)offset;
+   ov->OffsetHigh = (DWORD)(offset >> 32);
+   if ( bWrite )
+      b = WriteFile(handle, buffer, cbIo, NULL, ov);
+   else
+      b = ReadFile(handle, buffer, cbIo, NULL, ov);
+   if ( !b  &&  (rc = GetLastError()) != ERROR_IO_PENDING )
+      return rc;
+   if ( !GetOverlappedResult(handle, ov, nBytes, TRUE) )
+      return GetLastError();
+   return 0;
+}
+
+
+// Worker thread that copies stripe units until the file is done or another
+// worker fails
+static unsigned __stdcall
+   StripeWorkerThread(
+      void                 * arg          // i/o-StripeWorker
+   )
+{
+   StripeWorker            * worker = (StripeWorker *)arg;
+   StripeCopy              * copy = worker->copy;
+   BYTE                    * buffer;
+   OVERLAPPED                ov;
+   __int64                   offset,
+                             end;
+   DWORD                     rc = 0,
+                             nRead,
+                             nWrite,
+                             cbWrite;
+
+   memset(&ov, 0, sizeof ov);
+   buffer = BufLease(STRIPE_Unit);
+   ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+   if ( !buffer  ||  !ov.hEvent )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(30301, rc, L"Stripe worker allocation(%s)=%ld ", copy->action->tgtPath, rc);
+   }
+
+   while ( !rc  &&  !copy->abort )
+   {
+      offset = InterlockedExchangeAdd64(&copy->next, STRIPE_Unit);
+      if ( offset >= copy->cbFile )
+         break;
+
+      rc = StripeIo(FALSE, copy->hSrc, buffer, STRIPE_Unit, offset, &ov, &nRead);
+      if ( rc == ERROR_HANDLE_EOF )       // file shrunk since the scan
+      {
+         rc = 0;
+         break;
+      }
+      if ( rc )
+      {
+         err.SysMsgWrite(30302, rc, L"ReadFile(%s,%I64d)=%ld ", copy->action->srcPath, offset, rc);
+         break;
+      }
+      if ( nRead == 0 )                   // file shrunk since the scan
+         break;
+
+      XformApply(buffer, nRead, NULL);    // position independent ones only
+
+      // Only the last unit can be short.  Unbuffered writes must be sector
+      // multiples so it's zero padded here and the file is truncated to the
+      // true size when all the workers are done.
+      cbWrite = (nRead + STRIPE_Align - 1) & ~(STRIPE_Align - 1);
+      memset(buffer + nRead, 0, cbWrite - nRead);
+      if ( rc = StripeIo(TRUE, copy->hTgt, buffer, cbWrite, offset, &ov, &nWrite) )
+      {
+         err.SysMsgWrite(30303, rc, L"WriteFile(%s,%I64d)=%ld ", copy->action->tgtPath, offset, rc);
+         break;
+      }
+      InterlockedExchangeAdd64(&gOptions.bWritten, nRead);
+      for ( end = copy->end;
+            offset + nRead > end
+            && InterlockedCompareExchange64(&copy->end, offset + nRead, end) != end;
+            end = copy->end );
+   }
+
+   if ( rc )
+      InterlockedExchange(&copy->abort, 1);
+   if ( ov.hEvent )
+      CloseHandle(ov.hEvent);
+   BufReturn(buffer);
+   worker->rc = rc;
+   return 0;
+}
+
+
+// Copies the contents of a huge source file to the target with gOptions.nStripe
+// workers.  Both handles must be open with FILE_FLAG_OVERLAPPED.
+DWORD _stdcall
+   FileCopyStriped(
+      FileAction const     * action      ,// in -file action
+      HANDLE                 hSrc        ,// in -overlapped source file handle
+      HANDLE                 hTgt         // in -overlapped target file handle
+   )
+{
+   StripeCopy                copy;
+   StripeWorker              worker[STRIPE_MaxWorkers];
+   HANDLE                    hThread[STRIPE_MaxWorkers];
+   LARGE_INTEGER             cbFile,
+                             cbAlloc;
+   FILE_END_OF_FILE_INFO     eof;
+   DWORD                     rc = 0;
+   int                       nWorker,
+                             n;
+
+   if ( !GetFileSizeEx(hSrc, &cbFile) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(31028, rc, L"GetFileSize=%ld ", rc);
+      return rc;
+   }
+
+   // pre-size the target so the workers all write in place
+   cbAlloc.QuadPart = (cbFile.QuadPart + STRIPE_Align - 1) & ~(__int64)(STRIPE_Align - 1);
+   if ( !SetFilePointerEx(hTgt, cbAlloc, NULL, FILE_BEGIN)  ||  !SetEndOfFile(hTgt) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(30304, rc, L"Stripe extend(%s,%I64d)=%ld ",
+                                 action->tgtPath, cbAlloc.QuadPart, rc);
+      return rc;
+   }
+
+   copy.action = action;
+   copy.hSrc   = hSrc;
+   copy.hTgt   = hTgt;
+   copy.cbFile = cbFile.QuadPart;
+   copy.next   = 0;
+   copy.end    = 0;
+   copy.abort  = 0;
+
+   // no more workers than units
+   nWorker = (int)min((__int64)min(gOptions.nStripe, STRIPE_MaxWorkers),
+                      (cbFile.QuadPart + STRIPE_Unit - 1) / STRIPE_Unit);
+   for ( n = 0;  n < nWorker;  n++ )
+   {
+      worker[n].copy = &copy;
+      worker[n].rc   = 0;
+      hThread[n] = (HANDLE)_beginthreadex(NULL, 0, StripeWorkerThread, &worker[n], 0, NULL);
+      if ( !hThread[n] )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(20305, rc, L"_beginthreadex(StripeWorkerThread)=%ld ", rc);
+         break;
+      }
+   }
+   nWorker = n;                           // any workers started finish the file
+   if ( nWorker == 0 )
+      return rc;
+
+   WaitForMultipleObjects(nWorker, hThread, TRUE, INFINITE);
+   for ( rc = 0, n = 0;  n < nWorker;  n++ )
+   {
+      CloseHandle(hThread[n]);
+      rc = max(rc, worker[n].rc);
+   }
+   if ( rc )
+      return rc;
+
+   // drop the padding of the last unit, and what the source no longer has
+   // if it shrunk since the scan
+   eof.EndOfFile.QuadPart = copy.end;
+   if ( !SetFileInformationByHandle(hTgt, FileEndOfFileInfo, &eof, sizeof eof) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(30306, rc, L"Stripe truncate(%s,%I64d)=%ld ",
+                                 action->tgtPath, copy.end, rc);
+   }
+   return rc;
+}
@@ -0,0 +1,215 @@
+/*
+===============================================================================
+
+  Program    - FileMap
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Memory mapped copy and compare of medium sized files with
+               /mmap.  The read/write loop copies each block from the kernel
+               into the copy buffer and back out again and the compare reads
+               both files into halves of it before comparing.  Here the source
+               is mapped and the target written straight from the view, and
+               a compare maps both files and compares the views, leaving the
+               data moves to the memory manager's paging I/O.  The views are
+               prefetched whole up front, as madvise(WILLNEED) would, so the
+               pages come in as a few large reads rather than page faults.
+
+               A file truncated by someone else while mapped raises an
+               in-page error when the vanished pages are touched, rather
+               than returning a short read.  That is caught with structured
+               exception handling and reported as a read error of the file.
+
+               Not used with /xor since the source view is read-only.
+  Updates -
+  26/10/19 TPB Compared files opened relative to the walk's open directories.
+
+===============================================================================
+*/
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+#define MMAP_Chunk           (1024*1024) // target write size from the view
+
+
+// Maps a whole file read-only and prefetches the view.  Returns NULL with
+// rc set on failure.
+static BYTE const *
+   FileMapView(
+      HANDLE                 hFile       ,// in -file handle open for read
+      WCHAR const          * path        ,// in -path for messages
+      __int64                cbFile      ,// in -file size
+      DWORD                * rc           // out-error code
+   )
+{
+   HANDLE                    hMap;
+   BYTE const              * view;
+   WIN32_MEMORY_RANGE_ENTRY  range;
+
+   *rc = 0;
+   if ( !(hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL)) )
+   {
+      *rc = GetLastError();
+      err.SysMsgWrite(30401, *rc, L"CreateFileMapping(%s)=%ld ", path, *rc);
+      return NULL;
+   }
+   view = (BYTE const *)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+   if ( !view )
+   {
+      *rc = GetLastError();
+      err.SysMsgWrite(30402, *rc, L"MapViewOfFile(%s)=%ld ", path, *rc);
+   }
+   CloseHandle(hMap);                     // the view keeps the mapping
+   if ( view )
+   {
+      // only a hint -- failure just means the pages fault in as touched
+      range.VirtualAddress = (void *)view;
+      range.NumberOfBytes  = (SIZE_T)cbFile;
+      PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+   }
+   return view;
+}
+
+
+// Copies the contents of a medium sized source file by writing the target
+// from a view of the source
+DWORD _stdcall
+   FileCopyMapped(
+      FileAction const     * action      ,// in -file action
+      HANDLE                 hSrc        ,// in -source file handle
+      HANDLE                 hTgt         // in -target file handle
+   )
+{
+   BYTE const              * view;
+   LARGE_INTEGER             cbFile;
+   __int64                   offset;
+   DWORD                     rc = 0,
+                             cbWrite,
+                             nTgt;
+
+   if ( !GetFileSizeEx(hSrc, &cbFile) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(31028, rc, L"GetFileSize=%ld ", rc);
+      return rc;
+   }
+   if ( cbFile.QuadPart == 0 )            // emptied since the scan, can't map
+      return 0;
+   if ( !(view = FileMapView(hSrc, action->srcPath, cbFile.QuadPart, &rc)) )
+      return rc;
+
+   __try
+   {
+      for ( offset = 0;  offset < cbFile.QuadPart;  offset += cbWrite )
+      {
+         cbWrite = (DWORD)min((__int64)MMAP_Chunk, cbFile.QuadPart - offset);
+         // the view is zero filled to the end of its last page, so an
+         // unbuffered target can take the last chunk rounded up
+         if ( gOptions.global & OPT_GlobalNoCache )
+            cbWrite = (cbWrite + NOCACHE_Align - 1) & ~(NOCACHE_Align - 1);
+         if ( !WriteFile(hTgt, view + offset, cbWrite, &nTgt, NULL) )
+         {
+            rc = GetLastError();
+            err.SysMsgWrite(30103, rc, L"WriteFile(%ld,%ld)=%ld, ", cbWrite, nTgt, rc);
+            break;
+         }
+         InterlockedExchangeAdd64(&gOptions.bWritten, min((__int64)nTgt, cbFile.QuadPart - offset));
+      }
+   }
+   __except ( GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER
+                                                            : EXCEPTION_CONTINUE_SEARCH )
+   {
+      rc = ERROR_HANDLE_EOF;
+      err.SysMsgWrite(30403, rc, L"Mapped read(%s) in-page error, file truncated while copied ",
+                             action->srcPath);
+   }
+   UnmapViewOfFile(view);
+
+   if ( !rc  &&  cbFile.QuadPart & (NOCACHE_Align - 1)  &&  gOptions.global & OPT_GlobalNoCache )
+      rc = FileEndSet(action, hTgt, cbFile.QuadPart);
+   return rc;
+}
+
+
+// Compares medium sized file contents by mapping both files.  Returns 0 if
+// the same, 1 if different, otherwise an error code.
+DWORD _stdcall
+   FileContentsCompareMapped(
+      FileAction const     * action       // in -file action
+   )
+{
+   HANDLE                    hSrc,
+                             hTgt;
+   BYTE const              * viewSrc = NULL,
+                           * viewTgt = NULL;
+   LARGE_INTEGER             cbSrc,
+                             cbTgt;
+   DWORD                     rc = 0,
+                             cmp = 0;
+
+   err.MsgWrite(0, L"Fc %s", action->tgtPath);
+   hSrc = RelCreateFile(action->srcDir, action->srcApiPath,
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN);
+   if ( hSrc == INVALID_HANDLE_VALUE)
+   {
+      rc = GetLastError();
+      if ( rc == ERROR_SHARING_VIOLATION )
+         err.MsgWrite(20101, L"Source file in use %s", action->srcPath);
+      else
+         err.SysMsgWrite(40101, rc, L"OpenRs(%s)=%d ", action->srcPath, rc);
+      return rc;
+   }
+
+   hTgt = RelCreateFile(action->tgtDir, action->tgtApiPath,
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN);
+   if ( hTgt == INVALID_HANDLE_VALUE)
+   {
+      rc = GetLastError();
+      if ( rc == ERROR_SHARING_VIOLATION )
+         err.MsgWrite(20101, L"Target file in use %s", action->tgtPath);
+      else
+         err.SysMsgWrite(40101, rc, L"OpenRt(%s)=%d, ", action->tgtPath, rc);
+      CloseHandle(hSrc);
+      return rc;
+   }
+
+   if ( !GetFileSizeEx(hSrc, &cbSrc)  ||  !GetFileSizeEx(hTgt, &cbTgt) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(31028, rc, L"GetFileSize=%ld ", rc);
+   }
+   else if ( cbSrc.QuadPart != cbTgt.QuadPart )
+      cmp = 1;
+   else if ( cbSrc.QuadPart
+          && (viewSrc = FileMapView(hSrc, action->srcPath, cbSrc.QuadPart, &rc))
+          && (viewTgt = FileMapView(hTgt, action->tgtPath, cbTgt.QuadPart, &rc)) )
+   {
+      __try
+      {
+         cmp = memcmp(viewSrc, viewTgt, (size_t)cbSrc.QuadPart) ? 1 : 0;
+      }
+      __except ( GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER
+                                                               : EXCEPTION_CONTINUE_SEARCH )
+      {
+         rc = ERROR_HANDLE_EOF;
+         err.SysMsgWrite(40104, rc, L"Mapped compare(%s) in-page error, file truncated ",
+                                action->tgtPath);
+      }
+   }
+
+   if ( viewSrc )
+      UnmapViewOfFile(viewSrc);
+   if ( viewTgt )
+      UnmapViewOfFile(viewTgt);
+   CloseHandle(hSrc);
+   CloseHandle(hTgt);
+
+   return max(cmp, rc);
+}
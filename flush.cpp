@@ -0,0 +1,467 @@
+/*
+===============================================================================
+
+  Module     - Flush
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Durability of the target per /sync=.  Without it (none), the
+               written files are left to the system's lazy writer and their
+               durability when NetDitto ends is unknown.
+
+               file  - each target file's handle is handed over to a flusher
+                       thread as the copy finishes, rather than closed, and
+                       the flusher flushes and closes it while the copying
+                       goes on.  Each directory written is flushed after its
+                       files so that their entries are durable too.
+               group - the target file handles of a directory are batched and
+                       given to the flusher together with the directory when
+                       the walk leaves it, or sooner when too many handles
+                       are held.  At the end the whole target volume is
+                       flushed where that is allowed (administrators, local
+                       volumes).
+
+               Directories created or renamed have their parent flushed.
+               The open handles held are bounded; the time the copy has to
+               wait for the flusher and the time spent flushing are logged
+               at the end so the cost of each mode is visible.
+
+               FlushFileBuffers is the Win32 fsync/fdatasync and flushing a
+               volume handle is its syncfs.
+  Updates -
+
+===============================================================================
+*/
+
+#include <process.h>
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+#define FLUSH_HandlesMax     1024         // target handles held open at most
+#define FLUSH_GroupMax       256          // batched handles before dispatching
+
+struct FlushItem                          // file or directory to flush
+{
+   FlushItem               * next;
+   HANDLE                    handle;      // open file, NULL for a directory
+   WCHAR                     path[1];     // \\?\ path
+};
+
+struct FlushDir                           // files written in a walk directory
+{
+   FlushDir                * next;
+   void const              * dir;         // directory (walk frame) id
+   FlushItem               * head,        // group batch
+                           * tail;
+   long                      nItem;       // items in batch
+   long                      nFile;       // files written
+};
+
+static FlushItem           * head,        // items for the flusher
+                           * tail;
+static FlushDir            * dirs;        // directories with files written
+static long                  nBatched;    // handles in all group batches
+static bool                  dirFlushOff; // directory flush not supported
+static HANDLE                hThread;
+static TSemaphore          * semQueued;   // items queued for the flusher
+static TSemaphore          * semHandles;  // handles that may still be held
+static TCriticalSection      csFlush;     // serializes the lists
+static LARGE_INTEGER         perfFreq;    // performance counter ticks per second
+
+
+// Allocates an item for a file handle or directory path
+static FlushItem *
+   FlushItemNew(
+      HANDLE                 handle      ,// in -file handle or NULL
+      WCHAR const          * path        ,// in -\\?\ path
+      size_t                 cchPath      // in -path length
+   )
+{
+   FlushItem               * item;
+
+   item = (FlushItem *)malloc(offsetof(FlushItem, path) + (cchPath + 1) * sizeof (WCHAR));
+   if ( !item )
+   {
+      err.MsgWrite(50802, L"Flush item allocation failed (%s)", path);
+      return NULL;
+   }
+   item->next   = NULL;
+   item->handle = handle;
+   wcsncpy(item->path, path, cchPath);
+   item->path[cchPath] = L'\0';
+   return item;
+}
+
+
+// Appends a list of items to the flusher queue
+static void
+   FlushQueue(
+      FlushItem            * first       ,// in -first item
+      FlushItem            * last        ,// in -last item
+      long                   nItem        // in -items in list
+   )
+{
+   csFlush.Enter();
+   if ( tail )
+      tail->next = first;
+   else
+      head = first;
+   tail = last;
+   csFlush.Leave();
+   semQueued->Release(nItem);
+}
+
+
+// Hands a directory's group batch to the flusher.  Must be called under csFlush.
+static void
+   FlushBatchDispatch(
+      FlushDir             * fd           // i/o-directory whose batch is dispatched
+   )
+{
+   if ( !fd->head )
+      return;
+   if ( tail )
+      tail->next = fd->head;
+   else
+      head = fd->head;
+   tail = fd->tail;
+   semQueued->Release(fd->nItem);
+   nBatched -= fd->nItem;
+   fd->head = fd->tail = NULL;
+   fd->nItem = 0;
+}
+
+
+// Returns the record of a walk directory, creating it if needed.  Must be
+// called under csFlush.
+static FlushDir *
+   FlushDirGet(
+      void const           * dir          // in -directory (walk frame) id
+   )
+{
+   FlushDir                * fd;
+
+   for ( fd = dirs;  fd  &&  fd->dir != dir;  fd = fd->next );
+   if ( !fd  &&  (fd = (FlushDir *)malloc(sizeof *fd)) )
+   {
+      memset(fd, 0, sizeof *fd);
+      fd->dir  = dir;
+      fd->next = dirs;
+      dirs     = fd;
+   }
+   return fd;
+}
+
+
+// Flushes a directory's entries
+static void
+   FlushDirPath(
+      WCHAR const          * path         // in -\\?\ directory path
+   )
+{
+   HANDLE                    hDir;
+   DWORD                     rc;
+
+   if ( dirFlushOff )
+      return;
+
+   hDir = CreateFile(path,
+                     GENERIC_WRITE,
+                     FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                     NULL, OPEN_EXISTING,
+                     FILE_FLAG_BACKUP_SEMANTICS,
+                     0);
+   if ( hDir == INVALID_HANDLE_VALUE )
+   {
+      rc = GetLastError();
+      if ( rc != ERROR_FILE_NOT_FOUND  &&  rc != ERROR_PATH_NOT_FOUND )   // since removed
+         err.SysMsgWrite(20801, rc, L"Flush OpenDir(%s)=%ld ",
+                                path + DIM(gOptions.target.apipath), rc);
+      return;
+   }
+   if ( !FlushFileBuffers(hDir) )
+   {
+      // some file systems and redirectors don't flush directories -- say so once
+      rc = GetLastError();
+      err.SysMsgWrite(20802, rc, L"FlushFileBuffers(%s)=%ld, directories not flushed ",
+                             path + DIM(gOptions.target.apipath), rc);
+      dirFlushOff = true;
+   }
+   else
+      gOptions.flush.nDir++;
+   CloseHandle(hDir);
+}
+
+
+// Flusher thread that flushes and closes queued files and flushes queued
+// directories in order until it finds the queue empty
+static unsigned __stdcall
+   FlushThread(
+      void                 * arg          // in -not used
+   )
+{
+   FlushItem               * item;
+   LARGE_INTEGER             t0,
+                             t1;
+   DWORD                     rc;
+
+   for ( ;; )
+   {
+      semQueued->WaitSingle();
+      csFlush.Enter();
+      if ( item = head )
+         if ( !(head = item->next) )
+            tail = NULL;
+      csFlush.Leave();
+      if ( !item )
+         break;                           // terminate request
+
+      QueryPerformanceCounter(&t0);
+      if ( item->handle )
+      {
+         if ( !FlushFileBuffers(item->handle) )
+         {
+            rc = GetLastError();
+            err.SysMsgWrite(30801, rc, L"FlushFileBuffers(%s)=%ld ",
+                                   item->path + DIM(gOptions.target.apipath), rc);
+         }
+         else
+            gOptions.flush.nFile++;
+         CloseHandle(item->handle);
+         semHandles->Release();
+      }
+      else
+         FlushDirPath(item->path);
+      QueryPerformanceCounter(&t1);
+      gOptions.flush.ticksFlush += t1.QuadPart - t0.QuadPart;
+      free(item);
+   }
+   return 0;
+}
+
+
+// Flushes the volume the target is on, the closest there is to syncfs
+static void
+   FlushVolume(
+   )
+{
+   WCHAR                     volPath[MAX_PATH],
+                             volName[64];
+   HANDLE                    hVol;
+   LARGE_INTEGER             t0,
+                             t1;
+   DWORD                     rc;
+
+   if ( !GetVolumePathName(gOptions.target.path, volPath, DIM(volPath))
+     || !GetVolumeNameForVolumeMountPoint(volPath, volName, DIM(volName)) )
+   {
+      err.MsgWrite(0, L"Volume flush(%s) not possible, files and directories were flushed",
+                      gOptions.target.path);
+      return;
+   }
+   volName[wcslen(volName) - 1] = L'\0';  // without the '\' to open the volume itself
+
+   QueryPerformanceCounter(&t0);
+   hVol = CreateFile(volName,
+                     GENERIC_WRITE,
+                     FILE_SHARE_READ | FILE_SHARE_WRITE,
+                     NULL, OPEN_EXISTING,
+                     0,
+                     0);
+   if ( hVol == INVALID_HANDLE_VALUE  ||  !FlushFileBuffers(hVol) )
+   {
+      rc = GetLastError();
+      err.MsgWrite(0, L"Volume flush(%s)=%ld not done, files and directories were flushed",
+                      volPath, rc);
+   }
+   else
+      gOptions.flush.nVolume++;
+   if ( hVol != INVALID_HANDLE_VALUE )
+      CloseHandle(hVol);
+   QueryPerformanceCounter(&t1);
+   gOptions.flush.ticksFlush += t1.QuadPart - t0.QuadPart;
+}
+
+
+// Starts the flusher thread if /sync=file or group was specified and files
+// are changed
+void _stdcall
+   FlushStart(
+   )
+{
+   if ( gOptions.syncMode == SYNC_None
+     || !(gOptions.global & OPT_GlobalChange) )
+      return;
+
+   QueryPerformanceFrequency(&perfFreq);
+   semQueued  = new TSemaphore(0, MAXLONG);
+   semHandles = new TSemaphore(FLUSH_HandlesMax, FLUSH_HandlesMax);
+   hThread = (HANDLE)_beginthreadex(NULL, 0, FlushThread, NULL, 0, NULL);
+   if ( !hThread )
+      err.SysMsgWrite(50801, GetLastError(), L"_beginthreadex(FlushThread)=%ld ",
+                             GetLastError());
+   gOptions.fState |= FLAG_Flush;
+}
+
+
+// Dispatches anything still batched, waits for the flusher to finish and,
+// with /sync=group, flushes the target volume
+void _stdcall
+   FlushTerminate(
+   )
+{
+   FlushDir                * fd;
+
+   if ( !(gOptions.fState & FLAG_Flush) )
+      return;
+
+   csFlush.Enter();
+   while ( fd = dirs )
+   {
+      FlushBatchDispatch(fd);
+      dirs = fd->next;
+      free(fd);
+   }
+   csFlush.Leave();
+
+   semQueued->Release();                  // behind everything queued
+   WaitForSingleObject(hThread, INFINITE);
+   CloseHandle(hThread);
+   gOptions.fState &= ~FLAG_Flush;
+   delete semQueued;
+   delete semHandles;
+
+   if ( gOptions.syncMode == SYNC_Group )
+      FlushVolume();
+}
+
+
+// Closes a written target file, handing it to the flusher first per /sync=.
+// The action's pending pointer identifies its directory.
+void _stdcall
+   FlushFileClose(
+      FileAction const     * action      ,// in -file action
+      HANDLE                 hTgt         // in -target file handle
+   )
+{
+   FlushItem               * item;
+   FlushDir                * fd;
+   LARGE_INTEGER             t0,
+                             t1;
+
+   if ( !(gOptions.fState & FLAG_Flush) )
+   {
+      CloseHandle(hTgt);
+      return;
+   }
+
+   if ( !(item = FlushItemNew(hTgt, action->tgtApiPath, wcslen(action->tgtApiPath))) )
+   {
+      CloseHandle(hTgt);
+      return;
+   }
+
+   // bound the handles held open; time spent here is the cost of the flushes
+   if ( semHandles->WaitSingle(0) == WAIT_TIMEOUT )
+   {
+      QueryPerformanceCounter(&t0);
+      semHandles->WaitSingle();
+      QueryPerformanceCounter(&t1);
+      InterlockedExchangeAdd64(&gOptions.flush.ticksWait, t1.QuadPart - t0.QuadPart);
+   }
+
+   csFlush.Enter();
+   if ( fd = FlushDirGet(action->pending) )
+      fd->nFile++;
+   if ( gOptions.syncMode == SYNC_Group  &&  fd )
+   {
+      if ( fd->tail )
+         fd->tail->next = item;
+      else
+         fd->head = item;
+      fd->tail = item;
+      fd->nItem++;
+      // too many held -- give all the batches to the flusher now
+      if ( ++nBatched >= FLUSH_GroupMax )
+         for ( fd = dirs;  fd;  fd = fd->next )
+            FlushBatchDispatch(fd);
+      csFlush.Leave();
+   }
+   else
+   {
+      csFlush.Leave();
+      FlushQueue(item, item, 1);
+   }
+}
+
+
+// Called as the walk leaves a directory, when its file actions are all
+// done.  Gives any group batch to the flusher followed by the directory if
+// files were written in it.
+void _stdcall
+   FlushDirDone(
+      void const           * dir         ,// in -directory (walk frame) id
+      WCHAR const          * tgtApiPath   // in -target directory path
+   )
+{
+   FlushDir                * fd,
+                          ** prev;
+   FlushItem               * item;
+
+   if ( !(gOptions.fState & FLAG_Flush) )
+      return;
+
+   csFlush.Enter();
+   for ( prev = &dirs;  (fd = *prev)  &&  fd->dir != dir;  prev = &fd->next );
+   if ( fd )
+   {
+      FlushBatchDispatch(fd);
+      *prev = fd->next;
+   }
+   csFlush.Leave();
+   if ( !fd )
+      return;
+
+   if ( fd->nFile  &&  (item = FlushItemNew(NULL, tgtApiPath, wcslen(tgtApiPath))) )
+      FlushQueue(item, item, 1);
+   free(fd);
+}
+
+
+// Flushes the parent directory of a directory just created or an object
+// just renamed so that its entry is durable
+void _stdcall
+   FlushParentDir(
+      WCHAR const          * tgtApiPath   // in -created/renamed target path
+   )
+{
+   WCHAR const             * name;
+   FlushItem               * item;
+
+   if ( !(gOptions.fState & FLAG_Flush) )
+      return;
+
+   if ( (name = wcsrchr(tgtApiPath, L'\\'))
+     && (item = FlushItemNew(NULL, tgtApiPath, name - tgtApiPath)) )
+      FlushQueue(item, item, 1);
+}
+
+
+// Logs what the flushes cost
+void _stdcall
+   FlushReport(
+   )
+{
+   static WCHAR const      * modes[] = { L"none", L"file", L"group" };
+
+   if ( gOptions.syncMode == SYNC_None  ||  !perfFreq.QuadPart )
+      return;
+
+   err.MsgWrite(0, L"Sync=%s files=%ld dirs=%ld volumes=%ld flushing=%.2fs "
+                   L"copy waited=%.2fs",
+                   modes[gOptions.syncMode],
+                   gOptions.flush.nFile, gOptions.flush.nDir, gOptions.flush.nVolume,
+                   (double)gOptions.flush.ticksFlush / perfFreq.QuadPart,
+                   (double)gOptions.flush.ticksWait / perfFreq.QuadPart);
+}
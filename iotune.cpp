@@ -0,0 +1,257 @@
+/*
+===============================================================================
+
+  Module     - IoTune
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Adaptive tuning of the overlapped I/O block size, the number
+               of outstanding I/Os and the large file threshold for a volume.
+               The copy engines report the bytes, elapsed time and per-I/O
+               latency they achieve and a simple hill-climbing controller
+               probes one parameter at a time, keeping changes that raise
+               the throughput and reverting those that don't.  Once no probe
+               direction pays off, the settings are considered settled and
+               only re-probed periodically in case conditions change.
+
+               The large file threshold follows from the measurements: it
+               is the larger of two blocks (the least that can overlap) and
+               the bandwidth-delay product of the volume, i.e., the amount
+               of data that can be moved in one I/O latency.  Files smaller
+               than that are dominated by per-file and per-I/O latency and
+               gain nothing from the overlapped path.
+
+  Updates -
+
+===============================================================================
+*/
+
+#include "netditto.hpp"
+
+#define IOTUNE_WindowBytes   ((__int64)32*1024*1024) // bytes per measurement window
+#define IOTUNE_Gain          1.05                    // rate gain needed to keep a probe
+#define IOTUNE_Reprobe       64                      // settled windows between re-probes
+#define IOTUNE_BlockMax      (1024*1024)             // largest I/O block size
+#define IOTUNE_DepthMin      2                       // fewest outstanding I/Os
+#define IOTUNE_DepthMax      64                      // most outstanding I/Os
+#define IOTUNE_LargeMin      ((__int64)64*1024)      // lowest large file threshold
+#define IOTUNE_LargeMax      ((__int64)64*1024*1024) // highest large file threshold
+
+// probes in the order they are tried: parameter and direction of change
+static struct
+{
+   short                     param;      // 0=block size, 1=depth
+   short                     step;       // +1=double, -1=halve
+}                         const probes[] = {{0, 1}, {0, -1}, {1, 1}, {1, -1}};
+
+static TCriticalSection      csTune;     // serializes updates from copy threads
+static LARGE_INTEGER         perfFreq;   // performance counter ticks per second
+
+
+// Initializes the tuning for a volume to the fixed defaults.  These are
+// what is used without /tune.
+void _stdcall
+   IoTuneInit(
+      DirOptions           * dirOptions   // i/o-volume whose tuning is initialized
+   )
+{
+   IoTune                  * tune = &dirOptions->tune;
+
+   QueryPerformanceFrequency(&perfFreq);
+   memset(tune, 0, sizeof *tune);
+
+   tune->cbBlockMin  = IOTUNE_BlockDefault;
+   tune->cbLargeFile = IOTUNE_LargeDefault;
+   if ( gOptions.global & OPT_GlobalIoTune )
+   {
+      // unbuffered I/O requires blocks to be multiples of the sector size,
+      // so never go below the cluster size of the volume
+      for ( ;  tune->cbBlockMin < dirOptions->cbCluster  &&  tune->cbBlockMin < IOTUNE_BlockMax;
+               tune->cbBlockMin <<= 1 );
+   }
+   tune->cbBlock     = tune->cbBlockMin;
+   tune->nDepth      = max(gOptions.sizeBuffer / tune->cbBlock, (DWORD)1);
+   if ( gOptions.global & OPT_GlobalIoTune )
+      tune->nDepth   = min(tune->nDepth, (DWORD)8);  // start where the fixed engine does
+}
+
+
+// Returns a consistent block size and depth pair for the next copy
+void _stdcall
+   IoTuneGet(
+      IoTune               * tune        ,// in -volume tuning
+      DWORD                * cbBlock     ,// out-I/O block size
+      DWORD                * nDepth       // out-number of outstanding I/Os
+   )
+{
+   csTune.Enter();
+   *cbBlock = tune->cbBlock;
+   *nDepth  = tune->nDepth;
+   csTune.Leave();
+}
+
+
+// Moves one parameter a step in the given direction, keeping the block size
+// times the depth within the copy buffer.  Returns false if at a limit.
+static bool
+   IoTuneStep(
+      IoTune               * tune        ,// i/o-volume tuning
+      short                  param       ,// in -0=block size, 1=depth
+      short                  step         // in -+1=double, -1=halve
+   )
+{
+   DWORD                     cbBlock = tune->cbBlock,
+                             nDepth  = tune->nDepth;
+
+   if ( param == 0 )
+   {
+      cbBlock = step > 0 ? cbBlock << 1 : cbBlock >> 1;
+      if ( cbBlock < tune->cbBlockMin  ||  cbBlock > IOTUNE_BlockMax
+        || cbBlock * IOTUNE_DepthMin > gOptions.sizeBuffer )
+         return false;
+      // a bigger block may not leave room for the current depth
+      nDepth = min(nDepth, gOptions.sizeBuffer / cbBlock);
+   }
+   else
+   {
+      nDepth = step > 0 ? nDepth << 1 : nDepth >> 1;
+      if ( nDepth < IOTUNE_DepthMin  ||  nDepth > IOTUNE_DepthMax
+        || cbBlock * nDepth > gOptions.sizeBuffer )
+         return false;
+   }
+
+   tune->cbBlockPrev = tune->cbBlock;
+   tune->nDepthPrev  = tune->nDepth;
+   tune->cbBlock     = cbBlock;
+   tune->nDepth      = nDepth;
+   return true;
+}
+
+
+// Starts the next probe that is not at a limit.  If every probe from the
+// current settings has failed, the settings are settled.
+static void
+   IoTuneProbe(
+      IoTune               * tune         // i/o-volume tuning
+   )
+{
+   for ( tune->probing = false;  tune->nFail < DIM(probes);  tune->nFail++ )
+   {
+      if ( IoTuneStep(tune, probes[tune->probe].param, probes[tune->probe].step) )
+      {
+         tune->probing = true;
+         return;
+      }
+      tune->probe = (tune->probe + 1) % DIM(probes);
+   }
+   tune->settled = true;
+}
+
+
+// Accumulates a copy's measurements into the current window and, when the
+// window is full, evaluates the last probe and sets up the next one.
+void _stdcall
+   IoTuneSample(
+      IoTune               * tune        ,// i/o-volume tuning
+      __int64                cbBytes     ,// in -bytes transferred
+      __int64                ticksXfer   ,// in -transfer elapsed perf counter ticks
+      __int64                ticksLatency,// in -sum of per-I/O latency ticks
+      DWORD                  nIO          // in -number of I/Os completed
+   )
+{
+   double                    rate,
+                             latency;
+   __int64                   cbLarge;
+
+   if ( !(gOptions.global & OPT_GlobalIoTune)  ||  ticksXfer <= 0 )
+      return;
+
+   csTune.Enter();
+   tune->wBytes   += cbBytes;
+   tune->wTicks   += ticksXfer;
+   tune->wLatency += ticksLatency;
+   tune->wIO      += nIO;
+   if ( tune->wBytes < IOTUNE_WindowBytes )
+   {
+      csTune.Leave();
+      return;
+   }
+
+   rate = (double)tune->wBytes * perfFreq.QuadPart / tune->wTicks;
+   if ( tune->wIO )
+   {
+      latency = (double)tune->wLatency / tune->wIO / perfFreq.QuadPart;
+      tune->latency = tune->nWindow ? tune->latency * 0.75 + latency * 0.25 : latency;
+   }
+
+   if ( tune->nWindow++ == 0 )
+   {
+      // first window is the baseline for the default settings
+      tune->rate = rate;
+      IoTuneProbe(tune);
+   }
+   else if ( tune->probing )
+   {
+      if ( rate >= tune->rate * IOTUNE_Gain )
+      {
+         // keep the change and keep climbing in the same direction
+         tune->rate  = rate;
+         tune->nFail = 0;
+      }
+      else
+      {
+         // revert and try the next parameter/direction
+         tune->cbBlock = tune->cbBlockPrev;
+         tune->nDepth  = tune->nDepthPrev;
+         tune->probe   = (tune->probe + 1) % DIM(probes);
+         tune->nFail++;
+      }
+      IoTuneProbe(tune);
+   }
+   else
+   {
+      // settled -- track the rate and periodically look around again
+      tune->rate = tune->rate * 0.75 + rate * 0.25;
+      if ( tune->nWindow % IOTUNE_Reprobe == 0 )
+      {
+         tune->settled = false;
+         tune->nFail = 0;
+         IoTuneProbe(tune);
+      }
+   }
+
+   // large file threshold is the bandwidth-delay product, rounded up to 64K
+   cbLarge = max((__int64)(tune->rate * tune->latency), (__int64)tune->cbBlock * 2);
+   cbLarge = (cbLarge + IOTUNE_LargeMin - 1) & ~(IOTUNE_LargeMin - 1);
+   tune->cbLargeFile = min(max(cbLarge, IOTUNE_LargeMin), IOTUNE_LargeMax);
+
+   tune->wBytes = tune->wTicks = tune->wLatency = 0;
+   tune->wIO = 0;
+   csTune.Leave();
+}
+
+
+// Logs the settings a volume settled on along with the measurements that
+// led to them.
+void _stdcall
+   IoTuneReport(
+      DirOptions const     * dirOptions  ,// in -volume whose tuning is reported
+      WCHAR const          * name         // in -source/target label
+   )
+{
+   IoTune const            * tune = &dirOptions->tune;
+
+   if ( !(gOptions.global & OPT_GlobalIoTune) )
+      return;
+
+   if ( tune->nWindow == 0 )
+      err.MsgWrite(0, L"I/O tuning %s(%s) no large file samples, block=%luK depth=%lu",
+                      name, dirOptions->path, tune->cbBlock / 1024, tune->nDepth);
+   else
+      err.MsgWrite(0, L"I/O tuning %s(%s) %s block=%luK depth=%lu large>=%I64dK "
+                      L"rate=%.1fMB/s latency=%.2fms windows=%lu",
+                      name, dirOptions->path,
+                      tune->settled ? L"settled" : L"probing",
+                      tune->cbBlock / 1024, tune->nDepth, tune->cbLargeFile / 1024,
+                      tune->rate / 1000000, tune->latency * 1000, tune->nWindow);
+}
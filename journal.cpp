@@ -0,0 +1,305 @@
+/*
+===============================================================================
+
+  Module     - Journal
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Restartable runs with /journal=.  A run interrupted by a crash
+               or reboot otherwise starts over, rescanning everything and
+               comparing again every file it had already done.
+
+               As the walk leaves a directory whose whole subtree was done
+               without error, its path relative to the source root is
+               added to the journal.  A later run with the same journal,
+               source and target loads the finished directories into a
+               balanced tree and the walk skips them without even reading
+               them.  Since the walk's order is that of the sorted DirIndex,
+               this takes it straight past everything finished to the first
+               directory that wasn't.
+
+               Paths are collected in a buffer and written in batches every
+               JOURNAL_Interval or JOURNAL_Batch bytes, so the journal costs
+               the walk next to nothing.  The most a crash loses is the last
+               batch, whose directories are simply done again.  A run that
+               completes without error deletes its journal.
+
+               Done means done by the walk.  A /verify mismatch found after
+               a directory was journalled, or its time set by the final
+               DirTimeFixup, isn't reflected in it: a run that crashes
+               before the end skips such a directory next time even so.
+               Target subtrees moved to the /trash or purged aren't
+               journalled at all.
+  Updates -
+  26/10/19 TPB Nothing journalled during a /maxtime= or /maxbytes= sweep.
+
+===============================================================================
+*/
+
+#include "netditto.hpp"
+#include "TList.h"
+
+#define JOURNAL_Batch        (64*1024)    // bytes buffered before writing
+#define JOURNAL_Buffer       (256*1024)   // batch buffer, room for the longest path
+#define JOURNAL_Interval     5000         // mSec between writes at most
+#define JOURNAL_Header       "NetDitto journal\t"
+
+class JournalDir : public TList           // finished directory
+{
+public:
+   WCHAR const             * path;        // relative to the source root
+
+                        JournalDir(WCHAR const * p) : path(p) {}
+};
+
+static HANDLE                hJournal = INVALID_HANDLE_VALUE;
+static char                * batch;       // paths not yet written
+static DWORD                 cbBatch;
+static DWORD                 tLastWrite;  // tick count of the last write
+static size_t                cchRoot;     // source root path length
+static WCHAR               * loaded;      // journal read at start, holds the paths
+static TListCollection     * finished;    // finished directories loaded
+
+
+static TListCompare(JournalCompare)
+{
+   return _wcsicmp(((JournalDir const *)v1)->path, ((JournalDir const *)v2)->path);
+}
+
+static TListSearchCompare(JournalSearchCompare)
+{
+   return _wcsicmp(((JournalDir const *)v1)->path, (WCHAR const *)v2);
+}
+
+// descending, the order TListCollection keeps its trees in
+static int __cdecl
+   JournalSortCompare(
+      void const           * v1          ,// in -JournalDir **
+      void const           * v2           // in -JournalDir **
+   )
+{
+   return -JournalCompare(*(TList const **)v1, *(TList const **)v2);
+}
+
+
+// Writes the batched paths
+static void
+   JournalWrite(
+   )
+{
+   DWORD                     nWritten,
+                             rc;
+
+   tLastWrite = GetTickCount();
+   if ( !cbBatch )
+      return;
+   if ( !WriteFile(hJournal, batch, cbBatch, &nWritten, NULL) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(21201, rc, L"Journal write(%s)=%ld ", gOptions.journal, rc);
+   }
+   cbBatch = 0;
+}
+
+
+// Appends a line, converted to UTF-8, to the batch
+static void
+   JournalAppend(
+      WCHAR const          * str          // in -line
+   )
+{
+   cbBatch += WideCharToMultiByte(CP_UTF8, 0, str, -1, batch + cbBatch,
+                                  JOURNAL_Buffer - cbBatch, NULL, NULL) - 1;
+   batch[cbBatch++] = '\n';
+}
+
+
+// Loads the finished directories of a journal that belongs to this source
+// and target.  Returns false if there is none.
+static bool
+   JournalLoad(
+      WCHAR const          * header       // in -expected first line
+   )
+{
+   LARGE_INTEGER             cbFile;
+   char                    * text;
+   WCHAR                   * line,
+                           * next;
+   JournalDir             ** dirs;
+   DWORD                     nRead;
+   int                       cch,
+                             nDir = 0,
+                             n;
+
+   if ( !GetFileSizeEx(hJournal, &cbFile)  ||  !cbFile.QuadPart
+     || cbFile.QuadPart >= MAXLONG / sizeof (WCHAR) )
+      return false;
+   if ( !(text = (char *)malloc((size_t)cbFile.QuadPart)) )
+      return false;
+   if ( ReadFile(hJournal, text, (DWORD)cbFile.QuadPart, &nRead, NULL) )
+   {
+      // a line cut off by a crash part way through a write isn't finished,
+      // and is cut from the file so the next line starts afresh
+      while ( nRead  &&  text[nRead-1] != '\n' )
+         nRead--;
+      if ( nRead < cbFile.QuadPart )
+      {
+         SetFilePointer(hJournal, nRead, NULL, FILE_BEGIN);
+         SetEndOfFile(hJournal);
+      }
+   }
+   else
+      nRead = 0;
+   if ( !nRead
+     || (cch = MultiByteToWideChar(CP_UTF8, 0, text, nRead, NULL, 0)) == 0
+     || !(loaded = (WCHAR *)malloc((cch + 1) * sizeof (WCHAR))) )
+   {
+      free(text);
+      return false;
+   }
+   MultiByteToWideChar(CP_UTF8, 0, text, nRead, loaded, cch);
+   loaded[cch] = L'\0';
+   free(text);
+
+   // the first line names the source and target; the rest are directories
+   for ( line = loaded;  line;  line = next )
+   {
+      if ( next = wcschr(line, L'\n') )
+         *next++ = L'\0';
+      if ( line == loaded )
+      {
+         if ( wcscmp(line, header) )
+         {
+            free(loaded);                 // another run's journal
+            loaded = NULL;
+            return false;
+         }
+      }
+      else if ( *line )
+         nDir++;
+   }
+   if ( !(dirs = (JournalDir **)malloc(max(nDir, 1) * sizeof *dirs)) )
+   {
+      free(loaded);
+      loaded = NULL;
+      return false;
+   }
+   for ( n = 0, line = loaded + wcslen(loaded) + 1;  n < nDir;  line += wcslen(line) + 1 )
+      if ( *line )
+         dirs[n++] = new JournalDir(line);
+
+   // sorted, the list converts to a balanced tree with no compares
+   qsort(dirs, nDir, sizeof *dirs, JournalSortCompare);
+   finished = new TListCollection(JournalCompare, JournalSearchCompare);
+   for ( n = 0;  n < nDir;  n++ )
+      finished->InsertBottom(dirs[n]);
+   if ( nDir )
+      finished->ToTree();
+   free(dirs);
+   err.MsgWrite(0, L"Journal %s, %d finished directories skipped", gOptions.journal, nDir);
+   return true;
+}
+
+
+// Opens the journal, loading the finished directories of an interrupted run
+// of the same source and target, or starting a new one
+void _stdcall
+   JournalStart(
+   )
+{
+   WCHAR                   * header;
+   size_t                    cchHeader;
+   DWORD                     rc;
+
+   if ( !gOptions.journal )
+      return;
+
+   cchRoot = wcslen(gOptions.source.path);
+   cchHeader = DIM(JOURNAL_Header) + cchRoot + wcslen(gOptions.target.path) + 1;
+   header = (WCHAR *)malloc(cchHeader * sizeof (WCHAR));
+   batch  = (char *)malloc(JOURNAL_Buffer);
+   if ( !header  ||  !batch )
+   {
+      err.MsgWrite(51202, L"Journal buffer allocation failed");
+      return;
+   }
+   _snwprintf(header, cchHeader, L"%S%s\t%s", JOURNAL_Header, gOptions.source.path,
+              gOptions.target.path);
+
+   hJournal = CreateFile(gOptions.journal,
+                         GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                         NULL, OPEN_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                         0);
+   if ( hJournal == INVALID_HANDLE_VALUE )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(51201, rc, L"Journal open(%s)=%ld ", gOptions.journal, rc);
+      free(header);
+      return;
+   }
+   if ( !JournalLoad(header) )
+   {
+      // start afresh with just the header
+      SetFilePointer(hJournal, 0, NULL, FILE_BEGIN);
+      SetEndOfFile(hJournal);
+      JournalAppend(header);
+      JournalWrite();
+   }
+   else
+      SetFilePointer(hJournal, 0, NULL, FILE_END);
+   free(header);
+   tLastWrite = GetTickCount();
+   gOptions.fState |= FLAG_Journal;
+}
+
+
+// Returns whether the walk can skip a directory finished by a previous run
+BOOL _stdcall
+   JournalSkip(
+      WCHAR const          * srcPath      // in -source directory path
+   )
+{
+   return finished
+       && wcslen(srcPath) > cchRoot
+       && finished->Search(srcPath + cchRoot) != NULL;
+}
+
+
+// Journals a directory as the walk leaves it if its subtree was finished
+// without error
+void _stdcall
+   JournalDirDone(
+      WCHAR const          * srcPath     ,// in -source directory path
+      long                   nErrorsStart // in -error count when the directory was entered
+   )
+{
+   // a sweep skips and stops part way, so its directories aren't finished
+   if ( !(gOptions.fState & FLAG_Journal)
+     || gOptions.fState & (FLAG_Shutdown | FLAG_Sweep)
+     || err.ErrorCount() != nErrorsStart
+     || wcslen(srcPath) <= cchRoot )      // the root is done when the run is
+      return;
+
+   JournalAppend(srcPath + cchRoot);
+   if ( cbBatch >= JOURNAL_Batch
+     || GetTickCount() - tLastWrite >= JOURNAL_Interval )
+      JournalWrite();
+}
+
+
+// Writes what remains batched and closes the journal, deleting it if the
+// run completed without error
+void _stdcall
+   JournalTerminate(
+   )
+{
+   if ( !(gOptions.fState & FLAG_Journal) )
+      return;
+
+   gOptions.fState &= ~FLAG_Journal;
+   JournalWrite();
+   CloseHandle(hJournal);
+   if ( !(gOptions.fState & FLAG_Shutdown)  &&  !err.ErrorCount() )
+      DeleteFile(gOptions.journal);
+}
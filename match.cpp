@@ -12,6 +12,27 @@
 
   Updates -
   95/08/14 RED Change save/restore of DirBuffer and DirIndex.
+  26/10/19 TPB File actions may be pipelined; wait for a directory's
+               pending actions before its exit processing.
+  26/10/19 TPB Schedule upcoming source files for /prefetch.
+  26/10/19 TPB Flush a directory per /sync= when leaving it.
+  26/10/19 TPB Leave /resume part and checkpoint files alone.
+  26/10/19 TPB Skip directories a /journal= says are finished and journal
+               those finished now.
+  26/10/19 TPB A /maxtime= or /maxbytes= sweep may skip to its cursor and
+               stop part way through.
+  26/10/19 TPB Keep the source and target directories open while in them
+               for the file actions' relative opens.
+  26/10/19 TPB Roll up whether anything in a subtree changed so directory
+               times are fixed only where needed.
+  26/10/19 TPB Purge target subtrees without a source in parallel.
+  26/10/19 TPB Move target subtrees without a source to the /trash.
+  26/10/19 TPB Make a missing target subtree's directories ahead of the walk.
+  26/10/19 TPB Merge a huge directory's files in partitions at once.
+  26/10/19 TPB Sort an unordered source index while the target is read.
+  26/10/19 TPB Walk from a stack of MatchFrames rather than recursing and
+               queue the subdirectories ahead for ScanAhead to read.
+  26/10/19 TPB Merge a directory over /spill= from Spill's sorted runs.
 
 ================================================================================
 */
@@ -19,8 +40,8 @@
 #include "netditto.hpp"
 
 // end-of-list macros for both source and target
-#define SrcEOL ( !srcIndex || srcNbr >= gOptions.source.dirBuffer.currIndex->usedSlots )
-#define TgtEOL ( !tgtIndex || tgtNbr >= gOptions.target.dirBuffer.currIndex->usedSlots )
+#define SrcEOL(f) ( !(f)->srcIndex || (f)->srcNbr >= gOptions.source.dirBuffer.currIndex->usedSlots )
+#define TgtEOL(f) ( !(f)->tgtIndex || (f)->tgtNbr >= gOptions.target.dirBuffer.currIndex->usedSlots )
 
 struct HiddenSemanticAction
 {
@@ -28,6 +49,8 @@ struct HiddenSemanticAction
    char                      tgtSet;      // 0=no action, 1=set tgtEntry to NULL
 };
 
+static BOOL                  seeded;      // in a subtree whose directories SeedTree made
+
 
 void _stdcall                              // ret-0=success
    HiddenSemanticsSet(
@@ -70,76 +93,320 @@ void _stdcall                              // ret-0=success
       *tgtEntry = NULL;
 }
 
-// matches the source and target ordered lists of DirEntry objects within a directory.
-// takes action depending upon whether both names match
-// Processes subdirectories recursively.
-short _stdcall                            // ret-0=success
-   MatchEntries(
-      short                  level       ,// in -current recursion/directory level
-      DirEntry             * srcDirEntry ,// in -source dir entry
-      DirEntry             * tgtDirEntry  // in -target dir entry
+// Returns the count of target changes so far that change a directory's
+// time, which moves whenever a name is created, removed or renamed in it.
+// Attribute and time updates don't, so a time fixup doesn't ripple up to
+// the parent.  A parent's pipelined actions still in flight may move it
+// too, which only costs a needless time fixup.
+static StatCount
+   ChangeCount(
    )
 {
-   int                       rc,
-                             comp;        // source/target operation result
-
-   // variables associated with popping LIFO stacks after done
-
-   DirBlock                * srcCurrBlock  = gOptions.source.dirBuffer.currBlock,
-                           * tgtCurrBlock  = gOptions.target.dirBuffer.currBlock;
-   DirEntry                * srcHwm        = srcCurrBlock->hwmEntry,
-                           * tgtHwm        = tgtCurrBlock->hwmEntry;
-   DWORD                     srcAvail      = srcCurrBlock->avail,
-                             tgtAvail      = tgtCurrBlock->avail;
-   DirIndex                * srcCurrIndex  = gOptions.source.dirBuffer.currIndex,
-                           * tgtCurrIndex  = gOptions.target.dirBuffer.currIndex;
-
-   DWORD                     srcNbr        = 0;
-   DWORD                     tgtNbr        = 0;
-   DirEntry               ** srcIndex      = NULL,
-                          ** tgtIndex      = NULL,
-                           * srcEntry,    // current source entry
-                           * tgtEntry;    // current target entry
-   WCHAR                   * srcAppend = gOptions.source.path + wcslen(gOptions.source.path),
-                           * tgtAppend = gOptions.target.path + wcslen(gOptions.target.path);
+   StatsChange const       * change = &gOptions.stats.change;
+
+   return change->dirCreated + change->dirRemoved
+        + change->fileCreated.count + change->fileRemoved.count
+        + gOptions.nRenamed;
+}
+
+// A directory being walked, with what the walk keeps for it while it is in
+// its subdirectories.  MatchEntries holds one per level on a stack of its
+// own rather than recursing.
+struct MatchFrame
+{
+   short                     level;       // recursion/directory level
+   DirEntry                * srcDirEntry; // source dir entry, in the parent's DirBuffer
+   DirEntry                * tgtDirEntry; // target dir entry, in the parent's DirBuffer
+
+   // LIFO stack positions restored on leaving
+   DirBlock                * srcCurrBlock,
+                           * tgtCurrBlock;
+   DirEntry                * srcHwm,
+                           * tgtHwm;
+   DWORD                     srcAvail,
+                             tgtAvail;
+   DirIndex                * srcCurrIndex,
+                           * tgtCurrIndex;
 
-   if ( srcDirEntry )
+   DWORD                     srcNbr,
+                             tgtNbr;
+   DirEntry               ** srcIndex,    // next source entry
+                          ** tgtIndex;    // next target entry
+   WCHAR                   * srcAppend,
+                           * tgtAppend;
+   LONG volatile             pending;     // file actions of this dir still in the pipeline
+   DirEntry               ** srcAhead,    // next source entry to consider for prefetch
+                          ** srcEnd;
+   DirEntry               ** srcScan,     // next source subdirectory to read ahead
+                          ** tgtScan,     // and where its target would be
+                          ** tgtEnd;
+   DWORD                     nSrc,
+                             nTgt;
+   long                      nErrors;     // for /journal=
+   StatCount                 nChanges;    // to tell if the subtree changed
+   HANDLE                    srcDirUp,    // parent's, for relative opens
+                             tgtDirUp;
+   BOOL                      seedTop,     // the subtree SeedTree made starts here
+                             partitioned; // files done by PartMerge
+};
+
+#define MATCH_Walk           0            // MatchDirEnter: walk the directory's entries
+#define MATCH_Done           1            // MatchDirEnter: nothing more to do
+
+
+// Queues the next of the directory's source subdirectories, and their
+// targets, to be read ahead of the walk as room is made
+static void
+   MatchScanAhead(
+      MatchFrame           * f            // i/o-directory
+   )
+{
+   DirEntry                * srcEntry,
+                           * tgtEntry;
+   DWORD                     room;
+   size_t                    cchSrc,
+                             cchTgt;
+
+   if ( f->level + 1 > gOptions.maxLevel  ||  !(room = ScanAheadRoom(f->level + 1)) )
+      return;
+   cchSrc = DIM(gOptions.source.apipath) + (f->srcAppend - gOptions.source.path);
+   cchTgt = DIM(gOptions.target.apipath) + (f->tgtAppend - gOptions.target.path);
+   while ( room  &&  f->srcScan < f->srcEnd )
    {
-      if ( srcDirEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY )
-         if ( rc = DirGet(&gOptions.source, &gOptions.stats.source, &srcIndex) )
-            return rc;
-         else;
+      srcEntry = *f->srcScan++;
+      if ( !(srcEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY) )
+         continue;
+      while ( f->tgtScan < f->tgtEnd  &&  _wcsicmp((*f->tgtScan)->cFileName, srcEntry->cFileName) < 0 )
+         f->tgtScan++;
+      if ( f->tgtScan < f->tgtEnd  &&  !_wcsicmp((*f->tgtScan)->cFileName, srcEntry->cFileName) )
+         tgtEntry = *f->tgtScan;
       else
-         MismatchSourceNotDir(srcDirEntry, tgtDirEntry);
+         tgtEntry = NULL;
+      if ( !(gOptions.global & OPT_GlobalHidden) )
+         HiddenSemanticsSet(&srcEntry, &tgtEntry);
+      if ( !srcEntry )
+         continue;
+      ScanAheadQueue(&gOptions.source, cchSrc, srcEntry->cFileName, f->level + 1);
+      room--;
+      if ( tgtEntry  &&  tgtEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY  &&  room )
+      {
+         ScanAheadQueue(&gOptions.target, cchTgt, tgtEntry->cFileName, f->level + 1);
+         room--;
+      }
    }
-   if ( tgtDirEntry )
+}
+
+
+// Reads a directory too big to hold, as DirGet found one of its sides, into
+// sorted runs for SpillJoin, letting go of a source already read whole.
+// Returns TRUE if it was, else FALSE with it read by DirGet after all and
+// rc set.
+static BOOL
+   MatchSpill(
+      MatchFrame           * f           ,// i/o-directory
+      StatsCommon const    * srcStats    ,// in -source statistics before its DirGet
+      int                  * rc           // out-return code
+   )
+{
+   BOOL                      srcDir = f->srcDirEntry  &&  f->srcDirEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY,
+                             tgtDir = f->tgtDirEntry  &&  f->tgtDirEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY;
+
+   if ( f->srcIndex )                     // read before the target was found too big
+   {
+      gOptions.source.dirBuffer.currBlock = f->srcCurrBlock;
+      f->srcCurrBlock->hwmEntry = f->srcHwm;
+      f->srcCurrBlock->avail    = f->srcAvail;
+      gOptions.source.dirBuffer.currIndex = f->srcCurrIndex;
+      gOptions.stats.source = *srcStats;
+      f->srcIndex = NULL;
+   }
+   if ( !SpillRead(srcDir, tgtDir) )
+      return TRUE;
+
+   // spilling is now off, so DirGet holds it whole
+   *rc = 0;
+   if ( srcDir  &&  (*rc = DirGet(&gOptions.source, &gOptions.stats.source, &f->srcIndex, NULL)) )
+      return FALSE;
+   if ( tgtDir )
+      *rc = DirGet(&gOptions.target, &gOptions.stats.target, &f->tgtIndex, NULL);
+   return FALSE;
+}
+
+
+// Reads a directory's source and target and does what is done on the way
+// into it.  Returns MATCH_Walk if its entries are to be walked, else
+// MATCH_Done with rc set.
+static int
+   MatchDirEnter(
+      MatchFrame           * f           ,// i/o-directory, level and dir entries set
+      int                  * rc           // out-return code when not walked
+   )
+{
+   HANDLE                    hSrcSort = NULL;  // thread sorting the source index
+   BOOL                      unsorted,         // index left for DirSort
+                             spill = FALSE;    // too big to hold, merged by SpillJoin
+   StatsCommon               srcStats = gOptions.stats.source;
+
+   f->srcCurrBlock = gOptions.source.dirBuffer.currBlock;
+   f->tgtCurrBlock = gOptions.target.dirBuffer.currBlock;
+   f->srcHwm       = f->srcCurrBlock->hwmEntry;
+   f->tgtHwm       = f->tgtCurrBlock->hwmEntry;
+   f->srcAvail     = f->srcCurrBlock->avail;
+   f->tgtAvail     = f->tgtCurrBlock->avail;
+   f->srcCurrIndex = gOptions.source.dirBuffer.currIndex;
+   f->tgtCurrIndex = gOptions.target.dirBuffer.currIndex;
+   f->srcNbr       = f->tgtNbr = 0;
+   f->srcIndex     = f->tgtIndex = NULL;
+   f->srcAppend    = gOptions.source.path + wcslen(gOptions.source.path);
+   f->tgtAppend    = gOptions.target.path + wcslen(gOptions.target.path);
+   f->pending      = 0;
+   f->srcAhead     = f->srcEnd = NULL;
+   f->srcScan      = f->tgtScan = f->tgtEnd = NULL;
+   f->nSrc         = f->nTgt = 0;
+   f->nErrors      = err.ErrorCount();
+   f->nChanges     = ChangeCount();
+   f->srcDirUp     = gOptions.source.hDir;
+   f->tgtDirUp     = gOptions.target.hDir;
+   f->seedTop      = FALSE;
+   *rc = 0;
+
+   // a target subtree with no source at all is moved to the /trash or
+   // purged in parallel rather than walked, leaving just its top for the
+   // usual removal.  It isn't journalled, as the removal may still be under
+   // way and a later run must find what is left of it.
+   if ( !f->srcDirEntry  &&  f->tgtDirEntry  &&  f->tgtDirEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY )
    {
-      if ( tgtDirEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY )
-         if ( rc = DirGet(&gOptions.target, &gOptions.stats.target, &tgtIndex) )
-            return rc;
-         else;
+      if ( TrashMove(f->level, f->tgtDirEntry) )
+         return MATCH_Done;
+      if ( PurgeUse() )
+      {
+         DisplayPathOffset(gOptions.target.path);
+         if ( *rc = PurgeTree(f->level, f->tgtDirEntry) )
+            return MATCH_Done;
+         MatchedDirTgtExists(f->srcDirEntry, f->tgtDirEntry, TRUE);
+         return MATCH_Done;
+      }
+   }
+
+   if ( f->srcDirEntry )
+   {
+      if ( f->srcDirEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY )
+      {
+         if ( (*rc = DirGet(&gOptions.source, &gOptions.stats.source, &f->srcIndex, &unsorted))
+              == DIRGET_Spill )
+            spill = TRUE;
+         else if ( *rc )
+            return MATCH_Done;
+         else if ( unsorted )             // sorted while the target is read
+            hSrcSort = DirSortStart(f->srcIndex, gOptions.source.dirBuffer.currIndex->usedSlots);
+      }
       else
-         MismatchTargetNotDir(srcDirEntry, tgtDirEntry);
+         MismatchSourceNotDir(f->srcDirEntry, f->tgtDirEntry);
+   }
+   if ( f->tgtDirEntry )
+   {
+      if ( f->tgtDirEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY )
+      {
+         if ( spill )
+            ;                             // read with the source by SpillRead
+         else if ( (*rc = DirGet(&gOptions.target, &gOptions.stats.target, &f->tgtIndex, &unsorted))
+                   == DIRGET_Spill )
+            spill = TRUE;
+         else if ( *rc )
+         {
+            DirSortWait(hSrcSort);
+            return MATCH_Done;
+         }
+         else if ( unsorted )
+            DirSort(f->tgtIndex, gOptions.target.dirBuffer.currIndex->usedSlots);
+      }
+      else
+         MismatchTargetNotDir(f->srcDirEntry, f->tgtDirEntry);
    }
    else      // process no target on way down in case of create)
-      MatchedDirNoTgt(srcDirEntry);
-   if ( srcDirEntry  &&  tgtDirEntry )
+   {
+      // and the rest of the missing subtree's directories are all made at
+      // once, so the walk below neither makes them nor reads them
+      if ( !MatchedDirNoTgt(f->srcDirEntry, seeded)  &&  !seeded  &&  SeedUse() )
+         seeded = f->seedTop = !SeedTree(f->level);
+   }
+   DirSortWait(hSrcSort);
+   if ( spill  &&  !(spill = MatchSpill(f, &srcStats, rc))  &&  *rc )
+      return MATCH_Done;
+   if ( f->srcDirEntry  &&  f->tgtDirEntry )
       gOptions.stats.match.dirMatched++;
 
+   // files are opened relative to their directory rather than by full path
+   gOptions.source.hDir = f->srcIndex
+                       || (spill  &&  f->srcDirEntry  &&  f->srcDirEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY)
+                        ? RelDirOpen(gOptions.source.apipath) : NULL;
+   gOptions.target.hDir = f->srcIndex  ||  f->tgtIndex  ||  spill
+                        ? RelDirOpen(gOptions.target.apipath) : NULL;
+
+   // a directory too big to hold has its files merged from its runs now,
+   // leaving the loop below just its subdirectories
+   if ( spill )
+      SpillJoin(&f->srcIndex, &f->tgtIndex, &f->pending);
+   if ( f->srcIndex )
+   {
+      f->nSrc     = gOptions.source.dirBuffer.currIndex->usedSlots;
+      f->srcAhead = f->srcScan = f->srcIndex;
+      f->srcEnd   = f->srcIndex + f->nSrc;
+   }
+   if ( f->tgtIndex )
+   {
+      f->nTgt    = gOptions.target.dirBuffer.currIndex->usedSlots;
+      f->tgtScan = f->tgtIndex;
+      f->tgtEnd  = f->tgtIndex + f->nTgt;
+   }
+
    DisplayPathOffset(gOptions.target.path);
+   MatchScanAhead(f);
+
+   // a huge directory's files are merged and processed in key ranges at
+   // once, leaving the loop below just its subdirectories
+   f->partitioned = !spill  &&  PartUse(f->nSrc, f->nTgt)
+                 && !PartMerge(f->srcIndex, f->nSrc, f->tgtIndex, f->nTgt, &f->pending);
+   if ( f->partitioned  ||  spill )
+      f->srcAhead = NULL;                 // nothing left to prefetch
 
    // append '\\' to source and target paths. The DireEntry filename will later 
    // be appended for a full path
-   *srcAppend = *tgtAppend = L'\\';       
-                                          
-   while ( !SrcEOL  ||  !TgtEOL )
+   *f->srcAppend = *f->tgtAppend = L'\\';
+   return MATCH_Walk;
+}
+
+
+// Matches a directory's entries on from where it left off, processing files
+// until it comes to a subdirectory to be entered.  Returns TRUE with its
+// entries and the paths set to it, FALSE once the directory is done.
+static BOOL
+   MatchDirNext(
+      MatchFrame           * f           ,// i/o-directory
+      DirEntry            ** srcSub      ,// out-source subdirectory entry
+      DirEntry            ** tgtSub       // out-target subdirectory entry
+   )
+{
+   int                       comp,        // source/target operation result
+                             sweep;       // SweepEntry result
+   DirEntry                * srcEntry,    // current source entry
+                           * tgtEntry;    // current target entry
+
+   while ( !SrcEOL(f)  ||  !TgtEOL(f) )
    {
-      if ( tgtIndex  &&  !TgtEOL )
-         tgtEntry = *tgtIndex;
+      if ( f->srcAhead )
+      {
+         if ( f->srcAhead < f->srcIndex )
+            f->srcAhead = f->srcIndex;
+         PrefetchAhead(&f->pending, DIM(gOptions.source.apipath) + (f->srcAppend - gOptions.source.path),
+                       &f->srcAhead, f->srcEnd, f->tgtIndex - f->tgtNbr, f->nTgt);
+      }
+      if ( f->tgtIndex  &&  !TgtEOL(f) )
+         tgtEntry = *f->tgtIndex;
       else
          tgtEntry = NULL;
-      if ( srcIndex  &&  !SrcEOL )
-         srcEntry = *srcIndex;
+      if ( f->srcIndex  &&  !SrcEOL(f) )
+         srcEntry = *f->srcIndex;
       else
          srcEntry = NULL;
 
@@ -154,65 +421,170 @@ short _stdcall                            // ret-0=success
       if ( tgtEntry )
       {
          if ( !srcEntry )
-            wcscpy(srcAppend+1, tgtEntry->cFileName);
-         wcscpy(tgtAppend+1, tgtEntry->cFileName);
-         tgtIndex++;
-         tgtNbr++;
+            wcscpy(f->srcAppend+1, tgtEntry->cFileName);
+         wcscpy(f->tgtAppend+1, tgtEntry->cFileName);
+         f->tgtIndex++;
+         f->tgtNbr++;
       }
       if ( srcEntry )
       {
-         wcscpy(srcAppend+1, srcEntry->cFileName);
+         wcscpy(f->srcAppend+1, srcEntry->cFileName);
          if ( !tgtEntry )
-            wcscpy(tgtAppend+1, srcEntry->cFileName);
-         srcIndex++;
-         srcNbr++;
+            wcscpy(f->tgtAppend+1, srcEntry->cFileName);
+         f->srcIndex++;
+         f->srcNbr++;
+      }
+
+      // a sweep seeks its cursor and stops when out of budget
+      if ( gOptions.fState & FLAG_Sweep )
+      {
+         sweep = SweepEntry(gOptions.source.path);
+         if ( sweep == SWEEP_Stop )
+            break;
+         if ( sweep == SWEEP_Skip )
+            continue;
       }
 
       // resolve hidden file/directory semantics when /-h specified
       if ( !(gOptions.global & OPT_GlobalHidden) )
          HiddenSemanticsSet(&srcEntry, &tgtEntry);
 
-      // recursive call for subdirectories
+      // a /resume copy's part file isn't an extra target file to be removed
+      if ( !srcEntry  &&  tgtEntry  &&  gOptions.global & OPT_GlobalResume
+        && ResumeFileIs(tgtEntry->cFileName) )
+         tgtEntry = NULL;
+
+      // nor is the /trash directory
+      if ( !f->level  &&  !srcEntry  &&  tgtEntry  &&  TrashIs(tgtEntry->cFileName) )
+         tgtEntry = NULL;
+
+      // subdirectories are entered in turn
       if ( (srcEntry  &&  srcEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY )
         || (tgtEntry  &&  tgtEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY) )
       {
-         if ( (level+1) <= gOptions.maxLevel )
-            MatchEntries(level + 1, srcEntry, tgtEntry);
+         if ( (f->level+1) <= gOptions.maxLevel  &&  !JournalSkip(gOptions.source.path) )
+         {
+            MatchScanAhead(f);
+            *srcSub = srcEntry;
+            *tgtSub = tgtEntry;
+            return TRUE;
+         }
       }
-      else if ( srcEntry  ||  tgtEntry )
+      else if ( (srcEntry  ||  tgtEntry)  &&  !f->partitioned )
       {
-         MatchedFileProcess(srcEntry, tgtEntry);
+         MatchedFileProcess(srcEntry, tgtEntry, &f->pending);
       }
    }
+   return FALSE;
+}
+
+
+// Does what is done on the way out of a directory once its entries are done
+static void
+   MatchDirExit(
+      MatchFrame           * f            // i/o-directory
+   )
+{
+   // The directory's time, attributes or removal must wait until all of its
+   // files are done.  Subdirectories have already waited for their own.
+   PipelineDirWait(&f->pending);
+   PrefetchDirDone(&f->pending);
+   ScanAheadDrop(f->level + 1);
+
+   // closed before the exit processing, which may remove the directory
+   if ( gOptions.source.hDir )
+      CloseHandle(gOptions.source.hDir);
+   if ( gOptions.target.hDir )
+      CloseHandle(gOptions.target.hDir);
+   gOptions.source.hDir = f->srcDirUp;
+   gOptions.target.hDir = f->tgtDirUp;
 
    // Pop LIFO stacks by restoring previous stack pointers
-   srcAppend[0] = tgtAppend[0] = L'\0';
+   f->srcAppend[0] = f->tgtAppend[0] = L'\0';
 
-   gOptions.source.dirBuffer.currBlock = srcCurrBlock;
-   if ( (void *) srcCurrBlock != (void *) &gOptions.source.dirBuffer.block )
+   gOptions.source.dirBuffer.currBlock = f->srcCurrBlock;
+   if ( (void *) f->srcCurrBlock != (void *) &gOptions.source.dirBuffer.block )
    {
-      srcCurrBlock->hwmEntry = srcHwm;
-      srcCurrBlock->avail    = srcAvail;
+      f->srcCurrBlock->hwmEntry = f->srcHwm;
+      f->srcCurrBlock->avail    = f->srcAvail;
    }
 
-   gOptions.target.dirBuffer.currBlock = tgtCurrBlock;
-   if ( (void *) tgtCurrBlock != (void *) &gOptions.target.dirBuffer.block )
+   gOptions.target.dirBuffer.currBlock = f->tgtCurrBlock;
+   if ( (void *) f->tgtCurrBlock != (void *) &gOptions.target.dirBuffer.block )
    {
-      tgtCurrBlock->hwmEntry = tgtHwm;
-      tgtCurrBlock->avail    = tgtAvail;
+      f->tgtCurrBlock->hwmEntry = f->tgtHwm;
+      f->tgtCurrBlock->avail    = f->tgtAvail;
    }
 
-   gOptions.source.dirBuffer.currIndex = srcCurrIndex;
-   gOptions.target.dirBuffer.currIndex = tgtCurrIndex;
+   gOptions.source.dirBuffer.currIndex = f->srcCurrIndex;
+   gOptions.target.dirBuffer.currIndex = f->tgtCurrIndex;
 
    DisplayPathOffset(gOptions.target.path);
 
-   if ( tgtDirEntry )
+   if ( f->tgtDirEntry )
       // do target dirs on way up in case of deletion
-      MatchedDirTgtExists(srcDirEntry, tgtDirEntry);
+      MatchedDirTgtExists(f->srcDirEntry, f->tgtDirEntry, ChangeCount() != f->nChanges);
    else
       // Takes care of dir attributes that can't be set at dir creation time
-      MatchedDirNoTgtExit(srcDirEntry);
+      MatchedDirNoTgtExit(f->srcDirEntry);
+   FlushDirDone(&f->pending, gOptions.target.apipath);
+   JournalDirDone(gOptions.source.path, f->nErrors);
+   if ( f->seedTop )
+      seeded = FALSE;
+}
 
+
+// matches the source and target ordered lists of DirEntry objects within a directory.
+// takes action depending upon whether both names match
+// Processes subdirectories depth first from a stack of MatchFrames, one per
+// level, so the depth of the tree costs no thread stack.
+short _stdcall                            // ret-0=success
+   MatchEntries(
+      short                  level       ,// in -current recursion/directory level
+      DirEntry             * srcDirEntry ,// in -source dir entry
+      DirEntry             * tgtDirEntry  // in -target dir entry
+   )
+{
+   MatchFrame              * frame,       // one per level below this one, and its own
+                           * f;
+   DirEntry                * srcSub,
+                           * tgtSub;
+   int                       depth = 0,
+                             rc,
+                             rcSub;
+
+   frame = (MatchFrame *)malloc((max(gOptions.maxLevel - level, 0) + 1) * sizeof *frame);
+   if ( !frame )
+   {
+      err.MsgWrite(50201, L"Walk frame allocation failed");
+      return ERROR_NOT_ENOUGH_MEMORY;
+   }
+   frame->level       = level;
+   frame->srcDirEntry = srcDirEntry;
+   frame->tgtDirEntry = tgtDirEntry;
+   if ( MatchDirEnter(frame, &rc) != MATCH_Walk )
+   {
+      free(frame);
+      return rc;
+   }
+
+   while ( depth >= 0 )
+   {
+      f = &frame[depth];
+      if ( MatchDirNext(f, &srcSub, &tgtSub) )
+      {
+         f[1].level       = f->level + 1;
+         f[1].srcDirEntry = srcSub;
+         f[1].tgtDirEntry = tgtSub;
+         if ( MatchDirEnter(&f[1], &rcSub) == MATCH_Walk )
+            depth++;
+      }
+      else
+      {
+         MatchDirExit(f);
+         depth--;
+      }
+   }
+   free(frame);
    return 0;
 }
@@ -0,0 +1,133 @@
+/*
+===============================================================================
+
+  Module     - Meta
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Applies the metadata changes of a target file or directory,
+               last write time, attributes and compression state, as one
+               batch through one open handle.  The callers used to set the
+               time on one handle, close it, then set the attributes by path
+               and open the object yet again to change its compression, each
+               a full path lookup and open of its own.
+
+               A MetaChange collects what is to change.  MetaApply applies it
+               to a handle the caller already has open, such as a copy's
+               target, and MetaSet opens the object once for just the access
+               needed, relative to its directory when the walk has it open.
+               Compression goes first as its FSCTL needs data access that a
+               read-only attribute would deny; the time and the attributes
+               then go together in a single FileBasicInfo call, zero fields
+               being left unchanged.  Permissions are still replicated by
+               PermReplicate through the security APIs.
+  Updates -
+
+===============================================================================
+*/
+
+#include "netditto.hpp"
+
+// attributes that can be set through FILE_BASIC_INFO; the others are changed
+// with their own APIs or are not ours to set
+#define META_AttrSettable    ( FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN  \
+                             | FILE_ATTRIBUTE_SYSTEM   | FILE_ATTRIBUTE_ARCHIVE \
+                             | FILE_ATTRIBUTE_TEMPORARY | FILE_ATTRIBUTE_OFFLINE \
+                             | FILE_ATTRIBUTE_NOT_CONTENT_INDEXED )
+
+
+// Applies the changes through an open handle of the target, which needs
+// FILE_WRITE_ATTRIBUTES and, to change compression, data access too
+DWORD _stdcall                            // ret-0 or last error
+   MetaApply(
+      HANDLE                 handle      ,// in -target handle
+      MetaChange const     * change      ,// in -changes to apply
+      WCHAR const          * tgtApiPath  ,// in -target path with \\?\ prefix
+      WCHAR const          * tgtPath      // in -target path for messages
+   )
+{
+   FILE_BASIC_INFO           basic;
+   DWORD                     rc = 0;
+
+   // the read-only attribute is left to the basic info that follows
+   if ( change->fields & META_Compress )
+      if ( !CompressionSet(INVALID_HANDLE_VALUE, handle,
+                           change->attr & ~FILE_ATTRIBUTE_READONLY,
+                           change->srcApiPath, tgtApiPath) )
+         rc = ERROR_INVALID_FUNCTION;
+
+   if ( !(change->fields & (META_Time | META_Attr)) )
+      return rc;
+   memset(&basic, 0, sizeof basic);
+   if ( change->fields & META_Time )
+   {
+      basic.LastWriteTime.LowPart  = change->ftimeLastWrite.dwLowDateTime;
+      basic.LastWriteTime.HighPart = change->ftimeLastWrite.dwHighDateTime;
+   }
+   if ( change->fields & META_Attr )
+   {
+      basic.FileAttributes = change->attr & META_AttrSettable;
+      if ( !basic.FileAttributes )
+         basic.FileAttributes = FILE_ATTRIBUTE_NORMAL;
+   }
+   if ( !SetFileInformationByHandle(handle, FileBasicInfo, &basic, sizeof basic) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(41401, rc, L"SetFileInformationByHandle(%s,%lX)=%ld ",
+                             tgtPath, change->fields, rc);
+   }
+   return rc;
+}
+
+
+// Opens the target once for the access the changes need and applies them
+DWORD _stdcall                            // ret-0 or last error
+   MetaSet(
+      HANDLE                 hDir        ,// in -target's directory, NULL for by path
+      MetaChange const     * change      ,// in -changes to apply
+      WCHAR const          * tgtApiPath  ,// in -target path with \\?\ prefix
+      WCHAR const          * tgtPath      // in -target path for messages
+   )
+{
+   HANDLE                    handle;
+   MetaChange                reset;       // changes plus restoring a cleared read-only
+   DWORD                     rc,
+                             access = FILE_WRITE_ATTRIBUTES,
+                             flags  = 0;
+
+   if ( !change->fields )
+      return 0;
+   if ( change->fields & META_Compress )
+      access |= FILE_READ_DATA | FILE_WRITE_DATA;
+   if ( change->attr & FILE_ATTRIBUTE_DIRECTORY
+     || gOptions.global & (OPT_GlobalBackup | OPT_GlobalBackupForce) )
+      flags = FILE_FLAG_BACKUP_SEMANTICS;
+
+   handle = RelCreateFile(hDir, tgtApiPath, access,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                          OPEN_EXISTING, flags);
+   if ( handle == INVALID_HANDLE_VALUE
+     && GetLastError() == ERROR_ACCESS_DENIED  &&  access != FILE_WRITE_ATTRIBUTES )
+   {
+      // a read-only file denies data access; clear it, open again and have
+      // the attributes set back with the rest
+      if ( RelSetFileAttributes(hDir, tgtApiPath, FILE_ATTRIBUTE_NORMAL) )
+      {
+         handle = RelCreateFile(hDir, tgtApiPath, access,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                OPEN_EXISTING, flags);
+         reset = *change;
+         reset.fields |= META_Attr;
+         change = &reset;
+      }
+   }
+   if ( handle == INVALID_HANDLE_VALUE )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(21402, rc, L"CreateFileMeta(%s)=%ld ", tgtPath, rc);
+      return rc;
+   }
+   rc = MetaApply(handle, change, tgtApiPath, tgtPath);
+   CloseHandle(handle);
+   return rc;
+}
@@ -14,6 +14,12 @@
                options that resolve conflicts and special situations.
 
   Updates -
+  26/10/19 TPB Look up the NT entry points for relative opens.
+  26/10/19 TPB Apply the deferred directory time fixups after the walk.
+  26/10/19 TPB End the purge workers after the walk.
+  26/10/19 TPB Start and wait for the /trash reaper.
+  26/10/19 TPB End the seed workers after the walk.
+  26/10/19 TPB Start and end the ScanAhead directory readers.
 
 ===============================================================================
 */
@@ -78,13 +84,41 @@ int
    if ( gOptions.spaceMinFree  ||  gOptions.spaceInterval )
       SpaceCheckStart();
 
+   RelOpenInit();
+   XformStart();
+   VerifyStart();
+   FlushStart();
+   PrefetchStart();
+   PipelineStart();
+   JournalStart();
+   SweepStart();
+   TrashStart();
+   ScanAheadStart();
    MatchEntries(0, srcEntry, tgtEntry);
+   if ( SweepWrap() )                     // round again from the top to the cursor
+      MatchEntries(0, srcEntry, tgtEntry);
+   ScanAheadTerminate();
+   PipelineTerminate();
+   PurgeTerminate();
+   SeedTerminate();
+   TrashTerminate();
+   DirTimeFixup();
+   XformTerminate();
+   VerifyTerminate();
+   PrefetchTerminate();
+   FlushTerminate();
+   JournalTerminate();
+   SweepTerminate();
 
    gOptions.fState |= FLAG_Shutdown;
    StatsTimerTerminate();
    if ( gOptions.spaceMinFree  ||  gOptions.spaceInterval )
       SpaceCheckTerminate();
    DisplayTime();
+   IoTuneReport(&gOptions.source, L"source");
+   IoTuneReport(&gOptions.target, L"target");
+   FlushReport();
+   VerifyReport();
    time(&t);
    err.MsgWrite(0, L"End time=%-.24s", _wctime(&t));
    DisplayInit(0);
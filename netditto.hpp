@@ -86,10 +86,48 @@ struct Property                          // Actions for dir/file properties
 #define OPT_GlobalNameCase   0x00010000  // make name case significant when different
 #define OPT_GlobalReadComp   0x00020000  // read source compression type for target repl
 #define OPT_DirFilter        0x00040000  // directory include/exclude filter set
+#define OPT_GlobalIoTune     0x00080000  // adapt I/O block size/depth to measured rates
+#define OPT_GlobalNoCache    0x00100000  // copy file data around the system file cache
+#define OPT_GlobalLargePages 0x00200000  // I/O buffers in large pages
+#define OPT_GlobalLockBuf    0x00400000  // I/O buffers locked in memory
+#define OPT_GlobalMmap       0x00800000  // memory mapped copy/compare of medium files
+#define OPT_GlobalKernelCopy 0x01000000  // copy file data with the system copy engine
+#define OPT_GlobalCrc        0x02000000  // log the CRC-32C of each file copied
+#define OPT_GlobalVerify     0x04000000  // read back copied files and compare CRCs
+#define OPT_GlobalDigest     (OPT_GlobalCrc | OPT_GlobalVerify) // CRC computed while copied
+#define OPT_GlobalResume     0x08000000  // large file copies checkpointed and resumed
+#define OPT_GlobalTrash      0x10000000  // removed subtrees moved to a trash and reaped
+#define OPT_GlobalSeed       0x20000000  // missing subtrees' directories made ahead of the walk
+#define OPT_GlobalScanAhead  0x40000000  // directories read ahead of the walk
+#define MMAP_Min             (64*1024)           // smallest file /mmap applies to
+#define MMAP_Max             (64*1024*1024)      // largest file /mmap applies to
+#define NOCACHE_Align        4096        // unbuffered write size multiple with /nocache
+#define RESUME_Min           ((__int64)128*1024*1024) // smallest file /resume applies to
 
 #define FLAG_Shutdown        (1 << 0)    // Shutdown program
 #define FLAG_SameVolume      (1 << 1)    // source and target on same volume name
 #define FLAG_OverlappedScan  (1 << 2)    // overlapped directory scanning
+#define FLAG_Pipeline        (1 << 3)    // file actions run by pipeline workers
+#define FLAG_Prefetch        (1 << 4)    // small source files are prefetched
+#define FLAG_Flush           (1 << 5)    // target files flushed per /sync=
+#define FLAG_Xform           (1 << 6)    // transform worker threads running
+#define FLAG_Verify          (1 << 7)    // verifier thread running
+#define FLAG_Journal         (1 << 8)    // finished directories journalled
+#define FLAG_Sweep           (1 << 9)    // walk is a budgeted, resumable sweep
+
+#define SWEEP_Skip           0           // SweepEntry: before the cursor
+#define SWEEP_Process        1           // SweepEntry: process the entry
+#define SWEEP_Stop           2           // SweepEntry: budget or lap done
+
+#define SYNC_None            0           // /sync=none - left to the lazy writer
+#define SYNC_File            1           // /sync=file - each file flushed
+#define SYNC_Group           2           // /sync=group - flushed in directory batches
+
+#define STRIPE_MinDefault    ((__int64)256*1024*1024) // default /stripemin= size
+#define PREFETCH_MemDefault  ((__int64)32*1024*1024)  // default /prefetchmem= size
+#define DIRMEM_Default       ((__int64)64*1024*1024)  // default /scanmem= size
+
+#define DIRGET_Spill         ((DWORD)-2) // DirGet: directory over /spill=, left to Spill
 
 #define DIR_IndexSize        (1024*2)    // Initial DirIndex allocation size
 #define DIR_BlockSize        (1024*512)  // Default DirBlock allocation size
@@ -164,6 +202,15 @@ typedef struct
    StatsCommon               target;
 }                         Stats;
 
+typedef struct               // /sync= flush counts and costs
+{
+   long                      nFile;      // files flushed
+   long                      nDir;       // directories flushed
+   long                      nVolume;    // volumes flushed
+   __int64                   ticksFlush; // perf counter ticks spent flushing
+   __int64                   ticksWait;  // perf counter ticks copies waited on flushes
+}                         FlushStats;
+
 //-----------------------------------------------------------------------------
 // Bi-directional queue structures.
 //-----------------------------------------------------------------------------
@@ -274,6 +321,38 @@ struct DirBuffer
    DirIndex                * currIndex;  // current DirIndex
 };
 
+//-----------------------------------------------------------------------------
+// Adaptive I/O tuning.  Each volume carries the overlapped I/O block size,
+// number of outstanding I/Os and the size at which a file is considered
+// "large" (and thus copied with overlapped I/O).  With /tune, these are
+// adjusted by a hill-climbing controller fed by the throughput and per-I/O
+// latency measured while copying.  See IoTune.cpp.
+//-----------------------------------------------------------------------------
+#define IOTUNE_BlockDefault  (32*1024)    // overlapped I/O block size default
+#define IOTUNE_LargeDefault  (256*1024)   // large file threshold default
+#define IOTUNE_BufferSize    (1<<22)      // copy buffer size with /tune
+
+struct IoTune                            // adaptive I/O parameters for a volume
+{
+   DWORD                     cbBlock;    // overlapped I/O block size
+   DWORD                     nDepth;     // overlapped I/Os outstanding
+   __int64                   cbLargeFile;// files this size or more use overlapped I/O
+   DWORD                     cbBlockMin; // smallest block size the volume allows
+   DWORD                     cbBlockPrev;// block size before current probe
+   DWORD                     nDepthPrev; // depth before current probe
+   __int64                   wBytes;     // bytes transferred in current window
+   __int64                   wTicks;     // transfer time in current window
+   __int64                   wLatency;   // sum of per-I/O latency in current window
+   DWORD                     wIO;        // I/Os completed in current window
+   DWORD                     nWindow;    // measurement windows completed
+   DWORD                     nFail;      // consecutive probes without a gain
+   double                    rate;       // bytes/sec at current settings
+   double                    latency;    // smoothed per-I/O latency in seconds
+   short                     probe;      // current probe (parameter/direction)
+   bool                      probing;    // last window measured a probe
+   bool                      settled;    // no probe direction improved the rate
+};
+
 struct DirOptions
 {
    __int64                   cbVolTotal;     // total bytes on volume
@@ -288,11 +367,14 @@ struct DirOptions
    WCHAR                     volName[MAX_PATH];// volume name (drive or UNC)
    bool                      bUNC;           // UNC form name? UNC\server\share 
    DirBuffer                 dirBuffer;      // directory buffer
+   IoTune                    tune;           // adaptive I/O parameters
+   HANDLE                    hDir;           // walk's current directory for relative opens, NULL=none
 };
 
 struct Options                           // main object of system containing processed parms and data structs
 {
    __int64                   bWritten;   // bytes  written for stats display
+   LONG volatile             nRenamed;   // target names changed in place, for ChangeCount
    __int64                   spaceMinFree; // space free minimum
    FileList                * include;    // list of filespecs to include
    FileList                * exclude;    // list of filespecs to exclude
@@ -302,6 +384,20 @@ struct Options                           // main object of system containing pro
 // char                      spaceDrive;   // space check drive letter
    DWORD                     sizeBuffer; // copy buffer size
    short                     maxLevel;   // max directory recursion level
+   short                     nStripe;    // workers per striped file copy (0/1=none)
+   short                     nPipe;      // file action pipeline workers (0=inline)
+   short                     nPrefetch;  // source files prefetched ahead (0=none)
+   short                     syncMode;   // SYNC_None, SYNC_File or SYNC_Group
+   __int64                   cbPrefetchMax;// bytes of prefetched files held at most
+   __int64                   cbDirMemMax;// /scanmem= directory entry memory ScanAhead and spills keep to
+   __int64                   cbSpillMin; // /spill= directory size spilled to disk (0=never)
+   __int64                   cbStripeMin;// file size at which copies are striped
+   WCHAR const             * manifest;   // /manifest= file of verified CRCs, NULL=none
+   WCHAR const             * journal;    // /journal= restart journal file, NULL=none
+   WCHAR const             * cursor;     // /cursor= sweep cursor file, NULL=none
+   long                      sweepMinutes;// /maxtime= sweep time budget (0=none)
+   __int64                   sweepBytes; // /maxbytes= sweep write budget (0=none)
+   long                      reapMinutes;// /reaptime= trash reaper wait after the walk (-1=none)
    DirOptions                source;     // source options including current path and directory buffer
    DirOptions                target;     // target options including current path and directory buffer
    Property                  dir;        // actions for dir/properties
@@ -309,6 +405,7 @@ struct Options                           // main object of system containing pro
    DWORD                     fState;     // status flags
    DWORD                     global;     // global actions
    Stats                     stats;      // statistics
+   FlushStats                flush;      // /sync= statistics
    DWORD                     findAttr;   // DosFind attribute
    DWORD                     sizeDirBuff;// Directory buffer size
    DWORD                     sizeDirIndex;// Directory index size
@@ -318,15 +415,116 @@ struct Options                           // main object of system containing pro
    WIN32_STREAM_ID         * unsecure;   // backup stream to unsecure object for deletion
 };
 
+//-----------------------------------------------------------------------------
+// A file level action (create, update, compare or remove) along with the
+// paths, copy buffer and statistics it runs with.  Run inline by the walk,
+// these are gOptions' own.  With /pipe, the walk hands a copy of the entries
+// and paths to a pipeline worker that supplies its own buffer and statistics
+// and the action counts against its directory's pending actions.
+//-----------------------------------------------------------------------------
+struct LogBuffer                         // log lines held to be written in order
+{
+   WCHAR                   * text;       // lines, each NUL terminated
+   size_t                    cch;        // chars used
+   size_t                    cchAlloc;   // chars allocated
+};
+
+struct FileAction
+{
+   DirEntry const          * srcEntry;   // source file entry, NULL if none
+   DirEntry const          * tgtEntry;   // target file entry, NULL if none
+   WCHAR const             * srcApiPath; // source path with \\?\ prefix
+   WCHAR const             * tgtApiPath; // target path with \\?\ prefix
+   WCHAR const             * srcPath;    // source path after the prefix
+   WCHAR const             * tgtPath;    // target path after the prefix
+   BYTE                    * copyBuffer; // copy buffer - file contents
+   DWORD                     sizeBuffer; // copy buffer size
+   Stats                   * stats;      // statistics the action is counted in
+   LONG volatile           * pending;    // directory's outstanding pipelined actions,
+                                         // also identifies the directory
+   HANDLE                    srcDir;     // source directory for relative opens, NULL=by path
+   HANDLE                    tgtDir;     // target directory for relative opens, NULL=by path
+   LogBuffer               * log;        // detail lines held for ordered output, NULL=written
+};
+
+struct ResumeState                       // /resume state of a large file copy
+{
+   __int64                   cbDone;     // bytes known written, where the copy starts
+   __int64                   cbCkpt;     // bytes written at the last checkpoint
+   WCHAR                   * partApiPath;// part file \\?\ path
+   WCHAR                   * ckptApiPath;// checkpoint file \\?\ path
+};
+
+#define META_Time            0x01        // MetaChange fields: last write time
+#define META_Attr            0x02        // attributes
+#define META_Compress        0x04        // compression state per the attributes
+
+struct MetaChange                        // metadata to apply to a target object
+{
+   DWORD                     fields;     // META_ flags of what is changed
+   DWORD                     attr;       // source attributes
+   FILETIME                  ftimeLastWrite; // source last write time
+   WCHAR const             * srcApiPath; // source path to read compression from
+};
+
+struct XformState                        // a file's transform state, in file order
+{
+   DWORD                     crc;        // CRC-32C so far, inverted
+   __int64                   cbFile;     // bytes in the CRC so far
+};
+
+struct XformJob                          // block queued for a transform worker
+{
+   XformJob                * next;
+   BYTE                    * buffer;     // block
+   DWORD                     cb;         // block size
+   XformState              * state;      // file's transform state
+   HANDLE                    evDone;     // set when transformed
+};
+
 //-----------------------------------------------------------------------------
 // Prototypes
 //-----------------------------------------------------------------------------
 
-DWORD _stdcall                             // ret-0=success -1=overflow +=error
+DWORD _stdcall                             // ret-0=success -1=overflow
+                                           //    DIRGET_Spill=too big +=error
    DirGet(
       DirOptions           * dir         ,// i/o-directory data and options
       StatsCommon          * stats       ,// i/o-dir level statistics
-      DirEntry           *** dirArray     // out-array of DirEntry pointers
+      DirEntry           *** dirArray    ,// out-array of DirEntry pointers
+      BOOL                 * unsorted     // out-array left for the caller to sort,
+                                          //     NULL=sorted here
+   );
+
+DirEntry * _stdcall                        // ret-entry to be filled in
+   DirBufferAdd(
+      DirOptions           * dir         ,// i/o-directory data and options
+      size_t                 cbDirEntry   // in -length of the entry
+   );
+
+DirEntry ** _stdcall                       // ret-array of DirEntry pointers
+   DirIndexBuild(
+      DirOptions           * dir         ,// i/o-directory data and options
+      DirBlock             * orgCurrBlock,// in -block of the first entry
+      DirEntry             * orgHwm      ,// in -first entry, or where it would have been
+      DWORD                  dirCount     // in -entries added
+   );
+
+void _stdcall
+   DirSort(
+      DirEntry            ** index       ,// i/o-index array
+      DWORD                  n            // in -entries
+   );
+
+HANDLE _stdcall
+   DirSortStart(
+      DirEntry            ** index       ,// i/o-index array
+      DWORD                  n            // in -entries
+   );
+
+void _stdcall
+   DirSortWait(
+      HANDLE                 hThread      // in -from DirSortStart, NULL if none
    );
 
 short _stdcall
@@ -390,19 +588,56 @@ void _stdcall
    );
 */
 
+WCHAR * _stdcall
+   AttrStr(
+      DWORD                  attr        ,// in -file/dir attribute
+      WCHAR                * retStr       // out-return attribute string
+   );
 DWORD _stdcall
    FileContentsCompare(
+      FileAction const     * action       // in -file action
    );
 
 DWORD _stdcall
    FileCopy(
-      DirEntry const       * srcEntry    ,// in -source directory entry
-      DirEntry const       * tgtEntry     // in -target directory entry
+      FileAction const     * action       // in -file action
    );
 DWORD _stdcall
    FileCopyContentsOverlapped(
+      FileAction const     * action      ,// in -file action
+      HANDLE                 hSrc        ,// in -source file handle
+      HANDLE               * hTgt        ,// i/o-target file handle
+      ResumeState          * resume       // i/o-/resume checkpoint state, NULL if none
+   );
+DWORD _stdcall
+   FileCopyKernel(
+      FileAction const     * action       // in -file action
+   );
+DWORD _stdcall
+   FileCopyMapped(
+      FileAction const     * action      ,// in -file action
       HANDLE                 hSrc        ,// in -source file handle
-      HANDLE               * hTgt         // i/o-target file handle
+      HANDLE                 hTgt         // in -target file handle
+   );
+DWORD _stdcall
+   FileContentsCompareMapped(
+      FileAction const     * action       // in -file action
+   );
+DWORD _stdcall
+   FileCopySmall(
+      FileAction const     * action       // in -file action
+   );
+DWORD _stdcall
+   FileEndSet(
+      FileAction const     * action      ,// in -file action
+      HANDLE                 hTgt        ,// in -target file handle
+      __int64                cbFile       // in -true file size
+   );
+DWORD _stdcall
+   FileCopyStriped(
+      FileAction const     * action      ,// in -file action
+      HANDLE                 hSrc        ,// in -overlapped source file handle
+      HANDLE                 hTgt         // in -overlapped target file handle
    );
 DWORD _stdcall
    FileBackupCopy(
@@ -435,13 +670,20 @@ short _stdcall                            // ret-0=success
 DWORD _stdcall
    MatchedFileProcess(
       DirEntry const       * srcEntry    ,// in -current source entry processed
-      DirEntry const       * tgtEntry     // in -current target entry processed
+      DirEntry const       * tgtEntry    ,// in -current target entry processed
+      LONG volatile        * pending      // i/o-directory's outstanding pipelined actions
+   );
+
+DWORD _stdcall
+   FileActionProcess(
+      FileAction const     * action       // in -file action
    );
 
 DWORD _stdcall
    MatchedDirTgtExists(
       DirEntry const       * srcEntry    ,// in -current source entry processed
-      DirEntry const       * tgtEntry     // in -current target entry processed
+      DirEntry const       * tgtEntry    ,// in -current target entry processed
+      BOOL                   changed      // in -anything in the subtree changed
    );
 
 DWORD _stdcall
@@ -451,7 +693,8 @@ DWORD _stdcall
 
 DWORD _stdcall
    MatchedDirNoTgt(
-      DirEntry const       * srcEntry     // in -current source entry processed
+      DirEntry const       * srcEntry    ,// in -current source entry processed
+      BOOL                   made         // in -directory already made by SeedTree
    );
 
 void _stdcall
@@ -522,11 +765,458 @@ BOOL
    CompressionSet(
       HANDLE                 hSrc         ,// in -source dir/file handle
       HANDLE                 hTgt         ,// in -target dir/file handle (if open)
-      DWORD                  attr          // in -target file/dir attribute
+      DWORD                  attr         ,// in -target file/dir attribute
+      WCHAR const          * srcApiPath   ,// in -source path if no source handle
+      WCHAR const          * tgtApiPath    // in -target path if no target handle
+   );
+
+DWORD _stdcall                            // ret-0 or last error
+   MetaApply(
+      HANDLE                 handle      ,// in -target handle
+      MetaChange const     * change      ,// in -changes to apply
+      WCHAR const          * tgtApiPath  ,// in -target path with \\?\ prefix
+      WCHAR const          * tgtPath      // in -target path for messages
+   );
+
+DWORD _stdcall                            // ret-0 or last error
+   MetaSet(
+      HANDLE                 hDir        ,// in -target's directory, NULL for by path
+      MetaChange const     * change      ,// in -changes to apply
+      WCHAR const          * tgtApiPath  ,// in -target path with \\?\ prefix
+      WCHAR const          * tgtPath      // in -target path for messages
+   );
+
+DWORD _stdcall                            // ret-0 or last error
+   DirTimeQueue(
+      MetaChange const     * change      ,// in -changes to apply
+      WCHAR const          * tgtApiPath  ,// in -directory path with \\?\ prefix
+      WCHAR const          * tgtPath      // in -directory path for messages
+   );
+
+void _stdcall
+   DirTimeFixup(
+   );
+
+BOOL _stdcall
+   PurgeUse(
+   );
+
+DWORD _stdcall
+   PurgeTree(
+      short                  level       ,// in -recursion level of the directory
+      DirEntry const       * tgtDirEntry  // in -target directory entry
+   );
+
+void _stdcall
+   PurgeTerminate(
+   );
+
+BOOL _stdcall
+   PartUse(
+      DWORD                  nSrc        ,// in -source index entries
+      DWORD                  nTgt         // in -target index entries
+   );
+
+DWORD _stdcall
+   PartMerge(
+      DirEntry            ** srcIndex    ,// in -source index, NULL if none
+      DWORD                  nSrc        ,// in -source index entries
+      DirEntry            ** tgtIndex    ,// in -target index, NULL if none
+      DWORD                  nTgt        ,// in -target index entries
+      LONG volatile        * pending      // in -directory's pending actions, its id
+   );
+
+void __cdecl
+   LogBufferAdd(
+      LogBuffer            * log         ,// i/o-log buffer
+      WCHAR const          * fmt         ,// in -format
+      ...                                 // in -arguments
+   );
+
+void _stdcall
+   HiddenSemanticsSet(
+      DirEntry            ** srcEntry    ,// i/o-source dir entry addr
+      DirEntry            ** tgtEntry     // i/o-target dir entry addr
+   );
+
+BOOL _stdcall
+   SeedUse(
+   );
+
+DWORD _stdcall
+   SeedTree(
+      short                  level        // in -recursion level of the directory
+   );
+
+void _stdcall
+   SeedTerminate(
+   );
+
+struct ScanDir;                           // directory read ahead, see ScanAhead.cpp
+
+void _stdcall
+   ScanAheadStart(
+   );
+
+DWORD _stdcall
+   ScanAheadRoom(
+      short                  level        // in -recursion level
+   );
+
+void _stdcall
+   ScanAheadQueue(
+      DirOptions const     * side        ,// in -&gOptions.source or &gOptions.target
+      size_t                 cchDir      ,// in -length of the directory's \\?\ path
+      WCHAR const          * name        ,// in -subdirectory name
+      short                  level        // in -recursion level of the subdirectory
+   );
+
+ScanDir * _stdcall
+   ScanAheadTake(
+      DirOptions const     * side         // in -directory with its current path
+   );
+
+BOOL _stdcall
+   ScanAheadNext(
+      ScanDir              * scan        ,// i/o-listing
+      WIN32_FIND_DATA      * fd           // out-entry
+   );
+
+void _stdcall
+   ScanAheadFree(
+      ScanDir              * scan         // in -listing from ScanAheadTake
+   );
+
+void _stdcall
+   ScanAheadDrop(
+      short                  level        // in -recursion level
+   );
+
+void _stdcall
+   ScanAheadTerminate(
+   );
+
+DWORD _stdcall
+   SpillRead(
+      BOOL                   src         ,// in -source is to be read
+      BOOL                   tgt          // in -target is to be read
+   );
+
+void _stdcall
+   SpillJoin(
+      DirEntry           *** srcIndex    ,// out-source subdirectories, NULL if not read
+      DirEntry           *** tgtIndex    ,// out-target subdirectories, NULL if not read
+      LONG volatile        * pending      // i/o-directory's pending actions
+   );
+
+void _stdcall
+   TrashStart(
+   );
+
+BOOL _stdcall
+   TrashIs(
+      WCHAR const          * name         // in -target root entry name
+   );
+
+BOOL _stdcall
+   TrashMove(
+      short                  level       ,// in -recursion level of the directory
+      DirEntry const       * tgtDirEntry  // in -target directory entry
+   );
+
+void _stdcall
+   TrashTerminate(
+   );
+
+void _stdcall
+   PipelineStart(
+   );
+
+void _stdcall
+   PipelineTerminate(
+   );
+
+void _stdcall
+   PipelineStatsMerge(
+      Stats                * stats        // i/o-worker or range statistics
+   );
+
+DWORD _stdcall
+   PipelineSubmit(
+      DirEntry const       * srcEntry    ,// in -current source entry processed
+      DirEntry const       * tgtEntry    ,// in -current target entry processed
+      LONG volatile        * pending      // i/o-directory's outstanding pipelined actions
+   );
+
+void _stdcall
+   PipelineDirWait(
+      LONG volatile        * pending      // i/o-directory's outstanding pipelined actions
+   );
+
+void _stdcall
+   BufPoolInit(
+   );
+
+BYTE * _stdcall
+   BufLease(
+      DWORD                  cb           // in -buffer size
+   );
+
+void _stdcall
+   BufReturn(
+      BYTE                 * data         // in -buffer from BufLease, may be NULL
+   );
+
+void _stdcall
+   FlushStart(
+   );
+
+void _stdcall
+   FlushTerminate(
+   );
+
+void _stdcall
+   FlushFileClose(
+      FileAction const     * action      ,// in -file action
+      HANDLE                 hTgt         // in -target file handle
+   );
+
+void _stdcall
+   FlushDirDone(
+      void const           * dir         ,// in -directory (walk frame) id
+      WCHAR const          * tgtApiPath   // in -target directory path
+   );
+
+void _stdcall
+   FlushParentDir(
+      WCHAR const          * tgtApiPath   // in -created/renamed target path
+   );
+
+void _stdcall
+   FlushReport(
+   );
+
+void _stdcall
+   XformApply(
+      BYTE                 * buffer      ,// i/o-block
+      DWORD                  cb          ,// in -block size
+      XformState           * state        // i/o-file's transform state, NULL for XOR only
+   );
+
+DWORD _stdcall
+   XformCrc(
+      DWORD                  crc         ,// in -CRC so far, inverted
+      BYTE const           * p           ,// in -block
+      DWORD                  cb           // in -block size
+   );
+
+void _stdcall
+   XformStart(
+   );
+
+void _stdcall
+   XformTerminate(
+   );
+
+void _stdcall
+   XformSubmit(
+      XformJob             * job         ,// out-job, kept until evDone is set
+      BYTE                 * buffer      ,// i/o-block
+      DWORD                  cb          ,// in -block size
+      XformState           * state       ,// i/o-file's transform state
+      HANDLE                 evDone       // in -auto-reset event to set when done
+   );
+
+void _stdcall
+   XformInit(
+      XformState           * state        // out-file's transform state
+   );
+
+void _stdcall
+   XformReport(
+      FileAction const     * action      ,// in -file action
+      XformState const     * state        // in -file's transform state
+   );
+
+void _stdcall
+   VerifyStart(
+   );
+
+void _stdcall
+   VerifyTerminate(
+   );
+
+void _stdcall
+   VerifyQueue(
+      FileAction const     * action      ,// in -file action
+      XformState const     * state        // in -file's transform state
+   );
+
+void _stdcall
+   VerifyReport(
+   );
+
+DWORD _stdcall
+   ResumeBegin(
+      FileAction const     * action      ,// in -file action
+      ResumeState          * resume       // out-resume state
+   );
+
+void _stdcall
+   ResumeCheckpoint(
+      FileAction const     * action      ,// in -file action writing the part file
+      ResumeState          * resume      ,// i/o-resume state
+      HANDLE                 hPart       ,// in -part file handle
+      __int64                cbDone       // in -bytes written from the start
+   );
+
+DWORD _stdcall                            // ret-copy or rename error code
+   ResumeEnd(
+      FileAction const     * action      ,// in -file action
+      ResumeState          * resume      ,// i/o-resume state, freed
+      HANDLE                 hPart       ,// in -part file handle, closed
+      DWORD                  rc           // in -copy return code
+   );
+
+BOOL _stdcall
+   ResumeFileIs(
+      WCHAR const          * name         // in -file name
+   );
+
+void _stdcall
+   JournalStart(
+   );
+
+void _stdcall
+   JournalTerminate(
+   );
+
+BOOL _stdcall
+   JournalSkip(
+      WCHAR const          * srcPath      // in -source directory path
+   );
+
+void _stdcall
+   JournalDirDone(
+      WCHAR const          * srcPath     ,// in -source directory path
+      long                   nErrorsStart // in -error count when the directory was entered
+   );
+
+void _stdcall
+   SweepStart(
+   );
+
+int _stdcall                              // ret-SWEEP_Skip, SWEEP_Process or SWEEP_Stop
+   SweepEntry(
+      WCHAR const          * srcPath      // in -source entry path
+   );
+
+BOOL _stdcall
+   SweepWrap(
+   );
+
+void _stdcall
+   SweepTerminate(
+   );
+
+void _stdcall
+   RelOpenInit(
+   );
+
+HANDLE _stdcall
+   RelDirOpen(
+      WCHAR const          * apiPath      // in -directory \\?\ path
+   );
+
+HANDLE _stdcall
+   RelCreateFile(
+      HANDLE                 hDir        ,// in -directory handle, NULL for by path
+      WCHAR const          * apiPath     ,// in -file \\?\ path
+      DWORD                  access      ,// in -as for CreateFile
+      DWORD                  share       ,// in -as for CreateFile
+      DWORD                  creation    ,// in -as for CreateFile
+      DWORD                  flagsAttr    // in -as for CreateFile
+   );
+
+BOOL _stdcall
+   RelDeleteFile(
+      HANDLE                 hDir        ,// in -directory handle, NULL for by path
+      WCHAR const          * apiPath      // in -file \\?\ path
+   );
+
+BOOL _stdcall
+   RelSetFileAttributes(
+      HANDLE                 hDir        ,// in -directory handle, NULL for by path
+      WCHAR const          * apiPath     ,// in -file \\?\ path
+      DWORD                  attr         // in -attributes
+   );
+
+struct PrefetchEntry;
+
+void _stdcall
+   PrefetchStart(
+   );
+
+void _stdcall
+   PrefetchTerminate(
+   );
+
+void _stdcall
+   PrefetchAhead(
+      void const           * dir         ,// in -directory (walk frame) id
+      size_t                 cchDir      ,// in -length of source dir \\?\ path
+      DirEntry           *** srcAhead    ,// i/o-next source entry to consider
+      DirEntry            ** srcEnd      ,// in -end of source index
+      DirEntry            ** tgtIndex    ,// in -target index, NULL if none
+      DWORD                  nTgt         // in -target index entries
+   );
+
+PrefetchEntry * _stdcall
+   PrefetchTake(
+      WCHAR const          * srcApiPath  ,// in -source path
+      BYTE                ** data        ,// out-file contents
+      DWORD                * cbData       // out-file size
+   );
+
+void _stdcall
+   PrefetchRelease(
+      PrefetchEntry        * entry        // i/o-entry from PrefetchTake
+   );
+
+void _stdcall
+   PrefetchDirDone(
+      void const           * dir          // in -directory (walk frame) id
    );
 
 BOOL BackupPriviledgeSet();
 
+void _stdcall
+   IoTuneInit(
+      DirOptions           * dirOptions   // i/o-volume whose tuning is initialized
+   );
+
+void _stdcall
+   IoTuneGet(
+      IoTune               * tune        ,// in -volume tuning
+      DWORD                * cbBlock     ,// out-I/O block size
+      DWORD                * nDepth       // out-number of outstanding I/Os
+   );
+
+void _stdcall
+   IoTuneSample(
+      IoTune               * tune        ,// i/o-volume tuning
+      __int64                cbBytes     ,// in -bytes transferred
+      __int64                ticksXfer   ,// in -transfer elapsed perf counter ticks
+      __int64                ticksLatency,// in -sum of per-I/O latency ticks
+      DWORD                  nIO          // in -number of I/Os completed
+   );
+
+void _stdcall
+   IoTuneReport(
+      DirOptions const     * dirOptions  ,// in -volume whose tuning is reported
+      WCHAR const          * name         // in -source/target label
+   );
+
 DWORD
    VolumeGetInfo(
       WCHAR const          * path        ,// in -path string
@@ -327,26 +327,85 @@ static void
              "          e.g., /-u turns off update\n"
              " /a       Make the archive attribute bit significant in processing, both\n"
              "          for compare and replication.  Default is off.\n"
+             " /cursor=path  Save where a /maxtime= or /maxbytes= sweep stopped in\n"
+             "          the file given and continue from there the next run, going\n"
+             "          round to the top of the tree after its end.  The parts of the\n"
+             "          tree recent runs covered and when are logged at the end.\n"
+             " /crc     Log the CRC-32C checksum of the data of each file copied.\n"
+             "          Files are then copied sequentially, not striped, overlapped,\n"
+             "          mapped or by /kcopy.  Default is off.\n"
              " /d       Specify directory object actions.  See /fd section\n"
              " /f       Specify file object actions.  See /fd section\n"
              " /h       Process hidden and system files on target for update and delete.\n"
              "          Default is on.\n"
+             " /hugepages Allocate the I/O buffers in large pages, which needs the\n"
+             "          lock pages in memory privilege.  Default is off.\n"
+             " /journal=path  Record each directory finished without error in the\n"
+             "          journal given.  Rerun with the same journal, source and target\n"
+             "          after an interruption, the finished directories are skipped.\n"
+             "          The journal is deleted when a run completes without error.\n"
+             " /kcopy   Copy file data with the system's copy engine (CopyFile2) so it\n"
+             "          never passes through NetDitto, using server side and offloaded\n"
+             "          copies where the volumes support them.  Not used with /xor,\n"
+             "          /stripe or compression changes.  Default is off.\n"
              " /l	      Specifies that logging will take place.  The /l may be immediately\n"
              "          (no space) followed by a space specifying the path/name of the log\n"
              "          file.  Otherwise, 'NetDitto.log' is the default name in the\n"
              "          current working drive/directory.\n"
+             " /maxbytes=size  Stop the walk cleanly once this much has been written,\n"
+             "          e.g., 500g.  See /cursor=.  Default is no limit.\n"
+             " /maxtime=n  Stop the walk cleanly after n minutes.  See /cursor=.\n"
+             "          Default is no limit.\n"
+             " /manifest=path  Write the CRC-32C, size and path of each file verified\n"
+             "          to the path given.  Implies /verify.\n"
              " /m       Make (create ala MkDir) the dest directory if it does not exist.\n"
+             " /mmap    Copy and compare files of 64k to 64m memory mapped, saving the\n"
+             "          copies through the copy buffer.  Not used with /xor.  Default\n"
+             "          is off.\n"
              " /n       Newer:  Only consider target files different when source is newer\n"
              "          as determined by examing the file time/date last written.  Default\n"
              "          is on.\n"
+             " /nocache Copy file data without going through the system file cache so\n"
+             "          that bulk copies don't evict other applications' cached data\n"
+             "          or leave masses of dirty pages to be written.  Default is off.\n"
              " /o       Optimize:  Consider files with the same timestamp and size to be\n"
              "          identical.  Default is on.\n"
+             " /pipe=n  Copy, compare and remove files with n (1-64) worker threads\n"
+             "          while the directory walk continues, keeping many files in\n"
+             "          flight on high latency targets.  Not used with /backup.\n"
+             "          Default is 0 (off).\n"
+             " /pinbuf  Lock the I/O buffers in memory so they are never paged out.\n"
+             "          Default is off.\n"
+             " /prefetch=n  Read up to n upcoming small source files ahead into memory\n"
+             "          while earlier ones are written, hiding source seek and first\n"
+             "          byte latency.  Default is 0 (off).\n"
+             " /prefetchmem=size  Most memory held by /prefetch, e.g., 64m.  Default\n"
+             "          is 32m.\n"
              " /r       Process read-only target files (i.e., for delete/update actions).\n"
              "          With this turned off, read-only target files are not considered\n"
              "          for any processing, including comparison.  Default is on.\n"
+             " /reaptime=n  Wait at most n minutes for the /trash reaper once the\n"
+             "          walk is done, leaving the rest to the next /trash run.\n"
+             "          Default is no limit.\n"
+             " /resume  Copy files of 128m or more to a part file, checkpointed as it\n"
+             "          goes, and rename it into place once complete.  An interrupted\n"
+             "          copy carries on from its last checkpoint on the next run.\n"
+             "          Not used with /crc or /verify.  Default is off.\n"
              " /s       Display status and statistics display in real time.  When this\n"
              "          is turned off, no status and statistics are displayed.  \n"
              "          Default is on.\n"
+             " /scanahead Read the next subdirectories the walk will enter in the\n"
+             "          background, several siblings at once, so their entries are\n"
+             "          ready when it gets to them.  See /scanmem=.  Default is off.\n"
+             " /scanmem=size  Limit on directory entry memory, e.g., 256m.  No\n"
+             "          directory is read ahead by /scanahead while the entries held,\n"
+             "          read ahead or by the walk, reach it.  With /spill=, a directory\n"
+             "          whose entries would grow the walk's past it is spilled too;\n"
+             "          without, the walk's own are not capped.  Default is 64m.\n"
+             " /seed    Make all the directories of a subtree missing from the target\n"
+             "          at once, in parallel and breadth first, before its files are\n"
+             "          copied into them.  Use with /pipe= to copy the files\n"
+             "          concurrently too.  Default is off.\n"
              " /sd      Show detail status information on the bottom line of screen.\n"
              "          Default is on.\n"
              " /sm      Show detail matched information (no differences detected) on the\n"
@@ -357,8 +416,34 @@ static void
              "          actions specified (i.e., directory attribute update).  Without\n"
              "          this, target directories retain their timestamps and get the\n"
              "          current timestamp when created.  Default is on.\n"
+             " /spill=size  Directories whose entries would take more memory than\n"
+             "          this are read into sorted runs in temporary files and merged\n"
+             "          from them rather than held whole, e.g., 256m.  Not used in a\n"
+             "          sweep.  Default is off.\n"
+             " /stripe=n Copy files of /stripemin= size or more with n (2-32) workers\n"
+             "          each copying its own parts of the file concurrently.  Default\n"
+             "          is 0 (off).\n"
+             " /stripemin=size  Size at which /stripe applies, e.g., 1024m.  Default\n"
+             "          is 256m.\n"
+             " /sync=mode Durability of the target files: none leaves them to the\n"
+             "          system's lazy writer, file flushes each file in the background\n"
+             "          as it is written, group flushes a directory's files together\n"
+             "          and the target volume at the end.  Directories written or\n"
+             "          created are flushed too.  Default is none.\n"
+             " /trash   Move each target directory with no source, if all of it is\n"
+             "          to go, into a hidden trash directory at the top of the target\n"
+             "          in one rename and delete it in the background at low\n"
+             "          priority.  See /reaptime=.  Default is off.\n"
+             " /tune    Adapt the I/O block size, number of outstanding I/Os and the\n"
+             "          large file size threshold to the throughput and latency\n"
+             "          measured while copying.  Settled values are logged at the\n"
+             "          end.  Default is off.\n"
              " /u       Update target with specified differences.  Turning this off\n"
              "          means compare only.  Default is on.\n"
+             " /verify  Read each copied file back from the target, bypassing the\n"
+             "          cache, and compare its CRC-32C with that of the source data\n"
+             "          computed while it was copied.  Files are then copied\n"
+             "          sequentially as with /crc.  Default is off.\n"
              " /x       Subsequent file/wildcards are exclude specifications.  Default\n"
              "          is off.\n"
              " /#       # represents one or more decimal digits for the max directory\n"
@@ -460,8 +545,46 @@ short _stdcall                            // ret-0=success
                   globalChangeMask = OPT_GlobalBackup | OPT_GlobalBackupForce;
                else if ( !wcscmp(currArg+1, L"h") )
                   globalChangeMask = OPT_GlobalHidden;
+               else if ( !wcsncmp(currArg+1, L"cursor=", 7) )
+                  gOptions.cursor = currArg + 8;
+               else if ( !wcscmp(currArg+1, L"crc") )
+                  globalChangeMask = OPT_GlobalCrc;
+               else if ( !wcscmp(currArg+1, L"hugepages") )
+                  globalChangeMask = OPT_GlobalLargePages;
+               else if ( !wcscmp(currArg+1, L"pinbuf") )
+                  globalChangeMask = OPT_GlobalLockBuf;
+               else if ( !wcsncmp(currArg+1, L"journal=", 8) )
+                  gOptions.journal = currArg + 9;
+               else if ( !wcscmp(currArg+1, L"kcopy") )
+                  globalChangeMask = OPT_GlobalKernelCopy;
+               else if ( !wcsncmp(currArg+1, L"maxtime=", 8) )
+               {
+                  gOptions.sweepMinutes = (long)TextToInt64(currArg+9, 1, 525600, &errMsg);
+                  if ( errMsg )
+                  {
+                     err.MsgWrite(ErrE, L"%s - %s", currArg, errMsg);
+                     rc = 1;
+                  }
+               }
+               else if ( !wcsncmp(currArg+1, L"maxbytes=", 9) )
+               {
+                  gOptions.sweepBytes = TextToInt64(currArg+10, 1024*1024,
+                      (__int64)1024*1024*1024*1024*1024, &errMsg);
+                  if ( errMsg )
+                  {
+                     err.MsgWrite(ErrE, L"%s - %s", currArg, errMsg);
+                     rc = 1;
+                  }
+               }
+               else if ( !wcsncmp(currArg+1, L"manifest=", 9) )
+               {
+                  gOptions.manifest = currArg + 10;
+                  globalChangeMask = OPT_GlobalVerify;
+               }
                else if ( !wcscmp(currArg+1, L"m") )
                   globalChangeMask = OPT_GlobalMakeTgt;
+               else if ( !wcscmp(currArg+1, L"mmap") )
+                  globalChangeMask = OPT_GlobalMmap;
                else if ( !wcsncmp(currArg+1, L"m=", 2) )
                {
                   gOptions.sizeDirBuff = (DWORD)TextToInt64(currArg+3, 10000, 50000000, &errMsg);
@@ -475,6 +598,8 @@ short _stdcall                            // ret-0=success
                   globalChangeMask = OPT_GlobalNewer;
                else if ( !wcscmp(currArg+1, L"namecase") )
                   globalChangeMask = OPT_GlobalNameCase;
+               else if ( !wcscmp(currArg+1, L"nocache") )
+                  globalChangeMask = OPT_GlobalNoCache;
                else if ( !wcscmp(currArg+1, L"o") )
                   globalChangeMask = OPT_GlobalOptimize;
                else if ( !wcscmp(currArg+1, L"pa") )
@@ -483,6 +608,12 @@ short _stdcall                            // ret-0=success
                   globalChangeMask = OPT_GlobalDirPrec;
                else if ( !wcscmp(currArg+1, L"r") )
                   globalChangeMask = OPT_GlobalReadOnly;
+               else if ( !wcscmp(currArg+1, L"resume") )
+                  globalChangeMask = OPT_GlobalResume;
+               else if ( !wcscmp(currArg+1, L"scanahead") )
+                  globalChangeMask = OPT_GlobalScanAhead;
+               else if ( !wcscmp(currArg+1, L"seed") )
+                  globalChangeMask = OPT_GlobalSeed;
                else if ( !wcscmp(currArg+1, L"sd") )
                   globalChangeMask = OPT_GlobalDispDetail;
                else if ( !wcscmp(currArg+1, L"sm") )
@@ -491,8 +622,14 @@ short _stdcall                            // ret-0=success
                   globalChangeMask = OPT_GlobalSilent;
                else if ( !wcscmp(currArg+1, L"t") )
                   globalChangeMask = OPT_GlobalDirTime;
+               else if ( !wcscmp(currArg+1, L"trash") )
+                  globalChangeMask = OPT_GlobalTrash;
+               else if ( !wcscmp(currArg+1, L"tune") )
+                  globalChangeMask = OPT_GlobalIoTune;
                else if ( !wcscmp(currArg+1, L"u") )
                   globalChangeMask = OPT_GlobalChange;
+               else if ( !wcscmp(currArg+1, L"verify") )
+                  globalChangeMask = OPT_GlobalVerify;
                else if ( !wcscmp(currArg+1, L"xor") )
                   globalChangeMask = OPT_GlobalCopyXOR;
                else if ( !wcscmp(currArg+1, L"x") )
@@ -502,6 +639,96 @@ short _stdcall                            // ret-0=success
                   else
                      *state |= PS_EXCLUDE;
                }
+               else if ( !wcsncmp(currArg+1, L"pipe=", 5) )
+               {
+                  gOptions.nPipe = (short)TextToInt64(currArg+6, 0, 64, &errMsg);
+                  if ( errMsg )
+                  {
+                     err.MsgWrite(ErrE, L"%s - %s", currArg, errMsg);
+                     rc = 1;
+                  }
+               }
+               else if ( !wcsncmp(currArg+1, L"prefetch=", 9) )
+               {
+                  gOptions.nPrefetch = (short)TextToInt64(currArg+10, 0, 1024, &errMsg);
+                  if ( errMsg )
+                  {
+                     err.MsgWrite(ErrE, L"%s - %s", currArg, errMsg);
+                     rc = 1;
+                  }
+               }
+               else if ( !wcsncmp(currArg+1, L"prefetchmem=", 12) )
+               {
+                  gOptions.cbPrefetchMax = TextToInt64(currArg+13, 1024*1024,
+                      (__int64)4*1024*1024*1024, &errMsg);
+                  if ( errMsg )
+                  {
+                     err.MsgWrite(ErrE, L"%s - %s", currArg, errMsg);
+                     rc = 1;
+                  }
+               }
+               else if ( !wcsncmp(currArg+1, L"scanmem=", 8) )
+               {
+                  gOptions.cbDirMemMax = TextToInt64(currArg+9, 1024*1024,
+                      (__int64)64*1024*1024*1024, &errMsg);
+                  if ( errMsg )
+                  {
+                     err.MsgWrite(ErrE, L"%s - %s", currArg, errMsg);
+                     rc = 1;
+                  }
+               }
+               else if ( !wcsncmp(currArg+1, L"spill=", 6) )
+               {
+                  gOptions.cbSpillMin = TextToInt64(currArg+7, 1024*1024,
+                      (__int64)64*1024*1024*1024, &errMsg);
+                  if ( errMsg )
+                  {
+                     err.MsgWrite(ErrE, L"%s - %s", currArg, errMsg);
+                     rc = 1;
+                  }
+               }
+               else if ( !wcsncmp(currArg+1, L"reaptime=", 9) )
+               {
+                  gOptions.reapMinutes = (long)TextToInt64(currArg+10, 0, 525600, &errMsg);
+                  if ( errMsg )
+                  {
+                     err.MsgWrite(ErrE, L"%s - %s", currArg, errMsg);
+                     rc = 1;
+                  }
+               }
+               else if ( !wcsncmp(currArg+1, L"sync=", 5) )
+               {
+                  if ( !_wcsicmp(currArg+6, L"none") )
+                     gOptions.syncMode = SYNC_None;
+                  else if ( !_wcsicmp(currArg+6, L"file") )
+                     gOptions.syncMode = SYNC_File;
+                  else if ( !_wcsicmp(currArg+6, L"group") )
+                     gOptions.syncMode = SYNC_Group;
+                  else
+                  {
+                     err.MsgWrite(ErrE, L"%s - must be none, file or group", currArg);
+                     rc = 1;
+                  }
+               }
+               else if ( !wcsncmp(currArg+1, L"stripe=", 7) )
+               {
+                  gOptions.nStripe = (short)TextToInt64(currArg+8, 0, 32, &errMsg);
+                  if ( errMsg )
+                  {
+                     err.MsgWrite(ErrE, L"%s - %s", currArg, errMsg);
+                     rc = 1;
+                  }
+               }
+               else if ( !wcsncmp(currArg+1, L"stripemin=", 10) )
+               {
+                  gOptions.cbStripeMin = TextToInt64(currArg+11, 1024*1024,
+                      (__int64)1024*1024*1024*1024, &errMsg);
+                  if ( errMsg )
+                  {
+                     err.MsgWrite(ErrE, L"%s - %s", currArg, errMsg);
+                     rc = 1;
+                  }
+               }
                else if ( !wcsncmp(currArg+1, L"sf=", 3) )
                {
                   gOptions.spaceMinFree = (DWORD)TextToInt64(currArg+3, 0,
@@ -654,6 +881,10 @@ short _stdcall                            // ret-0=success
                            | OPT_GlobalDispDetail
                            | OPT_GlobalNameCase;
    gOptions.maxLevel = 255;
+   gOptions.reapMinutes = -1;
+   gOptions.cbStripeMin = STRIPE_MinDefault;
+   gOptions.cbPrefetchMax = PREFETCH_MemDefault;
+   gOptions.cbDirMemMax = DIRMEM_Default;
 
    if ( !argv[1] )
       Usage(false);
@@ -0,0 +1,323 @@
+/*
+===============================================================================
+
+  Module     - PartMerge
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Partitioned merge of a single huge directory.  Spreading the
+               work across directories does nothing for a flat directory of
+               millions of files, which one MatchEntries call would merge and
+               act on file by file.
+
+               With PART_MinEntries entries or more between source and
+               target, the two sorted indexes are cut into up to PART_Max key
+               ranges.  A cut is taken at an evenly spaced name of the larger
+               index and the matching point of each index found by binary
+               search, so no name is split from its match.  Each range is
+               merged and its file actions processed by a thread of its own,
+               the walk thread taking the first, each with its own paths,
+               copy buffer and statistics.  Subdirectories are left to the
+               walk's own loop, which follows once the files are done.
+
+               Once all ranges are done their statistics are added to the
+               walk's and their detail log lines, held in a LogBuffer each,
+               are written in range order, so the log reads the same however
+               the threads ran.  Error messages are written as they occur.
+  Updates -
+
+===============================================================================
+*/
+
+#include <process.h>
+#include <stdarg.h>
+
+#include "netditto.hpp"
+
+#define PART_Max             8            // most ranges, and threads
+#define PART_MinEntries      65536        // fewer source and target entries are merged serially
+#define PART_LogGrow         (64*1024)    // log buffer growth in chars
+#define PART_PathMax         (DIM(gOptions.target.apipath) + DIM(gOptions.target.path))
+
+struct PartRange                          // key range and what it needs to be processed
+{
+   DirEntry               ** src;         // source index entries of the range
+   DirEntry               ** srcEnd;
+   DirEntry               ** tgt;         // target index entries of the range
+   DirEntry               ** tgtEnd;
+   WCHAR                   * srcApiPath;  // source path being formed
+   WCHAR                   * tgtApiPath;  // target path being formed
+   size_t                    cchSrcDir;   // length of the directory's paths with '\'
+   size_t                    cchTgtDir;
+   BYTE                    * copyBuffer;  // leased, NULL for the walk's
+   LONG volatile           * pending;     // directory's, identifies it
+   Stats                     stats;       // file statistics of the range
+   LogBuffer                 log;         // detail lines of the range
+   HANDLE                    hThread;     // NULL if processed by the walk thread
+};
+
+
+// Adds a formatted line to a log buffer
+void __cdecl
+   LogBufferAdd(
+      LogBuffer            * log         ,// i/o-log buffer
+      WCHAR const          * fmt         ,// in -format
+      ...                                 // in -arguments
+   )
+{
+   WCHAR                     line[1024 + 32768];
+   WCHAR                   * grown;
+   va_list                   args;
+   int                       cch;
+
+   va_start(args, fmt);
+   cch = _vsnwprintf(line, DIM(line) - 1, fmt, args);
+   va_end(args);
+   if ( cch < 0 )
+      cch = DIM(line) - 1;
+   line[cch] = L'\0';
+
+   if ( log->cch + cch + 1 >= log->cchAlloc )
+   {
+      grown = (WCHAR *)realloc(log->text, (log->cchAlloc + cch + PART_LogGrow) * sizeof (WCHAR));
+      if ( !grown )
+      {
+         err.MsgWrite(0, L"%s", line);    // out of order rather than lost
+         return;
+      }
+      log->text = grown;
+      log->cchAlloc += cch + PART_LogGrow;
+   }
+   wcscpy(log->text + log->cch, line);
+   log->cch += cch + 1;                   // lines are kept NUL separated
+}
+
+
+// Writes a log buffer's lines to the log and frees it
+static void
+   LogBufferWrite(
+      LogBuffer            * log          // i/o-log buffer
+   )
+{
+   WCHAR const             * line;
+
+   for ( line = log->text;  line < log->text + log->cch;  line += wcslen(line) + 1 )
+      err.MsgWrite(0, L"%s", line);
+   free(log->text);
+   memset(log, 0, sizeof *log);
+}
+
+
+// First index entry not before a name
+static DirEntry **
+   PartLowerBound(
+      DirEntry            ** index       ,// in -sorted index
+      DirEntry            ** end         ,// in -end of index
+      WCHAR const          * name         // in -name
+   )
+{
+   DirEntry               ** mid;
+
+   while ( index < end )
+   {
+      mid = index + (end - index) / 2;
+      if ( _wcsicmp((*mid)->cFileName, name) < 0 )
+         index = mid + 1;
+      else
+         end = mid;
+   }
+   return index;
+}
+
+
+// Merges a range and processes its file actions.  Pairs that are
+// directories on either side are left to the walk.
+static void
+   PartProcess(
+      PartRange            * range        // i/o-range
+   )
+{
+   FileAction                action;
+   DirEntry                * srcEntry,
+                           * tgtEntry;
+   DirEntry               ** src = range->src,
+                          ** tgt = range->tgt;
+   int                       comp;
+
+   action.srcApiPath = range->srcApiPath;
+   action.tgtApiPath = range->tgtApiPath;
+   action.srcPath    = range->srcApiPath + DIM(gOptions.source.apipath);
+   action.tgtPath    = range->tgtApiPath + DIM(gOptions.target.apipath);
+   action.copyBuffer = range->copyBuffer ? range->copyBuffer : gOptions.copyBuffer;
+   action.sizeBuffer = gOptions.sizeBuffer;
+   action.stats      = &range->stats;
+   action.pending    = range->pending;
+   action.srcDir     = gOptions.source.hDir;
+   action.tgtDir     = gOptions.target.hDir;
+   action.log        = &range->log;
+
+   while ( src < range->srcEnd  ||  tgt < range->tgtEnd )
+   {
+      srcEntry = src < range->srcEnd ? *src : NULL;
+      tgtEntry = tgt < range->tgtEnd ? *tgt : NULL;
+      if ( srcEntry  &&  tgtEntry )
+      {
+         if ( (comp = _wcsicmp(srcEntry->cFileName, tgtEntry->cFileName)) < 0 )
+            tgtEntry = NULL;
+         else if ( comp > 0 )
+            srcEntry = NULL;
+      }
+      if ( tgtEntry )
+      {
+         if ( !srcEntry )
+            wcscpy(range->srcApiPath + range->cchSrcDir, tgtEntry->cFileName);
+         wcscpy(range->tgtApiPath + range->cchTgtDir, tgtEntry->cFileName);
+         tgt++;
+      }
+      if ( srcEntry )
+      {
+         wcscpy(range->srcApiPath + range->cchSrcDir, srcEntry->cFileName);
+         if ( !tgtEntry )
+            wcscpy(range->tgtApiPath + range->cchTgtDir, srcEntry->cFileName);
+         src++;
+      }
+
+      // as the walk's loop decides it
+      if ( !(gOptions.global & OPT_GlobalHidden) )
+         HiddenSemanticsSet(&srcEntry, &tgtEntry);
+      if ( !srcEntry  &&  tgtEntry  &&  gOptions.global & OPT_GlobalResume
+        && ResumeFileIs(tgtEntry->cFileName) )
+         tgtEntry = NULL;
+      if ( (!srcEntry  &&  !tgtEntry)
+        || (srcEntry  &&  srcEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY)
+        || (tgtEntry  &&  tgtEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY) )
+         continue;
+
+      action.srcEntry = srcEntry;
+      action.tgtEntry = tgtEntry;
+      FileActionProcess(&action);
+   }
+}
+
+
+static unsigned __stdcall
+   PartThread(
+      void                 * arg          // i/o-PartRange
+   )
+{
+   PartProcess((PartRange *)arg);
+   return 0;
+}
+
+
+// Returns whether a directory's files are to be merged in partitions
+BOOL _stdcall
+   PartUse(
+      DWORD                  nSrc        ,// in -source index entries
+      DWORD                  nTgt         // in -target index entries
+   )
+{
+   return nSrc + nTgt >= PART_MinEntries
+       && !(gOptions.fState & FLAG_Sweep)  // a sweep goes entry by entry
+       && !(gOptions.global & (OPT_GlobalBackup | OPT_GlobalBackupForce));
+}
+
+
+// Merges the files of the walk's current directory in key ranges processed
+// at once and adds up their statistics and detail lines in order.  Returns
+// nonzero if the walk is to process them itself after all.
+DWORD _stdcall
+   PartMerge(
+      DirEntry            ** srcIndex    ,// in -source index, NULL if none
+      DWORD                  nSrc        ,// in -source index entries
+      DirEntry            ** tgtIndex    ,// in -target index, NULL if none
+      DWORD                  nTgt        ,// in -target index entries
+      LONG volatile        * pending      // in -directory's pending actions, its id
+   )
+{
+   PartRange                 range[PART_Max];
+   HANDLE                    hThread[PART_Max];
+   DirEntry               ** keys;
+   DWORD                     nKeys;
+   WCHAR const             * key;
+   size_t                    cchSrcDir = wcslen(gOptions.source.apipath),
+                             cchTgtDir = wcslen(gOptions.target.apipath);
+   int                       nRange,
+                             nThread = 0,
+                             n;
+   DWORD                     tStart = GetTickCount();
+
+   // cut at evenly spaced names of the larger index
+   keys  = nSrc >= nTgt ? srcIndex : tgtIndex;
+   nKeys = max(nSrc, nTgt);
+   nRange = PART_Max;
+   memset(range, 0, sizeof range);
+   for ( n = 0;  n < nRange;  n++ )
+   {
+      range[n].src    = n ? range[n-1].srcEnd : srcIndex;
+      range[n].tgt    = n ? range[n-1].tgtEnd : tgtIndex;
+      if ( n == nRange - 1 )
+      {
+         range[n].srcEnd = srcIndex + nSrc;
+         range[n].tgtEnd = tgtIndex + nTgt;
+      }
+      else
+      {
+         key = keys[(DWORD)((__int64)nKeys * (n + 1) / nRange)]->cFileName;
+         range[n].srcEnd = PartLowerBound(range[n].src, srcIndex + nSrc, key);
+         range[n].tgtEnd = PartLowerBound(range[n].tgt, tgtIndex + nTgt, key);
+      }
+      range[n].cchSrcDir = cchSrcDir + 1;
+      range[n].cchTgtDir = cchTgtDir + 1;
+      range[n].pending   = pending;
+      range[n].srcApiPath = (WCHAR *)malloc(2 * PART_PathMax * sizeof (WCHAR));
+      if ( !range[n].srcApiPath )
+      {
+         err.MsgWrite(21902, L"Partition path allocation failed, merged serially (%s)",
+                             gOptions.target.path);
+         while ( n-- )
+            free(range[n].srcApiPath);
+         return ERROR_NOT_ENOUGH_MEMORY;
+      }
+      range[n].tgtApiPath = range[n].srcApiPath + PART_PathMax;
+      wcscpy(range[n].srcApiPath, gOptions.source.apipath);
+      wcscpy(range[n].tgtApiPath, gOptions.target.apipath);
+      range[n].srcApiPath[cchSrcDir] = range[n].tgtApiPath[cchTgtDir] = L'\\';
+   }
+
+   // each range after the first on a thread of its own if it can have one
+   for ( n = 1;  n < nRange;  n++ )
+   {
+      if ( !(range[n].copyBuffer = BufLease(gOptions.sizeBuffer)) )
+         continue;
+      range[n].hThread = (HANDLE)_beginthreadex(NULL, 0, PartThread, &range[n], 0, NULL);
+      if ( !range[n].hThread )
+      {
+         err.SysMsgWrite(21901, GetLastError(), L"_beginthreadex(PartThread)=%ld ",
+                                GetLastError());
+         BufReturn(range[n].copyBuffer);
+         range[n].copyBuffer = NULL;
+         continue;
+      }
+      hThread[nThread++] = range[n].hThread;
+   }
+   for ( n = 0;  n < nRange;  n++ )
+      if ( !range[n].hThread )
+         PartProcess(&range[n]);
+   if ( nThread )
+      WaitForMultipleObjects(nThread, hThread, TRUE, INFINITE);
+
+   for ( n = 0;  n < nRange;  n++ )
+   {
+      if ( range[n].hThread )
+         CloseHandle(range[n].hThread);
+      BufReturn(range[n].copyBuffer);
+      free(range[n].srcApiPath);
+      PipelineStatsMerge(&range[n].stats);
+      LogBufferWrite(&range[n].log);
+   }
+   err.MsgWrite(0, L"Partitioned %s src=%ld tgt=%ld ranges=%d threads=%d in %ldms",
+                   gOptions.target.path, nSrc, nTgt, nRange, nThread + 1,
+                   GetTickCount() - tStart);
+   return 0;
+}
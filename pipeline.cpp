@@ -0,0 +1,289 @@
+/*
+===============================================================================
+
+  Module     - Pipeline
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Decouples file actions from the directory walk.  With /pipe=n,
+               MatchedFileProcess hands each file create, update, compare and
+               removal to a bounded queue serviced by n worker threads, each
+               with its own copy buffer, so that many files are in flight at
+               once on latency bound targets rather than one at a time.  The
+               walk blocks only when the queue is full.
+
+               A queued action carries copies of its entries and paths since
+               the walk moves on and reuses both.  Each one counts against
+               its directory's pending count which MatchEntries waits on
+               before the directory's exit processing (timestamp, attributes
+               or removal), so a directory is never finished while its files
+               are still being written.
+
+               Workers count into their own Stats and merge the file level
+               counts into gOptions.stats after each action.  Directory level
+               counts belong to the walk thread and are never touched by the
+               merge.  Backup mode is not pipelined because the backup APIs
+               and unsecure-for-delete path work from the walk's paths.
+  Updates -
+  26/10/19 TPB Worker copy buffers are leased from the buffer pool.
+  26/10/19 TPB Actions carry the walk's directory handles, held open until
+               the directory's pending count drains.
+  26/10/19 TPB PartMerge's range statistics are merged with the workers'.
+
+===============================================================================
+*/
+
+#include <process.h>
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+#define PIPE_MaxWorkers      64          // most pipeline workers (wait limit)
+#define PIPE_SlotsPerWorker  4           // queued actions per worker
+
+struct PipeItem                          // queued file action with its own copies
+{
+   FileAction                action;     // action, entries/paths point below
+   DirEntry                  srcEntry;   // copy of source entry
+   DirEntry                  tgtEntry;   // copy of target entry
+   WCHAR                     paths[1];   // source then target \\?\ paths
+};
+
+struct PipeWorker
+{
+   HANDLE                    hThread;    // worker thread handle
+   BYTE                    * copyBuffer; // worker's own copy buffer
+   Stats                     stats;      // file statistics since last merge
+};
+
+static PipeItem           ** queue;      // ring of queued actions
+static long                  nSlots,     // queue ring size
+                             qHead,      // next slot to fill (walk thread only)
+                             qTail;      // next slot to take
+static int                   nWorker;
+static PipeWorker            worker[PIPE_MaxWorkers];
+static TSemaphore          * semFree;    // free queue slots
+static TSemaphore          * semFilled;  // queued actions
+static TEvent              * evDirDone;  // some directory's pending count reached 0
+static TCriticalSection      csQueue;    // serializes workers taking actions
+static TCriticalSection      csStats;    // serializes worker stats merges
+
+
+static void
+   StatBothAdd(
+      StatBoth             * sum         ,// i/o-total
+      StatBoth const       * add          // in -amount to add
+   )
+{
+   sum->count += add->count;
+   sum->bytes += add->bytes;
+}
+
+
+// Adds the file level statistics of a file action's own Stats to others.
+// Directory level counts belong to the walk thread and are left alone.
+static void
+   StatsFileAdd(
+      Stats                * sum         ,// i/o-statistics added to
+      Stats const          * add          // in -file statistics to add
+   )
+{
+   StatsChange             * change = &sum->change;
+   StatsMatch              * match  = &sum->match;
+
+   StatBothAdd(&change->fileCreated,     &add->change.fileCreated);
+   StatBothAdd(&change->fileUpdated,     &add->change.fileUpdated);
+   StatBothAdd(&change->fileRemoved,     &add->change.fileRemoved);
+   StatBothAdd(&change->filePermCreated, &add->change.filePermCreated);
+   StatBothAdd(&change->filePermUpdated, &add->change.filePermUpdated);
+   StatBothAdd(&change->filePermRemoved, &add->change.filePermRemoved);
+   change->fileAttrUpdated += add->change.fileAttrUpdated;
+   StatBothAdd(&match->fileMatched,      &add->match.fileMatched);
+   StatBothAdd(&match->filePermMatched,  &add->match.filePermMatched);
+}
+
+
+// Merges a worker's file level statistics into the global ones and clears
+// them for the next action.  PartMerge's ranges are merged here too as
+// workers may still be merging.
+void _stdcall
+   PipelineStatsMerge(
+      Stats                * stats        // i/o-worker or range statistics
+   )
+{
+   csStats.Enter();
+   StatsFileAdd(&gOptions.stats, stats);
+   csStats.Leave();
+   memset(stats, 0, sizeof *stats);
+}
+
+
+// Worker thread that processes queued file actions until it takes a NULL one
+static unsigned __stdcall
+   PipelineWorkerThread(
+      void                 * arg          // i/o-PipeWorker
+   )
+{
+   PipeWorker              * w = (PipeWorker *)arg;
+   PipeItem                * item;
+
+   for ( ;; )
+   {
+      semFilled->WaitSingle();
+      csQueue.Enter();
+      item = queue[qTail];
+      qTail = (qTail + 1) % nSlots;
+      csQueue.Leave();
+      semFree->Release();
+      if ( !item )
+         break;                           // terminate request
+
+      item->action.copyBuffer = w->copyBuffer;
+      item->action.sizeBuffer = gOptions.sizeBuffer;
+      item->action.stats      = &w->stats;
+      FileActionProcess(&item->action);
+      PipelineStatsMerge(&w->stats);
+
+      if ( InterlockedDecrement(item->action.pending) == 0 )
+         evDirDone->Set();
+      free(item);
+   }
+   return 0;
+}
+
+
+// Starts the pipeline workers if /pipe was specified.  Until this is called,
+// and after PipelineTerminate, file actions are processed inline.
+void _stdcall
+   PipelineStart(
+   )
+{
+   int                       n;
+
+   if ( gOptions.nPipe < 1
+     || gOptions.global & (OPT_GlobalBackup | OPT_GlobalBackupForce) )
+      return;
+
+   nWorker   = min(gOptions.nPipe, PIPE_MaxWorkers);
+   nSlots    = nWorker * PIPE_SlotsPerWorker;
+   qHead     = qTail = 0;
+   queue     = (PipeItem **)malloc(nSlots * sizeof *queue);
+   semFree   = new TSemaphore(nSlots, nSlots);
+   semFilled = new TSemaphore(0, nSlots);
+   evDirDone = new TEvent(FALSE, FALSE);
+   if ( !queue )
+      err.MsgWrite(50701, L"Pipeline queue allocation(%ld) failed", nSlots);
+
+   for ( n = 0;  n < nWorker;  n++ )
+   {
+      memset(&worker[n].stats, 0, sizeof worker[n].stats);
+      worker[n].copyBuffer = BufLease(gOptions.sizeBuffer);
+      if ( !worker[n].copyBuffer )
+         err.SysMsgWrite(50702, GetLastError(), L"Pipeline CopyBuffer BufLease(%u)=%ld ",
+                                gOptions.sizeBuffer, GetLastError());
+      worker[n].hThread = (HANDLE)_beginthreadex(NULL, 0, PipelineWorkerThread,
+                                                 &worker[n], 0, NULL);
+      if ( !worker[n].hThread )
+         err.SysMsgWrite(50703, GetLastError(), L"_beginthreadex(PipelineWorkerThread)=%ld ",
+                                GetLastError());
+   }
+   gOptions.fState |= FLAG_Pipeline;
+}
+
+
+// Stops the workers once they have drained the queue and releases them
+void _stdcall
+   PipelineTerminate(
+   )
+{
+   HANDLE                    hThread[PIPE_MaxWorkers];
+   int                       n;
+
+   if ( !(gOptions.fState & FLAG_Pipeline) )
+      return;
+
+   // one NULL action per worker, behind anything still queued
+   for ( n = 0;  n < nWorker;  n++ )
+   {
+      semFree->WaitSingle();
+      queue[qHead] = NULL;
+      qHead = (qHead + 1) % nSlots;
+      semFilled->Release();
+      hThread[n] = worker[n].hThread;
+   }
+   WaitForMultipleObjects(nWorker, hThread, TRUE, INFINITE);
+
+   for ( n = 0;  n < nWorker;  n++ )
+   {
+      CloseHandle(worker[n].hThread);
+      BufReturn(worker[n].copyBuffer);
+   }
+   gOptions.fState &= ~FLAG_Pipeline;
+   delete semFree;
+   delete semFilled;
+   delete evDirDone;
+   free(queue);
+}
+
+
+// Queues a file action with copies of its entries and the current paths and
+// counts it against the directory's pending actions.  Blocks while the queue
+// is full.
+DWORD _stdcall
+   PipelineSubmit(
+      DirEntry const       * srcEntry    ,// in -current source entry processed
+      DirEntry const       * tgtEntry    ,// in -current target entry processed
+      LONG volatile        * pending      // i/o-directory's outstanding pipelined actions
+   )
+{
+   size_t                    cchSrc = wcslen(gOptions.source.apipath) + 1,
+                             cchTgt = wcslen(gOptions.target.apipath) + 1;
+   PipeItem                * item;
+
+   item = (PipeItem *)malloc(offsetof(PipeItem, paths) + (cchSrc + cchTgt) * sizeof (WCHAR));
+   if ( !item )
+   {
+      err.MsgWrite(50704, L"Pipeline action allocation failed (%s)", gOptions.target.path);
+      return ERROR_NOT_ENOUGH_MEMORY;
+   }
+
+   item->action.srcEntry = item->action.tgtEntry = NULL;
+   if ( srcEntry )
+   {
+      memcpy(&item->srcEntry, srcEntry, CB_DirEntry(wcslen(srcEntry->cFileName)));
+      item->action.srcEntry = &item->srcEntry;
+   }
+   if ( tgtEntry )
+   {
+      memcpy(&item->tgtEntry, tgtEntry, CB_DirEntry(wcslen(tgtEntry->cFileName)));
+      item->action.tgtEntry = &item->tgtEntry;
+   }
+   wcscpy(item->paths, gOptions.source.apipath);
+   wcscpy(item->paths + cchSrc, gOptions.target.apipath);
+   item->action.srcApiPath = item->paths;
+   item->action.tgtApiPath = item->paths + cchSrc;
+   item->action.srcPath    = item->action.srcApiPath + DIM(gOptions.source.apipath);
+   item->action.tgtPath    = item->action.tgtApiPath + DIM(gOptions.target.apipath);
+   item->action.pending    = pending;
+   item->action.srcDir     = gOptions.source.hDir;
+   item->action.tgtDir     = gOptions.target.hDir;
+   item->action.log        = NULL;
+   InterlockedIncrement(pending);
+
+   semFree->WaitSingle();
+   queue[qHead] = item;
+   qHead = (qHead + 1) % nSlots;
+   semFilled->Release();
+   return 0;
+}
+
+
+// Waits until a directory's pipelined file actions are all done
+void _stdcall
+   PipelineDirWait(
+      LONG volatile        * pending      // i/o-directory's outstanding pipelined actions
+   )
+{
+   while ( *pending )
+      evDirDone->WaitSingle();
+}
@@ -0,0 +1,384 @@
+/*
+===============================================================================
+
+  Module     - Prefetch
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Cross-file read-ahead of small source files.  While one file
+               is being written, the next ones in the sorted source index are
+               already known, so with /prefetch=n the walk schedules up to n
+               upcoming small files (bounded also by /prefetchmem= bytes)
+               that are expected to be copied and reader threads load them
+               whole into an in-process cache.  When FileCopySmall gets to
+               a file, its contents are usually already resident and the
+               source open, seek and first-byte latency are off the critical
+               path entirely.
+
+               A file is expected to be copied unless the target has one of
+               the same name, size and (fuzzy) time under /o, which is found
+               by a binary search of the target index.  Files that are not
+               copied after all (or whose size changed since the scan) are
+               simply dropped when the walk leaves their directory.
+
+               Win32 has no readahead/fadvise(WILLNEED) for a file, so the
+               read into the bounded cache is the prefetch.
+  Updates -
+  26/10/19 TPB Read unbuffered like the copies so /nocache holds for the
+               prefetched files and their buffers suit an unbuffered write.
+
+===============================================================================
+*/
+
+#include <process.h>
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+#define PREFETCH_Threads     2            // reader threads
+
+enum PrefetchState { PF_Queued, PF_Reading, PF_Ready, PF_Failed, PF_Taken };
+
+struct PrefetchEntry                      // cached or to-be-cached source file
+{
+   PrefetchEntry           * next;        // next entry in schedule order
+   void const              * dir;         // directory (walk frame) that scheduled it
+   __int64                   cbFile;      // size from the directory scan
+   BYTE                    * data;        // file contents when PF_Ready
+   HANDLE                    evDone;      // set when read done if a taker waits
+   PrefetchState             state;
+   bool                      dropped;     // free when read completes
+   WCHAR                     path[1];     // \\?\ source path
+};
+
+static PrefetchEntry       * head,        // entries in schedule order
+                           * tail;
+static long                  nEntry;      // entries in cache
+static __int64               cbEntry;     // bytes reserved by entries
+static bool                  shutdown;
+static HANDLE                hThread[PREFETCH_Threads];
+static TSemaphore          * semQueued;   // entries queued to be read
+static TCriticalSection      csPrefetch;  // serializes cache list/state
+
+
+// Unlinks and frees an entry.  Must be called under csPrefetch.
+static void
+   PrefetchFree(
+      PrefetchEntry        * entry        // i/o-entry to free
+   )
+{
+   PrefetchEntry          ** prev;
+
+   for ( prev = &head;  *prev != entry;  prev = &(*prev)->next );
+   *prev = entry->next;
+   if ( tail == entry )
+      tail = (prev == &head) ? NULL : CONTAINING_RECORD(prev, PrefetchEntry, next);
+   nEntry--;
+   cbEntry -= entry->cbFile;
+   if ( entry->data )
+      VirtualFree(entry->data, 0, MEM_RELEASE);
+   free(entry);
+}
+
+
+// Reader thread that loads queued entries into the cache
+static unsigned __stdcall
+   PrefetchThread(
+      void                 * arg          // in -not used
+   )
+{
+   PrefetchEntry           * entry;
+   HANDLE                    hSrc;
+   BYTE                    * data;
+   DWORD                     nRead,
+                             cbRead;
+   bool                      ok;
+
+   for ( ;; )
+   {
+      semQueued->WaitSingle();
+      csPrefetch.Enter();
+      for ( entry = head;  entry  &&  entry->state != PF_Queued;  entry = entry->next );
+      if ( !entry )
+      {
+         // taken before it was read or a shutdown request
+         csPrefetch.Leave();
+         if ( shutdown )
+            break;
+         continue;
+      }
+      entry->state = PF_Reading;
+      csPrefetch.Leave();
+
+      // read one sector beyond the scanned size to detect a grown file; the
+      // page aligned buffer also has room for the padding of an unbuffered write
+      ok = false;
+      cbRead = (DWORD)(entry->cbFile + NOCACHE_Align) & ~(NOCACHE_Align - 1);
+      data = (BYTE *)VirtualAlloc(NULL, cbRead, MEM_COMMIT, PAGE_READWRITE);
+      hSrc = CreateFile(entry->path,
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        NULL, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING,
+                        0);
+      if ( data  &&  hSrc != INVALID_HANDLE_VALUE )
+         ok = ReadFile(hSrc, data, cbRead, &nRead, NULL)
+           && nRead == entry->cbFile;
+      if ( hSrc != INVALID_HANDLE_VALUE )
+         CloseHandle(hSrc);
+      if ( !ok  &&  data )
+      {
+         // not an error here -- the copy reads it and reports any error
+         VirtualFree(data, 0, MEM_RELEASE);
+         data = NULL;
+      }
+
+      csPrefetch.Enter();
+      entry->data  = data;
+      entry->state = ok ? PF_Ready : PF_Failed;
+      if ( entry->dropped )
+         PrefetchFree(entry);
+      else if ( entry->evDone )
+         SetEvent(entry->evDone);
+      csPrefetch.Leave();
+   }
+   return 0;
+}
+
+
+// Starts the reader threads if /prefetch was specified and files are copied
+void _stdcall
+   PrefetchStart(
+   )
+{
+   int                       n;
+
+   if ( gOptions.nPrefetch < 1
+     || !(gOptions.global & OPT_GlobalChange)
+     || gOptions.global & (OPT_GlobalBackup | OPT_GlobalBackupForce) )
+      return;
+
+   semQueued = new TSemaphore(0, MAXLONG);
+   for ( n = 0;  n < PREFETCH_Threads;  n++ )
+   {
+      hThread[n] = (HANDLE)_beginthreadex(NULL, 0, PrefetchThread, NULL, 0, NULL);
+      if ( !hThread[n] )
+         err.SysMsgWrite(50711, GetLastError(), L"_beginthreadex(PrefetchThread)=%ld ",
+                                GetLastError());
+   }
+   gOptions.fState |= FLAG_Prefetch;
+}
+
+
+// Stops the reader threads and frees anything left in the cache
+void _stdcall
+   PrefetchTerminate(
+   )
+{
+   int                       n;
+
+   if ( !(gOptions.fState & FLAG_Prefetch) )
+      return;
+
+   gOptions.fState &= ~FLAG_Prefetch;
+   shutdown = true;
+   semQueued->Release(PREFETCH_Threads);
+   WaitForMultipleObjects(PREFETCH_Threads, hThread, TRUE, INFINITE);
+   for ( n = 0;  n < PREFETCH_Threads;  n++ )
+      CloseHandle(hThread[n]);
+   while ( head )
+      PrefetchFree(head);
+   delete semQueued;
+}
+
+
+// Returns the target entry of the same name or NULL
+static DirEntry const *
+   PrefetchTgtFind(
+      WCHAR const          * name        ,// in -file name
+      DirEntry            ** tgtIndex    ,// in -target index
+      DWORD                  nTgt         // in -target index entries
+   )
+{
+   int                       lo = 0,
+                             hi = (int)nTgt - 1,
+                             mid,
+                             comp;
+
+   while ( lo <= hi )
+   {
+      mid = (lo + hi) / 2;
+      if ( (comp = _wcsicmp(name, tgtIndex[mid]->cFileName)) == 0 )
+         return tgtIndex[mid];
+      if ( comp < 0 )
+         hi = mid - 1;
+      else
+         lo = mid + 1;
+   }
+   return NULL;
+}
+
+
+// Schedules upcoming source files of the current directory for prefetch until
+// the cache is full.  *srcAhead is the next source entry to consider and is
+// advanced past those scheduled or skipped.
+void _stdcall
+   PrefetchAhead(
+      void const           * dir         ,// in -directory (walk frame) id
+      size_t                 cchDir      ,// in -length of source dir \\?\ path
+      DirEntry           *** srcAhead    ,// i/o-next source entry to consider
+      DirEntry            ** srcEnd      ,// in -end of source index
+      DirEntry            ** tgtIndex    ,// in -target index, NULL if none
+      DWORD                  nTgt         // in -target index entries
+   )
+{
+   DirEntry const          * srcEntry,
+                           * tgtEntry;
+   PrefetchEntry           * entry;
+   size_t                    cchName;
+   __int64                   cmp;
+
+   if ( !(gOptions.fState & FLAG_Prefetch) )
+      return;
+
+   for ( ;  *srcAhead < srcEnd;  (*srcAhead)++ )
+   {
+      srcEntry = **srcAhead;
+      if ( srcEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY
+        || srcEntry->cbFile == 0
+        || srcEntry->cbFile >= gOptions.target.tune.cbLargeFile
+        || srcEntry->cbFile >= gOptions.sizeBuffer )
+         continue;                        // not copied by FileCopySmall
+
+      // skip files expected to match the target
+      if ( tgtIndex  &&  (tgtEntry = PrefetchTgtFind(srcEntry->cFileName, tgtIndex, nTgt)) )
+      {
+         cmp = *(__int64 *)&srcEntry->ftimeLastWrite - *(__int64 *)&tgtEntry->ftimeLastWrite;
+         if ( cmp < 0  &&  gOptions.global & OPT_GlobalNewer )
+            continue;
+         if ( gOptions.global & OPT_GlobalOptimize
+           && srcEntry->cbFile == tgtEntry->cbFile
+           && cmp > -20000000  &&  cmp < 20000000 )
+            continue;
+      }
+
+      csPrefetch.Enter();
+      if ( nEntry >= gOptions.nPrefetch
+        || cbEntry + srcEntry->cbFile > gOptions.cbPrefetchMax )
+      {
+         csPrefetch.Leave();
+         break;                           // full -- try again on a later call
+      }
+      cchName = wcslen(srcEntry->cFileName);
+      entry = (PrefetchEntry *)malloc(offsetof(PrefetchEntry, path)
+                                      + (cchDir + cchName + 2) * sizeof (WCHAR));
+      if ( !entry )
+      {
+         csPrefetch.Leave();
+         break;
+      }
+      memset(entry, 0, offsetof(PrefetchEntry, path));
+      entry->dir    = dir;
+      entry->cbFile = srcEntry->cbFile;
+      entry->state  = PF_Queued;
+      wcsncpy(entry->path, gOptions.source.apipath, cchDir);
+      entry->path[cchDir] = L'\\';
+      wcscpy(entry->path + cchDir + 1, srcEntry->cFileName);
+      if ( tail )
+         tail->next = entry;
+      else
+         head = entry;
+      tail = entry;
+      nEntry++;
+      cbEntry += entry->cbFile;
+      csPrefetch.Leave();
+      semQueued->Release();
+   }
+}
+
+
+// Takes a source file's contents from the cache, waiting for a read in
+// progress.  Returns NULL if the file is not cached (or failed), otherwise
+// the entry, to be given back with PrefetchRelease.
+PrefetchEntry * _stdcall
+   PrefetchTake(
+      WCHAR const          * srcApiPath  ,// in -source path
+      BYTE                ** data        ,// out-file contents
+      DWORD                * cbData       // out-file size
+   )
+{
+   PrefetchEntry           * entry;
+   HANDLE                    evDone = NULL;
+
+   if ( !(gOptions.fState & FLAG_Prefetch) )
+      return NULL;
+
+   csPrefetch.Enter();
+   for ( entry = head;  entry  &&  wcscmp(entry->path, srcApiPath);  entry = entry->next );
+   if ( entry  &&  entry->state == PF_Reading )
+   {
+      evDone = entry->evDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+      csPrefetch.Leave();
+      if ( evDone )
+         WaitForSingleObject(evDone, INFINITE);
+      csPrefetch.Enter();
+      entry->evDone = NULL;
+   }
+   if ( entry  &&  entry->state != PF_Ready )
+   {
+      if ( entry->state == PF_Reading )   // event creation failed
+         entry->dropped = true;
+      else
+         PrefetchFree(entry);
+      entry = NULL;
+   }
+   if ( entry )                           // taken under the lock, so not freed
+   {
+      entry->state = PF_Taken;
+      *data   = entry->data;
+      *cbData = (DWORD)entry->cbFile;
+   }
+   csPrefetch.Leave();
+   if ( evDone )
+      CloseHandle(evDone);
+   return entry;
+}
+
+
+// Gives back a taken entry and frees its cache space
+void _stdcall
+   PrefetchRelease(
+      PrefetchEntry        * entry        // i/o-entry from PrefetchTake
+   )
+{
+   csPrefetch.Enter();
+   PrefetchFree(entry);
+   csPrefetch.Leave();
+}
+
+
+// Drops the entries a directory scheduled that were not taken.  Called as
+// the walk leaves the directory, when its file actions are all done.
+void _stdcall
+   PrefetchDirDone(
+      void const           * dir          // in -directory (walk frame) id
+   )
+{
+   PrefetchEntry           * entry,
+                           * next;
+
+   if ( !(gOptions.fState & FLAG_Prefetch) )
+      return;
+
+   csPrefetch.Enter();
+   for ( entry = head;  entry;  entry = next )
+   {
+      next = entry->next;
+      if ( entry->dir == dir )
+         if ( entry->state == PF_Reading )
+            entry->dropped = true;
+         else if ( entry->state != PF_Taken )
+            PrefetchFree(entry);
+   }
+   csPrefetch.Leave();
+}
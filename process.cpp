@@ -9,6 +9,17 @@
                and target entries have been "matched".  This may include
                file create/copy/deletion, ACL and attribute modification, etc.
   Updates -
+  26/10/19 TPB File level functions work from a FileAction so they can run
+               on pipeline workers with their own paths, buffer and stats.
+  26/10/19 TPB Flush the parent of created and renamed objects per /sync=.
+  26/10/19 TPB Target attributes set and files removed relative to their
+               open directory.
+  26/10/19 TPB Directory times, attributes and compression, and file
+               attributes and compression, applied as one batch by MetaSet.
+  26/10/19 TPB Directory times fixed only where the subtree changed or the
+               time differs, deferred to the end of the walk.
+  26/10/19 TPB Directories SeedTree made are not made again.
+  26/10/19 TPB A file action's detail line may be held in its LogBuffer.
 
 ===============================================================================
 */
@@ -28,7 +39,9 @@ BOOL
    CompressionSet(
       HANDLE                 hSrc         ,// in -source dir/file handle
       HANDLE                 hTgt         ,// in -target dir/file handle (if open)
-      DWORD                  attr          // in -target file/dir attribute
+      DWORD                  attr         ,// in -target file/dir attribute
+      WCHAR const          * srcApiPath   ,// in -source path if no source handle
+      WCHAR const          * tgtApiPath    // in -target path if no target handle
    )
 {
    DWORD                     rc,
@@ -49,7 +62,7 @@ BOOL
          // first see if we need to open source file or dir
          if ( hSrc == INVALID_HANDLE_VALUE )
          {
-            handle = CreateFile(gOptions.source.apipath,
+            handle = CreateFile(srcApiPath,
                                 GENERIC_READ,
                                 FILE_SHARE_READ | FILE_SHARE_WRITE,
                                 NULL,
@@ -60,7 +73,7 @@ BOOL
             {
                rc = GetLastError();
                err.SysMsgWrite(ErrS, rc, L"CreateFileGC(%s)=%ld ",
-                                     gOptions.source.path, rc);
+                                     srcApiPath, rc);
                return FALSE;
             }
          }
@@ -78,7 +91,7 @@ BOOL
          {
             rc = GetLastError();
             err.SysMsgWrite(ErrS, rc, L"Get compression(%hx,%s)=%ld ",
-                                  compressType, gOptions.source.path, rc);
+                                  compressType, srcApiPath, rc);
             compressType = COMPRESSION_FORMAT_DEFAULT;
          }
 
@@ -95,8 +108,8 @@ BOOL
         || gOptions.global & (OPT_GlobalBackup | OPT_GlobalBackupForce) )
          openMode = FILE_FLAG_BACKUP_SEMANTICS;
       if ( attr & FILE_ATTRIBUTE_READONLY )
-         SetFileAttributes(gOptions.target.apipath, FILE_ATTRIBUTE_NORMAL);
-      handle = CreateFile(gOptions.target.apipath,
+         SetFileAttributes(tgtApiPath, FILE_ATTRIBUTE_NORMAL);
+      handle = CreateFile(tgtApiPath,
                         FILE_READ_DATA | FILE_WRITE_DATA,
                         FILE_SHARE_READ | FILE_SHARE_WRITE,
                         NULL,
@@ -107,7 +120,7 @@ BOOL
       {
          rc = GetLastError();
          err.SysMsgWrite(ErrS, rc, L"CreateFileSC(%hx,%s)=%ld ",
-                               compressType, gOptions.target.path, rc);
+                               compressType, tgtApiPath, rc);
          return FALSE;
       }
    }
@@ -125,7 +138,7 @@ BOOL
    {
       rc = GetLastError();
       err.SysMsgWrite(ErrS, rc, L"Set compression(%hd,%s)=%ld ",
-                                compressType, gOptions.target.path, rc);
+                                compressType, tgtApiPath, rc);
    }
 
    // only close if we had to open it for this operation, else leave it open
@@ -133,7 +146,7 @@ BOOL
       CloseHandle(handle);
 
    if ( attr & FILE_ATTRIBUTE_READONLY )
-      SetFileAttributes(gOptions.target.apipath, attr);
+      SetFileAttributes(tgtApiPath, attr);
 
    return TRUE;
 }
@@ -141,21 +154,27 @@ BOOL
 // Renames file or directory when case is different
 DWORD
    FileDirRename(
-      DirEntry const       * srcEntry
+      DirEntry const       * srcEntry    ,// in -source entry with the new name case
+      WCHAR const          * tgtApiPath   // in -target path to rename
    )
 {
    DWORD                     rc = 0;
    WCHAR                     newName[_MAX_PATH];
    size_t                    len;
 
-   len = wcslen(gOptions.target.path) - wcslen(srcEntry->cFileName);
-   wcsncpy(newName, gOptions.target.path, len);
+   len = wcslen(tgtApiPath + DIM(gOptions.target.apipath)) - wcslen(srcEntry->cFileName);
+   wcsncpy(newName, tgtApiPath + DIM(gOptions.target.apipath), len);
    wcscpy(newName+len, srcEntry->cFileName);
-   if ( !MoveFile(gOptions.target.apipath, newName) )
+   if ( !MoveFile(tgtApiPath, newName) )
    {
       rc = GetLastError();
       err.SysMsgWrite(ErrE, L"Rename(%s,%s)=%ld ",
-                            gOptions.target.path, newName, rc);
+                            tgtApiPath + DIM(gOptions.target.apipath), newName, rc);
+   }
+   else
+   {
+      InterlockedIncrement(&gOptions.nRenamed);
+      FlushParentDir(tgtApiPath);
    }
    return rc;
 }
@@ -224,6 +243,7 @@ static
 DWORD _stdcall
    DirCreate(
       DirEntry const       * srcEntry    ,// in -current source entry processed
+      BOOL                   made        ,// in -already made by SeedTree
       LogActions           * log          // out-log action codes
    )
 {
@@ -233,13 +253,14 @@ DWORD _stdcall
    log->contents = L'M';
    if ( gOptions.global & OPT_GlobalChange )
    {
-      if ( !CreateDirectory(gOptions.target.apipath, NULL) )
+      if ( !made  &&  !CreateDirectory(gOptions.target.apipath, NULL) )
       {
          rc = GetLastError();
          err.SysMsgWrite(30201, rc, L"CreateDirectory(%s)=%ld ",
                                     gOptions.target.path, rc);
          return rc;
       }
+      FlushParentDir(gOptions.target.apipath);
    }
    return rc;
 }
@@ -253,6 +274,7 @@ DWORD _stdcall
    DirAttrUpdate(
       DirEntry const       * srcEntry     ,// in -source entry
       DirEntry const       * tgtEntry     ,// in -target entry
+      BOOL                   changed      ,// in -anything in the subtree changed
       LogAction            * logAction     // out-log action code
    )
 {
@@ -260,7 +282,7 @@ DWORD _stdcall
 
    BOOL                      attrDiff,     // attribute difference, if any
                              timeDiff;
-   HANDLE                    hDir;
+   MetaChange                meta;
 
    if ( gOptions.global & OPT_GlobalBackupForce )
    {
@@ -269,88 +291,57 @@ DWORD _stdcall
    }
    else
    {
-      // set significant attribute differences
+      // set significant attribute differences.  The target time scanned is
+      // still good unless something in the subtree changed since, in which
+      // case it is fixed up regardless.
       attrDiff = (srcEntry->attrFile ^ tgtEntry->attrFile) & gOptions.attrSignif;
-      if ( attrDiff )
-         timeDiff =  gOptions.global & OPT_GlobalDirTime
-                  && CompareFileTime(&srcEntry->ftimeLastWrite,
-                                     &tgtEntry->ftimeLastWrite);
-      else
-         timeDiff = 0;
+      timeDiff =  gOptions.global & OPT_GlobalDirTime
+              && ((changed  &&  gOptions.global & OPT_GlobalChange)
+                  || CompareFileTime(&srcEntry->ftimeLastWrite,
+                                     &tgtEntry->ftimeLastWrite));
    }
-/*
-   // Always recheck directory time and attributes at termination of its recursive
-   // process level because adding/deleting files/dirs will cause it to change
-   // Remove this code when level-based statistics are maintained so that this
-   // check becomes unnecessary.
-   if ( !timeDiff && !attrDiff )
-   {
-      GetFileAttributes(
-   }
-*/
    if ( timeDiff || attrDiff )
    {
       gOptions.stats.change.dirAttrUpdated++;
-      if ( timeDiff  &&  gOptions.global & OPT_GlobalChange)
+
+      // time, attributes and compression all through one open of the
+      // directory.  Attributes are left alone if only compression differs
+      // since that only changes by its own FSCTL.
+      meta.fields = 0;
+      if ( timeDiff )
       {
-         if ( tgtEntry->attrFile & FILE_ATTRIBUTE_READONLY )
-         {
-            if ( !SetFileAttributes(gOptions.target.apipath, FILE_ATTRIBUTE_NORMAL) )
-            {
-               rc = GetLastError();
-               err.SysMsgWrite(30638, rc, L"SetFileAttributesN(%s)=%ld ",
-                                          gOptions.target.path, rc);
-            }
-         }
-         hDir = CreateFile(gOptions.target.apipath,
-                           GENERIC_WRITE | GENERIC_READ,
-                           FILE_SHARE_READ | FILE_SHARE_WRITE,
-                           NULL,
-                           OPEN_EXISTING,
-                           FILE_FLAG_BACKUP_SEMANTICS,
-                           0);
-         if ( hDir == INVALID_HANDLE_VALUE )
-         {
-            rc = GetLastError();
-            err.SysMsgWrite(20629, rc, L"CreateFileTC(%s)=%ld ",
-                                       gOptions.target.path, rc);
-         }
-         else
-         {
-            if ( !SetFileTime(hDir, NULL, NULL, &srcEntry->ftimeLastWrite) )
-            {
-               rc = GetLastError();
-               err.SysMsgWrite(20630, rc, L"SetFileTime(%s)=%ld ",
-                                          gOptions.target.path, rc);
-            }
-            if ( attrDiff & FILE_ATTRIBUTE_COMPRESSED )  // significant compression attribute different?
-            {
-               CompressionSet(INVALID_HANDLE_VALUE, hDir, srcEntry->attrFile);
-               attrDiff &= ~FILE_ATTRIBUTE_COMPRESSED;
-            }
-            CloseHandle(hDir);
-         }
-         *logAction = L't';
+         meta.fields |= META_Time;
+         if ( gOptions.global & OPT_GlobalChange )
+            *logAction = L't';
       }
       if ( attrDiff )
       {
          if ( attrDiff & ~FILE_ATTRIBUTE_COMPRESSED )
+            meta.fields |= META_Attr;
+         if ( attrDiff & FILE_ATTRIBUTE_COMPRESSED )  // significant compression attribute different?
+            meta.fields |= META_Compress;
+         *logAction = L'a';
+      }
+      if ( gOptions.global & OPT_GlobalChange )
+      {
+         meta.attr           = srcEntry->attrFile;
+         meta.ftimeLastWrite = srcEntry->ftimeLastWrite;
+         meta.srcApiPath     = gOptions.source.apipath;
+         if ( !timeDiff )
+            rc = MetaSet(gOptions.target.hDir, &meta, gOptions.target.apipath, gOptions.target.path);
+         else
          {
-            // Don't do this if only attribute difference is compression because
-            // this won't change it -- the next code block will.
-            if ( !SetFileAttributes(gOptions.target.apipath,
-                                    srcEntry->attrFile & ~FILE_ATTRIBUTE_DIRECTORY) )
+            // the time, with the attributes, waits until the walk is done;
+            // compression needs the source so is changed now
+            if ( meta.fields & META_Compress )
             {
-               rc = GetLastError();
-               err.SysMsgWrite(20628, rc, L"SetFileAttributes(%s)=%ld ",
-                                          gOptions.target.path, rc);
+               meta.fields = META_Compress;
+               rc = MetaSet(gOptions.target.hDir, &meta, gOptions.target.apipath,
+                            gOptions.target.path);
+               meta.fields = META_Time | (attrDiff & ~FILE_ATTRIBUTE_COMPRESSED ? META_Attr : 0);
             }
+            DirTimeQueue(&meta, gOptions.target.apipath, gOptions.target.path);
          }
-         if ( attrDiff & FILE_ATTRIBUTE_COMPRESSED )  // significant compression attribute different?
-         {
-            CompressionSet(INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE, srcEntry->attrFile);
-         }
-         *logAction = L'a';
       }
    }
 
@@ -362,7 +353,7 @@ DWORD _stdcall
        && !_wcsicmp(srcEntry->cFileName, tgtEntry->cFileName) )
       {
          if ( gOptions.dir.attr & OPT_PropActionUpdate )
-            FileDirRename(srcEntry);
+            FileDirRename(srcEntry, gOptions.target.apipath);
          if ( *logAction == L' ' )
          {
             gOptions.stats.change.dirAttrUpdated++;
@@ -383,7 +374,8 @@ DWORD _stdcall
 DWORD _stdcall
    MatchedDirTgtExists(
       DirEntry const       * srcEntry    ,// in -current source entry processed
-      DirEntry const       * tgtEntry     // in -current target entry processed
+      DirEntry const       * tgtEntry    ,// in -current target entry processed
+      BOOL                   changed      // in -anything in the subtree changed
    )
 {
    DWORD                     rc = 0;
@@ -402,7 +394,7 @@ DWORD _stdcall
    else
    {
       if ( gOptions.dir.attr & OPT_PropActionUpdate )
-         rc = DirAttrUpdate(srcEntry, tgtEntry, &log.attr);
+         rc = DirAttrUpdate(srcEntry, tgtEntry, changed, &log.attr);
       if ( gOptions.dir.perms )
       {
          rc = PermReplicate(1, &log.perms);
@@ -422,7 +414,8 @@ DWORD _stdcall
 //-----------------------------------------------------------------------------
 DWORD _stdcall
    MatchedDirNoTgt(
-      DirEntry const       * srcEntry     // in -current source entry processed
+      DirEntry const       * srcEntry    ,// in -current source entry processed
+      BOOL                   made         // in -directory already made by SeedTree
    )
 {
    DWORD                     rc = 0;
@@ -430,7 +423,7 @@ DWORD _stdcall
 
    if ( gOptions.dir.contents & OPT_PropActionMake )
    {
-      rc = DirCreate(srcEntry, &log);
+      rc = DirCreate(srcEntry, made, &log);
       if ( !rc )
       {
          if ( gOptions.dir.perms & OPT_PropActionMake )
@@ -438,7 +431,8 @@ DWORD _stdcall
             rc = PermCreate(1, &log.perms);
             if ( srcEntry->attrFile & gOptions.attrSignif & FILE_ATTRIBUTE_COMPRESSED )
                if ( gOptions.global & OPT_GlobalChange )
-                  CompressionSet(INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE, srcEntry->attrFile );
+                  CompressionSet(INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE, srcEntry->attrFile,
+                                 gOptions.source.apipath, gOptions.target.apipath);
          }
       }
    }
@@ -491,7 +485,7 @@ DWORD _stdcall
       DirEntry const       * srcEntry     // in -current source entry processed
    )
 {
-   HANDLE                    hDir;
+   MetaChange                meta;
    DWORD                     rc = 0;
 
    if ( gOptions.dir.contents & OPT_PropActionMake
@@ -505,31 +499,11 @@ DWORD _stdcall
       }
       else
       {
-         hDir = CreateFile(gOptions.target.apipath, GENERIC_WRITE | GENERIC_WRITE,
-                           FILE_SHARE_READ, NULL, OPEN_EXISTING,
-                           FILE_FLAG_BACKUP_SEMANTICS, 0);
-         if ( hDir == INVALID_HANDLE_VALUE )
-         {
-            rc = GetLastError();
-            err.SysMsgWrite(30630, rc, L"CreateFileDirTC(%s)=%ld ", gOptions.target.path, rc);
-         }
-         else
-         {
-            if ( !SetFileTime(hDir, NULL, NULL, &srcEntry->ftimeLastWrite) )
-            {
-               rc = GetLastError();
-               err.SysMsgWrite(20630, rc, L"SetFileTime(%s)=%ld ", gOptions.target.path, rc);
-            }
-            CloseHandle(hDir);
-         }
-
-         if ( !SetFileAttributes(gOptions.target.apipath, srcEntry->attrFile
-                                                     & ~FILE_ATTRIBUTE_DIRECTORY) )
-         {
-            rc = GetLastError();
-            err.SysMsgWrite(20631, rc, L"SetFileAttributes(%s)=%ld ",
-                                       gOptions.target.path, rc);
-         }
+         meta.fields         = META_Time | META_Attr;
+         meta.attr           = srcEntry->attrFile;
+         meta.ftimeLastWrite = srcEntry->ftimeLastWrite;
+         meta.srcApiPath     = gOptions.source.apipath;
+         rc = DirTimeQueue(&meta, gOptions.target.apipath, gOptions.target.path);
       }
    }
 
@@ -544,21 +518,22 @@ DWORD _stdcall
 static
 DWORD _stdcall
    FileCreate(
-      DirEntry const       * srcEntry     // in -current source entry processed
+      FileAction const     * action       // in -file action
    )
 {
    DWORD                     rc = 0;
+   DirEntry const          * srcEntry = action->srcEntry;
 
-   gOptions.stats.change.fileCreated.count++;
-   gOptions.stats.change.fileCreated.bytes += srcEntry->cbFile;
+   action->stats->change.fileCreated.count++;
+   action->stats->change.fileCreated.bytes += srcEntry->cbFile;
    if ( gOptions.global & OPT_GlobalChange )
    {
       if ( gOptions.global & OPT_GlobalBackup )
          rc = FileBackupCopy(srcEntry, NULL);
       else
-         rc = FileCopy(srcEntry, NULL);
+         rc = FileCopy(action);
       if ( rc )
-         err.MsgWrite(203, L"File copy bypassed %s", gOptions.target.path);
+         err.MsgWrite(203, L"File copy bypassed %s", action->tgtPath);
    }
    return rc;
 }
@@ -570,33 +545,35 @@ DWORD _stdcall
 static
 DWORD _stdcall
    FileRemove(
-      DirEntry const       * tgtEntry     // in -current source entry processed
+      FileAction const     * action       // in -file action
    )
 {
    DWORD                     rc = 0;
+   DirEntry const          * tgtEntry = action->tgtEntry;
 
-   gOptions.stats.change.fileRemoved.count++;
-   gOptions.stats.change.fileRemoved.bytes += tgtEntry->cbFile;
+   action->stats->change.fileRemoved.count++;
+   action->stats->change.fileRemoved.bytes += tgtEntry->cbFile;
    if ( gOptions.global & OPT_GlobalChange )
    {
       // if file R/O, change to R/W
       if ( tgtEntry->attrFile & FILE_ATTRIBUTE_READONLY )
       {
-         if ( !SetFileAttributes(gOptions.target.apipath, FILE_ATTRIBUTE_NORMAL) )
+         if ( !RelSetFileAttributes(action->tgtDir, action->tgtApiPath, FILE_ATTRIBUTE_NORMAL) )
          {
             rc = GetLastError();
-            err.SysMsgWrite(30208, rc, L"SetFileAttributes(%s)=%ld ", gOptions.target.path, rc);
+            err.SysMsgWrite(30208, rc, L"SetFileAttributes(%s)=%ld ", action->tgtPath, rc);
             return rc;
          }
       }
-      if ( !DeleteFile(gOptions.target.apipath) )
+      if ( !RelDeleteFile(action->tgtDir, action->tgtApiPath) )
       {
          rc = GetLastError();
+         // backup mode is never pipelined, so the walk's target path is this file's
          if ( rc == ERROR_ACCESS_DENIED  &&  gOptions.global & OPT_GlobalBackup )
          {
             if ( UnsecureForDelete(tgtEntry) )
             {
-               if ( !DeleteFile(gOptions.target.apipath) )
+               if ( !DeleteFile(action->tgtApiPath) )
                   rc = GetLastError();
                else
                   rc = 0;
@@ -604,7 +581,7 @@ DWORD _stdcall
          }
          if ( rc )
             err.SysMsgWrite(30204, rc, L"DeleteFile(%s)=%ld ",
-                                       gOptions.target.path, rc);
+                                       action->tgtPath, rc);
          return rc;
       }
    }
@@ -619,10 +596,11 @@ DWORD _stdcall
 static
 DWORD _stdcall
    MatchedFileCompare(
-      DirEntry const       * srcEntry    ,// in -current source entry processed
-      DirEntry const       * tgtEntry     // in -current target entry processed
+      FileAction const     * action       // in -file action
    )
 {
+   DirEntry const          * srcEntry = action->srcEntry,
+                           * tgtEntry = action->tgtEntry;
    __int64                   cmp;         // compare result
 
    cmp = *(__int64 *)&srcEntry->ftimeLastWrite - *(__int64 *)&tgtEntry->ftimeLastWrite;
@@ -646,7 +624,7 @@ DWORD _stdcall
       return 1;   // file lengths not equal
 
    if ( !(gOptions.global & OPT_GlobalOptimize) )
-      return FileContentsCompare(); // no optimize, so compare contents
+      return FileContentsCompare(action); // no optimize, so compare contents
 
    return 0;         // they're the same
 }
@@ -660,59 +638,57 @@ DWORD _stdcall
 static
 DWORD _stdcall
    FileUpdate(
-      DirEntry const       * srcEntry    ,// in -current source entry processed
-      DirEntry const       * tgtEntry    ,// in -current target entry processed
+      FileAction const     * action      ,// in -file action
       LogActions           * log          // out-attribute action
    )
 {
+   DirEntry const          * srcEntry = action->srcEntry,
+                           * tgtEntry = action->tgtEntry;
    DWORD                     rc,
                              attrDiff;
+   MetaChange                meta;
 
    if ( gOptions.global & OPT_GlobalBackupForce )
       rc = 1;
    else
-      rc = MatchedFileCompare(srcEntry, tgtEntry);
+      rc = MatchedFileCompare(action);
 
    if ( rc )
    {
       log->contents = L'U';
-      gOptions.stats.change.fileUpdated.count++;
-      gOptions.stats.change.fileUpdated.bytes += srcEntry->cbFile;
+      action->stats->change.fileUpdated.count++;
+      action->stats->change.fileUpdated.bytes += srcEntry->cbFile;
       if ( gOptions.global & OPT_GlobalChange )
          if ( gOptions.global & OPT_GlobalBackup )
             rc = FileBackupCopy(srcEntry, tgtEntry);
          else
-            rc = FileCopy(srcEntry, tgtEntry);
+            rc = FileCopy(action);
       else
          rc = 0;
    }
    else
    {
-      gOptions.stats.match.fileMatched.count++;
-      gOptions.stats.match.fileMatched.bytes += srcEntry->cbFile;
+      action->stats->match.fileMatched.count++;
+      action->stats->match.fileMatched.bytes += srcEntry->cbFile;
       if ( gOptions.file.attr & OPT_PropActionUpdate )
       {
          // checks to see if signficant attributes are different
          attrDiff = (srcEntry->attrFile ^ tgtEntry->attrFile) & gOptions.attrSignif;
          if ( attrDiff )
          {
-            gOptions.stats.change.fileAttrUpdated++;
+            action->stats->change.fileAttrUpdated++;
             log->attr = 'a';
             if ( gOptions.global & OPT_GlobalChange )
             {
+               // attributes and compression through one open of the file
+               meta.fields = 0;
                if ( attrDiff & ~FILE_ATTRIBUTE_COMPRESSED )
-               {
-                  if ( !SetFileAttributes(gOptions.target.apipath, srcEntry->attrFile) )
-                  {
-                     rc = GetLastError();
-                     err.SysMsgWrite(20101, rc, L"SetFileAttributes(%s)=%ld ",
-                                                gOptions.target.path, rc);
-                  }
-               }
+                  meta.fields |= META_Attr;
                if ( attrDiff & FILE_ATTRIBUTE_COMPRESSED )  // significant compression attribute different?
-               {
-                  CompressionSet(INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE, srcEntry->attrFile);
-               }
+                  meta.fields |= META_Compress;
+               meta.attr       = srcEntry->attrFile;
+               meta.srcApiPath = action->srcApiPath;
+               rc = MetaSet(action->tgtDir, &meta, action->tgtApiPath, action->tgtPath);
             }
          }
       }
@@ -726,10 +702,10 @@ DWORD _stdcall
        && !_wcsicmp(srcEntry->cFileName, tgtEntry->cFileName) )
       {
          if ( gOptions.dir.attr & OPT_PropActionUpdate )
-            FileDirRename(srcEntry);
+            FileDirRename(srcEntry, action->tgtApiPath);
          if ( log->attr == L' ' )
          {
-            gOptions.stats.change.fileAttrUpdated++;
+            action->stats->change.fileAttrUpdated++;
             log->attr = L'a';
          }
       }
@@ -739,16 +715,18 @@ DWORD _stdcall
 
 
 //-----------------------------------------------------------------------------
-// Processes a matched file entry.  The source or the target (not both)
-// may be missing (DirEntry == NULL).
+// Processes a file action.  The source or the target (not both) may be
+// missing (DirEntry == NULL).  This runs on the walk thread or, with /pipe,
+// on a pipeline worker.
 //-----------------------------------------------------------------------------
 DWORD _stdcall
-   MatchedFileProcess(
-      DirEntry const       * srcEntry    ,// in -current source entry processed
-      DirEntry const       * tgtEntry     // in -current target entry processed
+   FileActionProcess(
+      FileAction const     * action       // in -file action
    )
 {
-   DWORD                     rc;
+   DWORD                     rc = 0;
+   DirEntry const          * srcEntry = action->srcEntry,
+                           * tgtEntry = action->tgtEntry;
    LogActions                log = {L' ', L' ', L' '};
 
    if ( !tgtEntry )
@@ -756,7 +734,7 @@ DWORD _stdcall
       if ( gOptions.file.contents & OPT_PropActionMake )
       {
          log.contents = L'C';
-         rc = FileCreate(srcEntry);
+         rc = FileCreate(action);
          if ( !rc )
             if ( gOptions.file.perms & OPT_PropActionMake )
                rc = PermCreate(0, &log.perms);
@@ -771,7 +749,7 @@ DWORD _stdcall
           || gOptions.global & OPT_GlobalHidden     ) )
       {
          log.contents = L'D';
-         rc = FileRemove(tgtEntry);
+         rc = FileRemove(action);
       }
       else
          if ( gOptions.file.perms & OPT_PropActionRemove )
@@ -785,7 +763,7 @@ DWORD _stdcall
        && ( !( tgtEntry->attrFile & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM) )
           || gOptions.global & OPT_GlobalHidden     ) )
       {
-         rc = FileUpdate(srcEntry, tgtEntry, &log);
+         rc = FileUpdate(action, &log);
       }
       if ( gOptions.file.perms & OPT_PropActionAll )
          rc = PermReplicate(0, &log.perms);
@@ -793,6 +771,44 @@ DWORD _stdcall
 
    if ( gOptions.global & OPT_GlobalDispDetail )
       if ( gOptions.global & OPT_GlobalDispMatches || wcsncmp((WCHAR*)&log, L"   ", 3) )
-         err.MsgWrite(0, L" %-3.3s %s", &log, gOptions.target.path);
+         if ( action->log )
+            LogBufferAdd(action->log, L" %-3.3s %s", &log, action->tgtPath);
+         else
+            err.MsgWrite(0, L" %-3.3s %s", &log, action->tgtPath);
    return rc;
 }
+
+
+//-----------------------------------------------------------------------------
+// Processes a matched file entry.  The source or the target (not both)
+// may be missing (DirEntry == NULL).  With /pipe, the action is handed to
+// the pipeline and counted in the directory's pending actions, otherwise it
+// is processed inline with the walk's paths, buffer and statistics.
+//-----------------------------------------------------------------------------
+DWORD _stdcall
+   MatchedFileProcess(
+      DirEntry const       * srcEntry    ,// in -current source entry processed
+      DirEntry const       * tgtEntry    ,// in -current target entry processed
+      LONG volatile        * pending      // i/o-directory's outstanding pipelined actions
+   )
+{
+   FileAction                action;
+
+   if ( gOptions.fState & FLAG_Pipeline )
+      return PipelineSubmit(srcEntry, tgtEntry, pending);
+
+   action.srcEntry   = srcEntry;
+   action.tgtEntry   = tgtEntry;
+   action.srcApiPath = gOptions.source.apipath;
+   action.tgtApiPath = gOptions.target.apipath;
+   action.srcPath    = gOptions.source.path;
+   action.tgtPath    = gOptions.target.path;
+   action.copyBuffer = gOptions.copyBuffer;
+   action.sizeBuffer = gOptions.sizeBuffer;
+   action.stats      = &gOptions.stats;
+   action.pending    = pending;      // not counted inline, identifies the directory
+   action.srcDir     = gOptions.source.hDir;
+   action.tgtDir     = gOptions.target.hDir;
+   action.log        = NULL;
+   return FileActionProcess(&action);
+}
@@ -0,0 +1,449 @@
+/*
+===============================================================================
+
+  Module     - Purge
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Parallel removal of target subtrees that have no source at all,
+               such as when the source is '-' or a large directory was
+               removed from it.  The walk would enter every directory of such
+               a subtree, DirGet it into the DirBuffer and remove each file
+               one at a time through FileRemove, all on the walk thread.
+
+               Here the subtree's directories are shared out to PURGE_Threads
+               workers, the walk thread lending a hand until the subtree is
+               gone.  A worker enumerates a directory through its handle a
+               buffer of entries at a time and removes its files relative to
+               that handle.  Subdirectories are queued for any worker to take.
+               Each directory counts its own enumeration and its subdirectories
+               not yet removed, and whoever brings the count to zero removes
+               it and counts it off its parent, so directories go bottom-up
+               as soon as they are empty.  The subtree's root is left for the
+               walk's own DirRemove.
+
+               The walk's rules are kept: filtered files, read-only ones
+               without /r, hidden and system ones without /h and /resume part
+               files are left, as are hidden directories without /h and those
+               past /level=.  A directory symbolic link or junction is removed
+               without removing what it points to.
+  Updates -
+
+===============================================================================
+*/
+
+#include <process.h>
+
+#include "netditto.hpp"
+
+#define PURGE_Threads        8            // workers besides the walk thread
+#define PURGE_Buffer         (64*1024)    // directory enumeration buffer
+
+struct PurgeDir                           // directory queued for purging
+{
+   PurgeDir                * next;        // next queued
+   PurgeDir                * parent;      // NULL for the subtree root
+   LONG volatile             pending;     // own enumeration plus subdirectories left
+   DWORD                     attr;        // attributes
+   short                     level;       // recursion level, for /level=
+   WCHAR                     apiPath[1];  // \\?\ path
+};
+
+struct PurgeWork                          // a purging thread's work areas
+{
+   WCHAR                   * path;        // entry path being formed
+   BYTE                    * buffer;      // enumeration buffer
+};
+
+static PurgeDir            * stack;       // directories queued, taken last first
+static TCriticalSection      csStack;
+static TSemaphore          * semQueued;   // directories queued
+static TEvent              * evTreeDone;  // subtree root's count reached zero
+static HANDLE                hThread[PURGE_Threads];
+static int                   nThread;
+static PurgeWork             work[PURGE_Threads + 1]; // workers', then the walk thread's
+static bool                  started;
+static Stats                 purgeStats;  // counted by all purging threads
+
+
+static void
+   PurgeCount(
+      StatCount            * count        // i/o-count
+   )
+{
+   InterlockedIncrement((LONG volatile *)count);
+}
+
+
+// Queues a directory for any purging thread to take
+static void
+   PurgePush(
+      PurgeDir             * dir          // in -directory
+   )
+{
+   csStack.Enter();
+   dir->next = stack;
+   stack = dir;
+   csStack.Leave();
+   semQueued->Release();
+}
+
+
+// Takes a queued directory once semQueued has been waited on.  NULL, with
+// nothing queued, is a terminate request.
+static PurgeDir *
+   PurgePop(
+   )
+{
+   PurgeDir                * dir;
+
+   csStack.Enter();
+   if ( dir = stack )
+      stack = dir->next;
+   csStack.Leave();
+   return dir;
+}
+
+
+// Removes a directory of the subtree as DirRemove would
+static void
+   PurgeDirRemove(
+      WCHAR const          * apiPath     ,// in -directory \\?\ path
+      DWORD                  attr         // in -attributes
+   )
+{
+   WCHAR const             * path = apiPath + DIM(gOptions.target.apipath);
+   DWORD                     rc;
+
+   if ( attr & FILE_ATTRIBUTE_READONLY  &&  !(gOptions.global & OPT_GlobalReadOnly) )
+      return;
+   PurgeCount(&purgeStats.change.dirRemoved);
+   if ( attr & FILE_ATTRIBUTE_READONLY
+     && !SetFileAttributes(apiPath, FILE_ATTRIBUTE_NORMAL) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(20628, rc, L"SetDirAttributes(%s)=%ld ", path, rc);
+      return;
+   }
+   if ( !RemoveDirectory(apiPath) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(30204, rc, L"RemoveDirectory(%s)=%ld ", path, rc);
+      return;
+   }
+   if ( gOptions.global & OPT_GlobalDispDetail )
+      err.MsgWrite(0, L" R   %s", path);
+}
+
+
+// Counts off the enumeration or a removed subdirectory of a directory,
+// removing it and so on up the tree when it is done
+static void
+   PurgeDirDone(
+      PurgeDir             * dir          // i/o-directory, freed once removed
+   )
+{
+   PurgeDir                * parent;
+
+   while ( InterlockedDecrement(&dir->pending) == 0 )
+   {
+      if ( !(parent = dir->parent) )
+      {
+         evTreeDone->Set();               // the root is the walk's to remove
+         return;
+      }
+      PurgeDirRemove(dir->apiPath, dir->attr);
+      free(dir);
+      dir = parent;
+   }
+}
+
+
+// Removes a file of the subtree as FileRemove would, or queues a directory
+static void
+   PurgeEntry(
+      PurgeDir             * dir         ,// i/o-directory the entry is in
+      HANDLE                 hDir        ,// in -directory handle
+      WCHAR const          * path        ,// in -entry \\?\ path
+      WCHAR const          * name        ,// in -entry name
+      FILE_FULL_DIR_INFO const * info     // in -entry information
+   )
+{
+   PurgeDir                * sub;
+   DWORD                     attr = info->FileAttributes,
+                             rc;
+   size_t                    cchPath;
+
+   // hidden entries aren't seen at all without /h
+   if ( attr & FILE_ATTRIBUTE_HIDDEN  &&  !(gOptions.global & OPT_GlobalHidden) )
+      return;
+
+   if ( attr & FILE_ATTRIBUTE_DIRECTORY )
+   {
+      if ( attr & FILE_ATTRIBUTE_REPARSE_POINT )
+      {
+         PurgeDirRemove(path, attr);      // the link, not what it points to
+         return;
+      }
+      if ( dir->level + 1 > gOptions.maxLevel )
+         return;
+      cchPath = wcslen(path);
+      sub = (PurgeDir *)malloc(offsetof(PurgeDir, apiPath) + (cchPath + 1) * sizeof (WCHAR));
+      if ( !sub )
+      {
+         err.MsgWrite(31603, L"Purge directory allocation failed (%s)",
+                             path + DIM(gOptions.target.apipath));
+         return;
+      }
+      sub->parent  = dir;
+      sub->pending = 1;                   // its enumeration
+      sub->attr    = attr;
+      sub->level   = dir->level + 1;
+      wcscpy(sub->apiPath, path);
+      InterlockedIncrement(&dir->pending);
+      PurgePush(sub);
+      return;
+   }
+
+   PurgeCount(&purgeStats.target.fileFound.count);
+   InterlockedExchangeAdd64(&purgeStats.target.fileFound.bytes, info->EndOfFile.QuadPart);
+   if ( FilterReject(name, gOptions.include, gOptions.exclude) )
+      return;
+   PurgeCount(&purgeStats.target.fileFiltered.count);
+   InterlockedExchangeAdd64(&purgeStats.target.fileFiltered.bytes, info->EndOfFile.QuadPart);
+
+   if ( (attr & FILE_ATTRIBUTE_READONLY  &&  !(gOptions.global & OPT_GlobalReadOnly))
+     || (attr & FILE_ATTRIBUTE_SYSTEM    &&  !(gOptions.global & OPT_GlobalHidden))
+     || (gOptions.global & OPT_GlobalResume  &&  ResumeFileIs(name)) )
+      return;
+
+   PurgeCount(&purgeStats.change.fileRemoved.count);
+   InterlockedExchangeAdd64(&purgeStats.change.fileRemoved.bytes, info->EndOfFile.QuadPart);
+   if ( attr & FILE_ATTRIBUTE_READONLY
+     && !RelSetFileAttributes(hDir, path, FILE_ATTRIBUTE_NORMAL) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(30208, rc, L"SetFileAttributes(%s)=%ld ",
+                                 path + DIM(gOptions.target.apipath), rc);
+      return;
+   }
+   if ( !RelDeleteFile(hDir, path) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(30204, rc, L"DeleteFile(%s)=%ld ", path + DIM(gOptions.target.apipath), rc);
+      return;
+   }
+   if ( gOptions.global & OPT_GlobalDispDetail )
+      err.MsgWrite(0, L" D   %s", path + DIM(gOptions.target.apipath));
+}
+
+
+// Enumerates a directory through its handle, removing its files and queuing
+// its subdirectories, then counts its enumeration done
+static void
+   PurgeEnum(
+      PurgeDir             * dir         ,// i/o-directory
+      PurgeWork            * work         // i/o-thread's work areas
+   )
+{
+   FILE_FULL_DIR_INFO      * info;
+   HANDLE                    hDir;
+   size_t                    cchDir = wcslen(dir->apiPath),
+                             cchName;
+   WCHAR                   * name = work->path + cchDir + 1;
+   DWORD                     rc;
+
+   hDir = CreateFile(dir->apiPath,
+                     FILE_LIST_DIRECTORY | SYNCHRONIZE,
+                     FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                     NULL, OPEN_EXISTING,
+                     FILE_FLAG_BACKUP_SEMANTICS,
+                     0);
+   if ( hDir == INVALID_HANDLE_VALUE )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(31601, rc, L"Purge OpenDir(%s)=%ld ",
+                             dir->apiPath + DIM(gOptions.target.apipath), rc);
+      PurgeDirDone(dir);
+      return;
+   }
+   PurgeCount(&purgeStats.target.dirFound);
+   PurgeCount(&purgeStats.target.dirFiltered);
+
+   wcscpy(work->path, dir->apiPath);
+   work->path[cchDir] = L'\\';
+   while ( GetFileInformationByHandleEx(hDir, FileFullDirectoryInfo, work->buffer, PURGE_Buffer) )
+   {
+      for ( info = (FILE_FULL_DIR_INFO *)work->buffer;  ;
+            info = (FILE_FULL_DIR_INFO *)((BYTE *)info + info->NextEntryOffset) )
+      {
+         cchName = info->FileNameLength / sizeof (WCHAR);
+         if ( cchDir + 1 + cchName < DIM(gOptions.target.path)
+           && !(info->FileName[0] == L'.'
+                && (cchName == 1  ||  (cchName == 2  &&  info->FileName[1] == L'.'))) )
+         {
+            wcsncpy(name, info->FileName, cchName);
+            name[cchName] = L'\0';
+            PurgeEntry(dir, hDir, work->path, name, info);
+         }
+         if ( !info->NextEntryOffset )
+            break;
+      }
+   }
+   if ( (rc = GetLastError()) != ERROR_NO_MORE_FILES )
+      err.SysMsgWrite(31602, rc, L"Purge enumerate(%s)=%ld ",
+                             dir->apiPath + DIM(gOptions.target.apipath), rc);
+   CloseHandle(hDir);
+   PurgeDirDone(dir);
+}
+
+
+// Worker thread that purges queued directories until it takes a NULL one
+static unsigned __stdcall
+   PurgeThread(
+      void                 * arg          // i/o-PurgeWork
+   )
+{
+   PurgeDir                * dir;
+
+   for ( ;; )
+   {
+      semQueued->WaitSingle();
+      if ( !(dir = PurgePop()) )
+         break;                           // terminate request
+      PurgeEnum(dir, (PurgeWork *)arg);
+   }
+   return 0;
+}
+
+
+// Allocates a purging thread's work areas
+static bool
+   PurgeWorkAlloc(
+      PurgeWork            * w            // out-work areas
+   )
+{
+   w->path   = (WCHAR *)malloc(sizeof gOptions.target.apipath + sizeof gOptions.target.path);
+   w->buffer = (BYTE *)malloc(PURGE_Buffer);
+   return w->path  &&  w->buffer;
+}
+
+
+// Starts the purge workers on the first subtree.  Returns false if not even
+// the walk thread's work areas can be had.
+static bool
+   PurgeStart(
+   )
+{
+   if ( !PurgeWorkAlloc(&work[PURGE_Threads]) )
+   {
+      err.MsgWrite(51601, L"Purge buffer allocation failed");
+      return false;
+   }
+   started    = true;
+   semQueued  = new TSemaphore(0, MAXLONG);
+   evTreeDone = new TEvent(FALSE, FALSE);
+   for ( nThread = 0;  nThread < PURGE_Threads;  nThread++ )
+   {
+      if ( !PurgeWorkAlloc(&work[nThread]) )
+         break;                           // fewer workers will do
+      hThread[nThread] = (HANDLE)_beginthreadex(NULL, 0, PurgeThread, &work[nThread], 0, NULL);
+      if ( !hThread[nThread] )
+      {
+         err.SysMsgWrite(21601, GetLastError(), L"_beginthreadex(PurgeThread)=%ld ",
+                                GetLastError());
+         break;
+      }
+   }
+   return true;
+}
+
+
+// Returns whether target subtrees without a source can be purged in
+// parallel rather than walked
+BOOL _stdcall
+   PurgeUse(
+   )
+{
+   return gOptions.global & OPT_GlobalChange
+       && gOptions.dir.contents  & OPT_PropActionRemove
+       && gOptions.file.contents & OPT_PropActionRemove
+       && !(gOptions.global & (OPT_GlobalBackup | OPT_GlobalBackupForce))
+       && !(gOptions.fState & FLAG_Sweep); // a sweep goes entry by entry
+}
+
+
+// Purges everything in the walk's current target directory, which has no
+// source, leaving the directory itself for DirRemove
+DWORD _stdcall
+   PurgeTree(
+      short                  level       ,// in -recursion level of the directory
+      DirEntry const       * tgtDirEntry  // in -target directory entry
+   )
+{
+   PurgeDir                * root,
+                           * dir;
+   HANDLE                    handles[2];
+   StatsChange             * change = &gOptions.stats.change;
+   StatsCommon             * target = &gOptions.stats.target;
+
+   if ( !started  &&  !PurgeStart() )
+      return ERROR_NOT_ENOUGH_MEMORY;
+   root = (PurgeDir *)malloc(offsetof(PurgeDir, apiPath)
+                             + (wcslen(gOptions.target.apipath) + 1) * sizeof (WCHAR));
+   if ( !root )
+   {
+      err.MsgWrite(51601, L"Purge buffer allocation failed");
+      return ERROR_NOT_ENOUGH_MEMORY;
+   }
+   root->parent  = NULL;
+   root->pending = 1;
+   root->attr    = tgtDirEntry->attrFile;
+   root->level   = level;
+   wcscpy(root->apiPath, gOptions.target.apipath);
+   PurgePush(root);
+
+   // lend a hand until the root's count reaches zero
+   handles[0] = evTreeDone->Handle();
+   handles[1] = semQueued->Handle();
+   while ( WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1 )
+      if ( dir = PurgePop() )
+         PurgeEnum(dir, &work[PURGE_Threads]);
+   free(root);
+
+   change->dirRemoved          += purgeStats.change.dirRemoved;
+   change->fileRemoved.count   += purgeStats.change.fileRemoved.count;
+   change->fileRemoved.bytes   += purgeStats.change.fileRemoved.bytes;
+   target->dirFound            += purgeStats.target.dirFound;
+   target->dirFiltered         += purgeStats.target.dirFiltered;
+   target->fileFound.count     += purgeStats.target.fileFound.count;
+   target->fileFound.bytes     += purgeStats.target.fileFound.bytes;
+   target->fileFiltered.count  += purgeStats.target.fileFiltered.count;
+   target->fileFiltered.bytes  += purgeStats.target.fileFiltered.bytes;
+   memset(&purgeStats, 0, sizeof purgeStats);
+   return 0;
+}
+
+
+// Ends the purge workers
+void _stdcall
+   PurgeTerminate(
+   )
+{
+   int                       n;
+
+   if ( !started )
+      return;
+   semQueued->Release(nThread);           // nothing is queued, so these are NULLs
+   WaitForMultipleObjects(nThread, hThread, TRUE, INFINITE);
+   for ( n = 0;  n < nThread;  n++ )
+      CloseHandle(hThread[n]);
+   for ( n = 0;  n <= PURGE_Threads;  n++ )
+   {
+      free(work[n].path);
+      free(work[n].buffer);
+   }
+   delete semQueued;
+   delete evTreeDone;
+   started = false;
+}
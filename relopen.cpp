@@ -0,0 +1,230 @@
+/*
+===============================================================================
+
+  Module     - RelOpen
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Opens, deletes and attribute changes of files relative to an
+               open handle of their directory, the Win32 counterpart of
+               openat, unlinkat and the like.  Given a full \\?\ path, the
+               system parses and looks up every component of it again on
+               each call, which on deep trees is most of the cost of a small
+               file.  MatchEntries keeps a handle of the source and target
+               directory of each level of the walk open and the file actions
+               pass them here, so only the file's own name is looked up, by
+               NtCreateFile with the directory as its root.
+
+               The functions take the full path anyway and behave like the
+               Win32 calls they stand in for, last error and all.  Without a
+               directory handle, or if ntdll's entry points can't be had,
+               they just make the Win32 call with the path.  Messages keep
+               using the full path.
+  Updates -
+
+===============================================================================
+*/
+
+#include "netditto.hpp"
+
+#include <winternl.h>
+
+#ifndef NT_SUCCESS
+#define NT_SUCCESS(status)   ((NTSTATUS)(status) >= 0)
+#endif
+#ifndef FILE_ATTRIBUTE_VALID_SET_FLAGS
+#define FILE_ATTRIBUTE_VALID_SET_FLAGS 0x000031A7 // what SetFileAttributes can set
+#endif
+#ifndef FILE_OPEN_REPARSE_POINT
+#define FILE_OPEN_REPARSE_POINT 0x00200000
+#endif
+
+typedef NTSTATUS (NTAPI * NtCreateFileFn)(PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES,
+                                          PIO_STATUS_BLOCK, PLARGE_INTEGER, ULONG, ULONG,
+                                          ULONG, ULONG, PVOID, ULONG);
+typedef ULONG (NTAPI * RtlNtStatusToDosErrorFn)(NTSTATUS);
+
+static NtCreateFileFn          pNtCreateFile;
+static RtlNtStatusToDosErrorFn pRtlNtStatusToDosError;
+
+
+// Gets the ntdll entry points.  Relative opens are off if they aren't there.
+void _stdcall
+   RelOpenInit(
+   )
+{
+   HMODULE                   hNtdll = GetModuleHandle(L"ntdll.dll");
+
+   if ( !hNtdll )
+      return;
+   pNtCreateFile          = (NtCreateFileFn)GetProcAddress(hNtdll, "NtCreateFile");
+   pRtlNtStatusToDosError = (RtlNtStatusToDosErrorFn)GetProcAddress(hNtdll,
+                                                                    "RtlNtStatusToDosError");
+   if ( !pRtlNtStatusToDosError )
+      pNtCreateFile = NULL;
+}
+
+
+// Opens a directory of the walk for the relative opens of its files.
+// Returns NULL if it can't be or relative opens are off.
+HANDLE _stdcall
+   RelDirOpen(
+      WCHAR const          * apiPath      // in -directory \\?\ path
+   )
+{
+   HANDLE                    hDir;
+
+   if ( !pNtCreateFile )
+      return NULL;
+   hDir = CreateFile(apiPath,
+                     FILE_TRAVERSE | SYNCHRONIZE,
+                     FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                     NULL, OPEN_EXISTING,
+                     FILE_FLAG_BACKUP_SEMANTICS,
+                     0);
+   return hDir == INVALID_HANDLE_VALUE ? NULL : hDir;
+}
+
+
+// Opens a file by its name relative to the directory handle
+static HANDLE
+   RelNtOpen(
+      HANDLE                 hDir        ,// in -directory handle
+      WCHAR const          * apiPath     ,// in -file \\?\ path, last name used
+      DWORD                  access      ,// in -access as for CreateFile
+      DWORD                  share       ,// in -share mode
+      ULONG                  disposition ,// in -NtCreateFile disposition
+      ULONG                  options     ,// in -NtCreateFile options
+      DWORD                  attr         // in -attributes for a created file
+   )
+{
+   WCHAR const             * name = wcsrchr(apiPath, L'\\') + 1;
+   UNICODE_STRING            uName;
+   OBJECT_ATTRIBUTES         objAttr;
+   IO_STATUS_BLOCK           iosb;
+   HANDLE                    handle;
+   NTSTATUS                  status;
+
+   uName.Buffer        = (WCHAR *)name;
+   uName.Length        = (USHORT)(wcslen(name) * sizeof (WCHAR));
+   uName.MaximumLength = uName.Length;
+   InitializeObjectAttributes(&objAttr, &uName, OBJ_CASE_INSENSITIVE, hDir, NULL);
+
+   status = pNtCreateFile(&handle, access | SYNCHRONIZE | FILE_READ_ATTRIBUTES,
+                          &objAttr, &iosb, NULL, attr, share, disposition, options, NULL, 0);
+   if ( !NT_SUCCESS(status) )
+   {
+      SetLastError(pRtlNtStatusToDosError(status));
+      return INVALID_HANDLE_VALUE;
+   }
+   return handle;
+}
+
+
+// CreateFile of a file in the directory of hDir, relative to it
+HANDLE _stdcall
+   RelCreateFile(
+      HANDLE                 hDir        ,// in -directory handle, NULL for by path
+      WCHAR const          * apiPath     ,// in -file \\?\ path
+      DWORD                  access      ,// in -as for CreateFile
+      DWORD                  share       ,// in -as for CreateFile
+      DWORD                  creation    ,// in -as for CreateFile
+      DWORD                  flagsAttr    // in -as for CreateFile
+   )
+{
+   ULONG                     disposition,
+                             options = 0;
+
+   if ( !hDir  ||  !pNtCreateFile )
+      return CreateFile(apiPath, access, share, NULL, creation, flagsAttr, 0);
+
+   switch ( creation )
+   {
+      case CREATE_NEW:        disposition = FILE_CREATE;       break;
+      case CREATE_ALWAYS:     disposition = FILE_OVERWRITE_IF; break;
+      case OPEN_ALWAYS:       disposition = FILE_OPEN_IF;      break;
+      case TRUNCATE_EXISTING: disposition = FILE_OVERWRITE;    break;
+      default:                disposition = FILE_OPEN;         break;
+   }
+   if ( !(flagsAttr & FILE_FLAG_OVERLAPPED) )
+      options |= FILE_SYNCHRONOUS_IO_NONALERT;
+   if ( flagsAttr & FILE_FLAG_BACKUP_SEMANTICS )
+      options |= FILE_OPEN_FOR_BACKUP_INTENT;
+   else
+      options |= FILE_NON_DIRECTORY_FILE;
+   if ( flagsAttr & FILE_FLAG_NO_BUFFERING )
+      options |= FILE_NO_INTERMEDIATE_BUFFERING;
+   if ( flagsAttr & FILE_FLAG_WRITE_THROUGH )
+      options |= FILE_WRITE_THROUGH;
+   if ( flagsAttr & FILE_FLAG_SEQUENTIAL_SCAN )
+      options |= FILE_SEQUENTIAL_ONLY;
+   if ( flagsAttr & FILE_FLAG_RANDOM_ACCESS )
+      options |= FILE_RANDOM_ACCESS;
+
+   return RelNtOpen(hDir, apiPath, access, share, disposition, options,
+                    flagsAttr & 0xFFFF & ~(FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_NORMAL));
+}
+
+
+// DeleteFile of a file in the directory of hDir, relative to it
+BOOL _stdcall
+   RelDeleteFile(
+      HANDLE                 hDir        ,// in -directory handle, NULL for by path
+      WCHAR const          * apiPath      // in -file \\?\ path
+   )
+{
+   FILE_DISPOSITION_INFO     disp;
+   HANDLE                    handle;
+   BOOL                      ok;
+   DWORD                     rc;
+
+   if ( !hDir  ||  !pNtCreateFile )
+      return DeleteFile(apiPath);
+
+   handle = RelNtOpen(hDir, apiPath, DELETE,
+                      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_OPEN,
+                      FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE
+                      | FILE_OPEN_REPARSE_POINT, 0);
+   if ( handle == INVALID_HANDLE_VALUE )
+      return FALSE;
+   disp.DeleteFile = TRUE;
+   ok = SetFileInformationByHandle(handle, FileDispositionInfo, &disp, sizeof disp);
+   rc = GetLastError();
+   CloseHandle(handle);
+   SetLastError(rc);
+   return ok;
+}
+
+
+// SetFileAttributes of a file in the directory of hDir, relative to it
+BOOL _stdcall
+   RelSetFileAttributes(
+      HANDLE                 hDir        ,// in -directory handle, NULL for by path
+      WCHAR const          * apiPath     ,// in -file \\?\ path
+      DWORD                  attr         // in -attributes
+   )
+{
+   FILE_BASIC_INFO           basic;
+   HANDLE                    handle;
+   BOOL                      ok;
+   DWORD                     rc;
+
+   if ( !hDir  ||  !pNtCreateFile )
+      return SetFileAttributes(apiPath, attr);
+
+   handle = RelNtOpen(hDir, apiPath, FILE_WRITE_ATTRIBUTES,
+                      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_OPEN,
+                      FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE
+                      | FILE_OPEN_REPARSE_POINT, 0);
+   if ( handle == INVALID_HANDLE_VALUE )
+      return FALSE;
+   memset(&basic, 0, sizeof basic);       // zero times are left unchanged
+   basic.FileAttributes = attr & FILE_ATTRIBUTE_VALID_SET_FLAGS;
+   if ( !basic.FileAttributes )
+      basic.FileAttributes = FILE_ATTRIBUTE_NORMAL;
+   ok = SetFileInformationByHandle(handle, FileBasicInfo, &basic, sizeof basic);
+   rc = GetLastError();
+   CloseHandle(handle);
+   SetLastError(rc);
+   return ok;
+}
@@ -0,0 +1,251 @@
+/*
+===============================================================================
+
+  Module     - Resume
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Resumable copies of large files with /resume.  Otherwise a
+               copy interrupted near the end of a huge file starts over from
+               offset zero on the next run since the target is created anew.
+
+               A file of RESUME_Min or more is copied to a part file beside
+               the target, <name>.ndpart, and renamed over the target only
+               once complete.  As the overlapped copy proceeds the part file
+               is flushed every RESUME_Interval bytes and a small checkpoint,
+               <name>.ndckpt, records how far it is known written along with
+               the CRC-32C of the block just before that point.  The next run
+               finds the checkpoint and, if the source's size and last write
+               time are unchanged and that block reads back the same, carries
+               on the copy from there.  Anything amiss and it starts over.
+
+               The walk leaves part and checkpoint files alone with /resume
+               rather than removing them as extra target files.
+  Updates -
+
+===============================================================================
+*/
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+#define RESUME_PartSuffix    L".ndpart"
+#define RESUME_CkptSuffix    L".ndckpt"
+#define RESUME_Interval      ((__int64)256*1024*1024) // bytes between checkpoints
+#define RESUME_Probe         (64*1024)    // bytes whose CRC is checkpointed
+#define RESUME_Magic         0x4B43444E   // "NDCK"
+
+struct ResumeCkpt                         // checkpoint file contents
+{
+   DWORD                     magic;       // RESUME_Magic
+   DWORD                     crcProbe;    // CRC-32C of the probe before cbDone
+   __int64                   cbSource;    // source size
+   FILETIME                  ftimeSource; // source last write time
+   __int64                   cbDone;      // bytes written from the start
+};
+
+
+// Computes the CRC-32C of the probe bytes of the part file ending at cbDone
+static DWORD
+   ResumeProbe(
+      WCHAR const          * partApiPath ,// in -part file path
+      __int64                cbDone      ,// in -end of probe
+      DWORD                * crc          // out-CRC-32C
+   )
+{
+   HANDLE                    hPart;
+   BYTE                    * buffer;
+   LARGE_INTEGER             offset;
+   DWORD                     rc = 0,
+                             nRead;
+
+   if ( !(buffer = (BYTE *)malloc(RESUME_Probe)) )
+      return ERROR_NOT_ENOUGH_MEMORY;
+   hPart = CreateFile(partApiPath,
+                      GENERIC_READ,
+                      FILE_SHARE_READ | FILE_SHARE_WRITE,
+                      NULL, OPEN_EXISTING,
+                      FILE_ATTRIBUTE_NORMAL,
+                      0);
+   if ( hPart == INVALID_HANDLE_VALUE )
+      rc = GetLastError();
+   else
+   {
+      offset.QuadPart = cbDone - RESUME_Probe;
+      if ( !SetFilePointerEx(hPart, offset, NULL, FILE_BEGIN)
+        || !ReadFile(hPart, buffer, RESUME_Probe, &nRead, NULL) )
+         rc = GetLastError();
+      else if ( nRead != RESUME_Probe )
+         rc = ERROR_HANDLE_EOF;
+      else
+         *crc = ~XformCrc(0xFFFFFFFF, buffer, RESUME_Probe);
+      CloseHandle(hPart);
+   }
+   free(buffer);
+   return rc;
+}
+
+
+// Forms the part and checkpoint paths and, if a valid checkpoint is found,
+// sets where the copy resumes from
+DWORD _stdcall
+   ResumeBegin(
+      FileAction const     * action      ,// in -file action
+      ResumeState          * resume       // out-resume state
+   )
+{
+   DirEntry const          * srcEntry = action->srcEntry;
+   size_t                    cchPath = wcslen(action->tgtApiPath);
+   ResumeCkpt                ckpt;
+   HANDLE                    hCkpt;
+   DWORD                     nRead,
+                             crc;
+
+   resume->cbDone = resume->cbCkpt = 0;
+   resume->partApiPath = (WCHAR *)malloc((cchPath + DIM(RESUME_PartSuffix)) * sizeof (WCHAR));
+   resume->ckptApiPath = (WCHAR *)malloc((cchPath + DIM(RESUME_CkptSuffix)) * sizeof (WCHAR));
+   if ( !resume->partApiPath  ||  !resume->ckptApiPath )
+   {
+      free(resume->partApiPath);
+      free(resume->ckptApiPath);
+      err.MsgWrite(21101, L"Resume path allocation failed (%s)", action->tgtPath);
+      return ERROR_NOT_ENOUGH_MEMORY;
+   }
+   wcscat(wcscpy(resume->partApiPath, action->tgtApiPath), RESUME_PartSuffix);
+   wcscat(wcscpy(resume->ckptApiPath, action->tgtApiPath), RESUME_CkptSuffix);
+
+   hCkpt = CreateFile(resume->ckptApiPath,
+                      GENERIC_READ, FILE_SHARE_READ,
+                      NULL, OPEN_EXISTING,
+                      FILE_ATTRIBUTE_NORMAL,
+                      0);
+   if ( hCkpt == INVALID_HANDLE_VALUE )
+      return 0;                           // nothing to resume
+   if ( ReadFile(hCkpt, &ckpt, sizeof ckpt, &nRead, NULL)
+     && nRead == sizeof ckpt
+     && ckpt.magic == RESUME_Magic
+     && ckpt.cbSource == srcEntry->cbFile
+     && !CompareFileTime(&ckpt.ftimeSource, &srcEntry->ftimeLastWrite)
+     && ckpt.cbDone >= RESUME_Probe  &&  ckpt.cbDone < ckpt.cbSource
+     && !(ckpt.cbDone & (NOCACHE_Align - 1))
+     && !ResumeProbe(resume->partApiPath, ckpt.cbDone, &crc)
+     && crc == ckpt.crcProbe )
+   {
+      resume->cbDone = resume->cbCkpt = ckpt.cbDone;
+      err.MsgWrite(0, L"Resume %s at %I64d", action->tgtPath, ckpt.cbDone);
+   }
+   else
+      err.MsgWrite(21102, L"Checkpoint of %s not valid, copy restarted", action->tgtPath);
+   CloseHandle(hCkpt);
+   return 0;
+}
+
+
+// Records how far the part file is known written once another interval of
+// it is done.  The part file is flushed first so the checkpoint never claims
+// more than is durable.
+void _stdcall
+   ResumeCheckpoint(
+      FileAction const     * action      ,// in -file action writing the part file
+      ResumeState          * resume      ,// i/o-resume state
+      HANDLE                 hPart       ,// in -part file handle
+      __int64                cbDone       // in -bytes written from the start
+   )
+{
+   ResumeCkpt                ckpt;
+   HANDLE                    hCkpt;
+   DWORD                     rc,
+                             nWritten;
+
+   if ( cbDone - resume->cbCkpt < RESUME_Interval )
+      return;
+   resume->cbCkpt = cbDone;               // next interval even if this one fails
+
+   if ( !FlushFileBuffers(hPart) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(21103, rc, L"Checkpoint FlushFileBuffers(%s)=%ld ", action->tgtPath, rc);
+      return;
+   }
+   memset(&ckpt, 0, sizeof ckpt);
+   ckpt.magic       = RESUME_Magic;
+   ckpt.cbSource    = action->srcEntry->cbFile;
+   ckpt.ftimeSource = action->srcEntry->ftimeLastWrite;
+   ckpt.cbDone      = cbDone;
+   if ( rc = ResumeProbe(resume->partApiPath, cbDone, &ckpt.crcProbe) )
+   {
+      err.SysMsgWrite(21103, rc, L"Checkpoint probe(%s)=%ld ", action->tgtPath, rc);
+      return;
+   }
+
+   hCkpt = CreateFile(resume->ckptApiPath,
+                      GENERIC_WRITE, 0,
+                      NULL, CREATE_ALWAYS,
+                      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_WRITE_THROUGH,
+                      0);
+   if ( hCkpt == INVALID_HANDLE_VALUE
+     || !WriteFile(hCkpt, &ckpt, sizeof ckpt, &nWritten, NULL) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(21104, rc, L"Checkpoint write(%s)=%ld ", action->tgtPath, rc);
+   }
+   else
+      resume->cbDone = cbDone;
+   if ( hCkpt != INVALID_HANDLE_VALUE )
+      CloseHandle(hCkpt);
+}
+
+
+// Closes the part file and, if the copy succeeded, renames it over the target
+// and removes the checkpoint.  A failed copy leaves both for the next run.
+DWORD _stdcall                            // ret-copy or rename error code
+   ResumeEnd(
+      FileAction const     * action      ,// in -file action
+      ResumeState          * resume      ,// i/o-resume state, freed
+      HANDLE                 hPart       ,// in -part file handle, closed
+      DWORD                  rc           // in -copy return code
+   )
+{
+   if ( !rc  &&  gOptions.fState & FLAG_Flush  &&  !FlushFileBuffers(hPart) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(30801, rc, L"FlushFileBuffers(%s)=%ld ", action->tgtPath, rc);
+   }
+   CloseHandle(hPart);
+
+   if ( !rc )
+   {
+      if ( !MoveFileEx(resume->partApiPath, action->tgtApiPath,
+                       MOVEFILE_REPLACE_EXISTING
+                       | (gOptions.fState & FLAG_Flush ? MOVEFILE_WRITE_THROUGH : 0)) )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(31101, rc, L"Resume rename(%s)=%ld ", action->tgtPath, rc);
+      }
+      else
+      {
+         InterlockedIncrement(&gOptions.nRenamed);
+         if ( !DeleteFile(resume->ckptApiPath)  &&  GetLastError() != ERROR_FILE_NOT_FOUND )
+            err.SysMsgWrite(21105, GetLastError(), L"Checkpoint delete(%s)=%ld ",
+                                   action->tgtPath, GetLastError());
+         FlushParentDir(action->tgtApiPath);
+      }
+   }
+   free(resume->partApiPath);
+   free(resume->ckptApiPath);
+   return rc;
+}
+
+
+// Returns whether a target name is a /resume part or checkpoint file
+BOOL _stdcall
+   ResumeFileIs(
+      WCHAR const          * name         // in -file name
+   )
+{
+   size_t                    cchName = wcslen(name);
+
+   return cchName > DIM(RESUME_PartSuffix) - 1
+       && (!_wcsicmp(name + cchName - (DIM(RESUME_PartSuffix) - 1), RESUME_PartSuffix)
+        || !_wcsicmp(name + cchName - (DIM(RESUME_CkptSuffix) - 1), RESUME_CkptSuffix));
+}
@@ -0,0 +1,401 @@
+/*
+===============================================================================
+
+  Module     - ScanAhead
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Reading of directories ahead of the walk.  The walk reads a
+               directory only when it enters it, so each Find*File round trip,
+               long on a network share, is waited on in turn.
+
+               As the walk goes through a directory, the next SCAN_Window
+               source subdirectories it will enter, and their targets, are
+               queued here and read by SCAN_Threads workers into listings of
+               their own, so several siblings' entries are at hand at once.
+               Those of the deepest directory are read first, as the walk
+               will want them first.  DirGet takes a directory's listing
+               rather than reading it itself, waits if it is being read, and
+               reads it as before if it isn't read yet or couldn't be, so
+               errors are reported as they always were.
+
+               /scanmem= limits the reading ahead: no directory is read ahead
+               while the listings held and the DirBuffer together reach it.
+               With /spill=, DirGet spills a directory that would grow the
+               DirBuffer past it too; without, the DirBuffer grows as the
+               walk needs.  Listings the walk doesn't
+               take, such as of directories a /journal= skips, are dropped
+               as it leaves their parent.  There is no reading ahead in a
+               sweep, which may stop anywhere.
+  Updates -
+
+===============================================================================
+*/
+
+#include <process.h>
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+#define SCAN_Threads         4            // directory readers
+#define SCAN_Window          32           // directories read ahead of the walk per level
+#define SCAN_ListingGrow     (64*1024)    // listing growth in bytes
+
+#define SCAN_Queued          0            // ScanDir states
+#define SCAN_Reading         1
+#define SCAN_Ready           2
+#define SCAN_Failed          3
+
+struct ScanDir                            // directory read ahead of the walk
+{
+   ScanDir                 * next;        // next in the order to be read
+   DirOptions const        * side;        // &gOptions.source or &gOptions.target
+   short                     level;       // recursion level of the directory
+   char                      state;       // SCAN_Queued...
+   bool                      dropped;     // no longer wanted, freed by its reader
+   BYTE                    * listing;     // DirEntry records packed as in a DirBlock
+   size_t                    cbListing;
+   size_t                    cbAlloc;
+   size_t                    offNext;     // next record to take
+   WCHAR                     apiPath[1];  // \\?\ path, room for \*
+};
+
+extern BufferOffset          bufferMax;   // DirBuffer memory
+
+static ScanDir             * head;        // deepest level first, in walk order within a level
+static TCriticalSection      csScan;
+static TEvent                evWork;      // directory queued or memory freed
+static TEvent                evRead(FALSE, FALSE); // a directory was read
+static HANDLE                hThread[SCAN_Threads];
+static int                   nThread;
+static __int64               cbAhead;     // listings held
+static bool volatile         stop;
+static bool                  started;
+static long                  nRead,       // directories read ahead
+                             nTaken;      // of them, those DirGet took
+
+
+static void
+   ScanDirFree(
+      ScanDir              * scan         // in -directory, freed
+   )
+{
+   free(scan->listing);
+   free(scan);
+}
+
+
+// Reads a directory into its listing.  Returns false if it couldn't.
+static bool
+   ScanRead(
+      ScanDir              * scan         // i/o-directory
+   )
+{
+   WIN32_FIND_DATA           fd;
+   HANDLE                    hFind;
+   DirEntry                * entry;
+   BYTE                    * grown;
+   size_t                    cch = wcslen(scan->apiPath),
+                             cbEntry;
+   DWORD                     rc;
+
+   wcscpy(scan->apiPath + cch, L"\\*");
+   hFind = FindFirstFileEx(scan->apiPath, FindExInfoBasic, &fd, FindExSearchNameMatch,
+                           NULL, FIND_FIRST_EX_LARGE_FETCH);
+   scan->apiPath[cch] = L'\0';
+   if ( hFind == INVALID_HANDLE_VALUE )
+      return false;
+   do
+   {
+      if ( fd.cFileName[0] == L'.'
+        && (!fd.cFileName[1]  ||  (fd.cFileName[1] == L'.'  &&  !fd.cFileName[2])) )
+         continue;
+      cbEntry = CB_DirEntry(wcslen(fd.cFileName));
+      if ( scan->cbListing + cbEntry > scan->cbAlloc )
+      {
+         if ( !(grown = (BYTE *)realloc(scan->listing, scan->cbAlloc + SCAN_ListingGrow)) )
+         {
+            FindClose(hFind);
+            return false;
+         }
+         scan->listing  = grown;
+         scan->cbAlloc += SCAN_ListingGrow;
+      }
+      entry = (DirEntry *)(scan->listing + scan->cbListing);
+      entry->ftimeLastWrite = fd.ftLastWriteTime;
+      entry->cbFile         = INT64R(fd.nFileSizeLow, fd.nFileSizeHigh);
+      entry->attrFile       = fd.dwFileAttributes;
+      wcscpy(entry->cFileName, fd.cFileName);
+      scan->cbListing += cbEntry;
+   } while ( FindNextFile(hFind, &fd) );
+   rc = GetLastError();
+   FindClose(hFind);
+   return rc == ERROR_NO_MORE_FILES;
+}
+
+
+// Takes the first queued directory if memory allows.  csScan is held.
+static ScanDir *
+   ScanNextQueued(
+   )
+{
+   ScanDir                 * scan;
+
+   if ( cbAhead + bufferMax >= gOptions.cbDirMemMax )
+      return NULL;
+   for ( scan = head;  scan;  scan = scan->next )
+      if ( scan->state == SCAN_Queued )
+         return scan;
+   return NULL;
+}
+
+
+// Reader thread
+static unsigned __stdcall
+   ScanThread(
+      void                 * arg          // in -not used
+   )
+{
+   ScanDir                 * scan;
+   bool                      ok;
+
+   for ( ;; )
+   {
+      csScan.Enter();
+      while ( !stop  &&  !(scan = ScanNextQueued()) )
+      {
+         evWork.Reset();                  // set again under csScan, so not missed
+         csScan.Leave();
+         WaitForSingleObject(evWork.Handle(), INFINITE);
+         csScan.Enter();
+      }
+      if ( stop )
+      {
+         csScan.Leave();
+         break;
+      }
+      scan->state = SCAN_Reading;
+      csScan.Leave();
+
+      ok = ScanRead(scan);
+
+      csScan.Enter();
+      if ( scan->dropped )
+         ScanDirFree(scan);
+      else
+      {
+         scan->state = ok ? SCAN_Ready : SCAN_Failed;
+         cbAhead += scan->cbAlloc;
+         nRead++;
+      }
+      csScan.Leave();
+      evRead.Set();
+   }
+   return 0;
+}
+
+
+// Starts the readers unless there is to be no reading ahead
+void _stdcall
+   ScanAheadStart(
+   )
+{
+   if ( !(gOptions.global & OPT_GlobalScanAhead)  ||  gOptions.fState & FLAG_Sweep )
+      return;
+   for ( nThread = 0;  nThread < SCAN_Threads;  nThread++ )
+   {
+      hThread[nThread] = (HANDLE)_beginthreadex(NULL, 0, ScanThread, NULL, 0, NULL);
+      if ( !hThread[nThread] )
+      {
+         err.SysMsgWrite(22001, GetLastError(), L"_beginthreadex(ScanThread)=%ld ",
+                                GetLastError());
+         break;
+      }
+   }
+   started = nThread > 0;
+}
+
+
+// Returns how many more directories of a level may be queued
+DWORD _stdcall
+   ScanAheadRoom(
+      short                  level        // in -recursion level
+   )
+{
+   ScanDir                 * scan;
+   DWORD                     n = 0;
+
+   if ( !started )
+      return 0;
+   csScan.Enter();
+   for ( scan = head;  scan;  scan = scan->next )
+      if ( scan->level == level )
+         n++;
+   csScan.Leave();
+   return n < SCAN_Window ? SCAN_Window - n : 0;
+}
+
+
+// Queues a subdirectory of the walk's current directory to be read, after
+// those of its level and deeper ones
+void _stdcall
+   ScanAheadQueue(
+      DirOptions const     * side        ,// in -&gOptions.source or &gOptions.target
+      size_t                 cchDir      ,// in -length of the directory's \\?\ path
+      WCHAR const          * name        ,// in -subdirectory name
+      short                  level        // in -recursion level of the subdirectory
+   )
+{
+   ScanDir                 * scan,
+                          ** prev;
+   size_t                    cchName = wcslen(name);
+
+   if ( cchDir + 1 + cchName + 2 >= DIM(side->apipath) + DIM(side->path) )
+      return;
+   scan = (ScanDir *)malloc(offsetof(ScanDir, apiPath) + (cchDir + cchName + 4) * sizeof (WCHAR));
+   if ( !scan )
+      return;                             // read by the walk
+   memset(scan, 0, offsetof(ScanDir, apiPath));
+   scan->side  = side;
+   scan->level = level;
+   scan->state = SCAN_Queued;
+   wcsncpy(scan->apiPath, side->apipath, cchDir);
+   scan->apiPath[cchDir] = L'\\';
+   wcscpy(scan->apiPath + cchDir + 1, name);
+
+   csScan.Enter();
+   for ( prev = &head;  *prev  &&  (*prev)->level >= level;  prev = &(*prev)->next )
+      ;
+   scan->next = *prev;
+   *prev = scan;
+   evWork.Set();
+   csScan.Leave();
+}
+
+
+// Takes the listing read ahead for a DirGet of a directory, waiting if it is
+// being read.  Returns NULL if there is none and the directory is to be read
+// as usual.
+ScanDir * _stdcall
+   ScanAheadTake(
+      DirOptions const     * side         // in -directory with its current path
+   )
+{
+   ScanDir                 * scan,
+                          ** prev;
+
+   if ( !started )
+      return NULL;
+   csScan.Enter();
+   for ( ;; )
+   {
+      for ( prev = &head;  scan = *prev;  prev = &scan->next )
+         if ( scan->side == side  &&  !wcscmp(scan->apiPath, side->apipath) )
+            break;
+      if ( !scan  ||  scan->state != SCAN_Reading )
+         break;
+      csScan.Leave();
+      WaitForSingleObject(evRead.Handle(), INFINITE);
+      csScan.Enter();
+   }
+   if ( scan )
+   {
+      *prev = scan->next;
+      if ( scan->state == SCAN_Ready )
+         nTaken++;
+      else
+      {
+         if ( scan->state == SCAN_Failed )
+            cbAhead -= scan->cbAlloc;
+         ScanDirFree(scan);
+         scan = NULL;
+         evWork.Set();
+      }
+   }
+   csScan.Leave();
+   return scan;
+}
+
+
+// Gives DirGet the next entry of a listing as Find*File would
+BOOL _stdcall
+   ScanAheadNext(
+      ScanDir              * scan        ,// i/o-listing
+      WIN32_FIND_DATA      * fd           // out-entry
+   )
+{
+   DirEntry const          * entry;
+
+   if ( scan->offNext >= scan->cbListing )
+      return FALSE;
+   entry = (DirEntry const *)(scan->listing + scan->offNext);
+   scan->offNext += CB_DirEntry(wcslen(entry->cFileName));
+   fd->dwFileAttributes = entry->attrFile;
+   fd->ftLastWriteTime  = entry->ftimeLastWrite;
+   fd->nFileSizeHigh    = (DWORD)(entry->cbFile >> 32);
+   fd->nFileSizeLow     = (DWORD)entry->cbFile;
+   wcscpy(fd->cFileName, entry->cFileName);
+   return TRUE;
+}
+
+
+// Frees a listing DirGet is done with
+void _stdcall
+   ScanAheadFree(
+      ScanDir              * scan         // in -listing from ScanAheadTake
+   )
+{
+   csScan.Enter();
+   cbAhead -= scan->cbAlloc;
+   evWork.Set();
+   csScan.Leave();
+   ScanDirFree(scan);
+}
+
+
+// Drops what is queued or read of a level and deeper, the walk having left
+// the directory above them
+void _stdcall
+   ScanAheadDrop(
+      short                  level        // in -recursion level
+   )
+{
+   ScanDir                 * scan,
+                          ** prev;
+
+   if ( !started )
+      return;
+   csScan.Enter();
+   for ( prev = &head;  (scan = *prev)  &&  scan->level >= level; )
+   {
+      *prev = scan->next;
+      if ( scan->state == SCAN_Reading )
+         scan->dropped = true;            // its reader frees it
+      else
+      {
+         if ( scan->state != SCAN_Queued )
+            cbAhead -= scan->cbAlloc;
+         ScanDirFree(scan);
+      }
+   }
+   evWork.Set();
+   csScan.Leave();
+}
+
+
+// Ends the readers
+void _stdcall
+   ScanAheadTerminate(
+   )
+{
+   if ( !started )
+      return;
+   ScanAheadDrop(0);
+   stop = true;
+   evWork.Set();
+   WaitForMultipleObjects(nThread, hThread, TRUE, INFINITE);
+   while ( nThread )
+      CloseHandle(hThread[--nThread]);
+   started = false;
+   err.MsgWrite(0, L"Scan ahead read dirs=%ld taken=%ld", nRead, nTaken);
+}
@@ -0,0 +1,292 @@
+/*
+===============================================================================
+
+  Module     - Seed
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Seeding of target subtrees that don't exist at all, such as the
+               first run of a new mirror.  The walk would make each directory
+               on its way down, one at a time between the files, each
+               CreateDirectory a round trip the walk waits on.
+
+               When the walk makes a directory whose target was missing, the
+               rest of the subtree's directories are made here before the
+               walk goes on, breadth first by SEED_Threads workers with the
+               walk thread lending a hand.  A worker enumerates a source
+               directory, makes the target of each subdirectory the walk
+               would enter and queues it in turn, so a directory is only
+               made once its parent is.  The walk then goes through the
+               subtree as before but, knowing its directories are there and
+               empty, neither makes them nor looks anything up in them,
+               streaming the files into them through the /pipe workers when
+               there are any.
+
+               Directories are made only where the walk would enter them:
+               hidden ones without /h and those past the level limit are
+               left out.  Statistics and the log are still the walk's.
+  Updates -
+
+===============================================================================
+*/
+
+#include <process.h>
+
+#include "netditto.hpp"
+
+#define SEED_Threads         8            // workers besides the walk thread
+#define SEED_PathMax         (DIM(gOptions.target.apipath) + DIM(gOptions.target.path))
+
+struct SeedDir                            // directory queued for seeding
+{
+   SeedDir                 * next;        // next queued
+   short                     level;       // recursion level, for the level limit
+   size_t                    cchSrc;      // source path length, target follows it
+   WCHAR                     apiPaths[1]; // source then target \\?\ paths
+};
+
+static SeedDir             * head,        // directories queued, taken first in first out
+                           * tail;
+static TCriticalSection      csQueue;
+static TSemaphore          * semQueued;   // directories queued
+static TEvent              * evTreeDone;  // no directory queued or being seeded
+static LONG volatile         nOutstanding;// directories queued or being seeded
+static HANDLE                hThread[SEED_Threads];
+static int                   nThread;
+static WCHAR               * work[SEED_Threads + 1]; // paths being formed, workers' then
+                                          // the walk thread's
+static bool                  started;
+
+
+// Queues a directory for any seeding thread to take
+static void
+   SeedPush(
+      SeedDir              * dir          // in -directory
+   )
+{
+   InterlockedIncrement(&nOutstanding);
+   dir->next = NULL;
+   csQueue.Enter();
+   if ( tail )
+      tail->next = dir;
+   else
+      head = dir;
+   tail = dir;
+   csQueue.Leave();
+   semQueued->Release();
+}
+
+
+// Takes a queued directory once semQueued has been waited on.  NULL, with
+// nothing queued, is a terminate request.
+static SeedDir *
+   SeedPop(
+   )
+{
+   SeedDir                 * dir;
+
+   csQueue.Enter();
+   if ( dir = head )
+      if ( !(head = dir->next) )
+         tail = NULL;
+   csQueue.Leave();
+   return dir;
+}
+
+
+// Queues a directory with its source and target paths
+static bool
+   SeedQueue(
+      WCHAR const          * srcApiPath  ,// in -source \\?\ path
+      WCHAR const          * tgtApiPath  ,// in -target \\?\ path
+      short                  level        // in -recursion level
+   )
+{
+   SeedDir                 * dir;
+   size_t                    cchSrc = wcslen(srcApiPath),
+                             cchTgt = wcslen(tgtApiPath);
+
+   dir = (SeedDir *)malloc(offsetof(SeedDir, apiPaths) + (cchSrc + cchTgt + 2) * sizeof (WCHAR));
+   if ( !dir )
+   {
+      err.MsgWrite(31801, L"Seed directory allocation failed (%s)",
+                          tgtApiPath + DIM(gOptions.target.apipath));
+      return false;
+   }
+   dir->level  = level;
+   dir->cchSrc = cchSrc;
+   wcscpy(dir->apiPaths, srcApiPath);
+   wcscpy(dir->apiPaths + cchSrc + 1, tgtApiPath);
+   SeedPush(dir);
+   return true;
+}
+
+
+// Makes the target of each subdirectory of a source directory that the walk
+// would enter and queues it to be seeded in turn
+static void
+   SeedEnum(
+      SeedDir              * dir         ,// in -directory, freed
+      WCHAR                * srcPath      // i/o-thread's paths being formed
+   )
+{
+   WIN32_FIND_DATA           fd;
+   HANDLE                    hFind;
+   WCHAR                   * tgtPath = srcPath + SEED_PathMax;
+   WCHAR const             * tgtDir = dir->apiPaths + dir->cchSrc + 1;
+   size_t                    cchTgt = wcslen(tgtDir),
+                             cchName;
+   DWORD                     rc;
+
+   wcscpy(srcPath, dir->apiPaths);
+   wcscpy(srcPath + dir->cchSrc, L"\\*");
+   wcscpy(tgtPath, tgtDir);
+   tgtPath[cchTgt] = L'\\';
+   if ( dir->level + 1 > gOptions.maxLevel )
+      hFind = INVALID_HANDLE_VALUE;
+   else                                   // an error is left to the walk's DirGet
+      hFind = FindFirstFileEx(srcPath, FindExInfoBasic, &fd, FindExSearchNameMatch,
+                              NULL, FIND_FIRST_EX_LARGE_FETCH);
+   if ( hFind != INVALID_HANDLE_VALUE )
+   {
+      do
+      {
+         if ( !(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+           || (fd.cFileName[0] == L'.'
+               && (!fd.cFileName[1]  ||  (fd.cFileName[1] == L'.'  &&  !fd.cFileName[2]))) )
+            continue;
+         // hidden source directories aren't seen at all without /h
+         if ( fd.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN
+           && !(gOptions.global & OPT_GlobalHidden) )
+            continue;
+         cchName = wcslen(fd.cFileName);
+         if ( dir->cchSrc + 1 + cchName >= SEED_PathMax  ||  cchTgt + 1 + cchName >= SEED_PathMax )
+            continue;
+         wcscpy(srcPath + dir->cchSrc + 1, fd.cFileName);
+         wcscpy(tgtPath + cchTgt + 1, fd.cFileName);
+         if ( !CreateDirectory(tgtPath, NULL)  &&  (rc = GetLastError()) != ERROR_ALREADY_EXISTS )
+         {
+            err.SysMsgWrite(30201, rc, L"CreateDirectory(%s)=%ld ",
+                                       tgtPath + DIM(gOptions.target.apipath), rc);
+            continue;
+         }
+         SeedQueue(srcPath, tgtPath, dir->level + 1);
+      } while ( FindNextFile(hFind, &fd) );
+      FindClose(hFind);
+   }
+
+   free(dir);
+   if ( InterlockedDecrement(&nOutstanding) == 0 )
+      evTreeDone->Set();
+}
+
+
+// Worker thread that seeds queued directories until it takes a NULL one
+static unsigned __stdcall
+   SeedThread(
+      void                 * arg          // i/o-paths being formed
+   )
+{
+   SeedDir                 * dir;
+
+   for ( ;; )
+   {
+      semQueued->WaitSingle();
+      if ( !(dir = SeedPop()) )
+         break;                           // terminate request
+      SeedEnum(dir, (WCHAR *)arg);
+   }
+   return 0;
+}
+
+
+// Starts the seed workers on the first subtree.  Returns false if not even
+// the walk thread's work area can be had.
+static bool
+   SeedStart(
+   )
+{
+   if ( !(work[SEED_Threads] = (WCHAR *)malloc(2 * SEED_PathMax * sizeof (WCHAR))) )
+   {
+      err.MsgWrite(21802, L"Seed buffer allocation failed, directories made by the walk");
+      return false;
+   }
+   started    = true;
+   semQueued  = new TSemaphore(0, MAXLONG);
+   evTreeDone = new TEvent(FALSE, FALSE);
+   for ( nThread = 0;  nThread < SEED_Threads;  nThread++ )
+   {
+      if ( !(work[nThread] = (WCHAR *)malloc(2 * SEED_PathMax * sizeof (WCHAR))) )
+         break;                           // fewer workers will do
+      hThread[nThread] = (HANDLE)_beginthreadex(NULL, 0, SeedThread, work[nThread], 0, NULL);
+      if ( !hThread[nThread] )
+      {
+         err.SysMsgWrite(21801, GetLastError(), L"_beginthreadex(SeedThread)=%ld ",
+                                GetLastError());
+         break;
+      }
+   }
+   return true;
+}
+
+
+// Returns whether the directories of a missing target subtree can be made
+// ahead of the walk
+BOOL _stdcall
+   SeedUse(
+   )
+{
+   return gOptions.global & OPT_GlobalSeed
+       && gOptions.global & OPT_GlobalChange
+       && gOptions.dir.contents & OPT_PropActionMake
+       && !(gOptions.fState & FLAG_Sweep); // a sweep may stop part way
+}
+
+
+// Makes all the directories below the walk's current target directory, just
+// made, breadth first.  Returns nonzero if they may not all have been tried.
+DWORD _stdcall
+   SeedTree(
+      short                  level        // in -recursion level of the directory
+   )
+{
+   HANDLE                    handles[2];
+   SeedDir                 * dir;
+
+   if ( !started  &&  !SeedStart() )
+      return ERROR_NOT_ENOUGH_MEMORY;
+   if ( !SeedQueue(gOptions.source.apipath, gOptions.target.apipath, level) )
+      return ERROR_NOT_ENOUGH_MEMORY;
+
+   // lend a hand until no directory is left queued or being seeded
+   handles[0] = evTreeDone->Handle();
+   handles[1] = semQueued->Handle();
+   while ( WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1 )
+      if ( dir = SeedPop() )
+         SeedEnum(dir, work[SEED_Threads]);
+   return 0;
+}
+
+
+// Ends the seed workers
+void _stdcall
+   SeedTerminate(
+   )
+{
+   int                       n;
+
+   if ( !started )
+      return;
+   semQueued->Release(nThread);           // nothing is queued, so these are NULLs
+   WaitForMultipleObjects(nThread, hThread, TRUE, INFINITE);
+   for ( n = 0;  n < nThread;  n++ )
+      CloseHandle(hThread[n]);
+   for ( n = 0;  n <= SEED_Threads;  n++ )
+   {
+      free(work[n]);
+      work[n] = NULL;
+   }
+   delete semQueued;
+   delete evTreeDone;
+   started = false;
+}
@@ -0,0 +1,489 @@
+/*
+===============================================================================
+
+  Module     - Spill
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Spilling of directories too big to hold.  DirGet keeps all of a
+               directory's entries in DirBlocks and indexes them in one
+               DirIndex, so a directory of tens of millions of files takes
+               gigabytes, however little of it differs.
+
+               With /spill=size, DirGet gives up on a directory whose entries
+               would take more than size, or would grow the DirBuffer past
+               /scanmem=, and it is read here instead, each side into
+               records of its own up to size.  Whenever
+               they fill, they are sorted with DirSort and written out as a
+               run to a temporary file that deletes itself when closed.  The
+               runs of each side, the last one kept in memory, are then read
+               back as one sorted stream and the source and target streams
+               merge joined, file pairs being processed as the walk would as
+               they come.  Subdirectories are added to the DirBuffer and
+               indexed for the walk to enter as usual, so only they are held.
+
+               If a temporary file or the memory can't be had, spilling is
+               turned off and the directory read whole by DirGet after all.
+  Updates -
+
+===============================================================================
+*/
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+#define SPILL_IoBuffer       (1024*1024)  // run write and read buffer size
+#define SPILL_PtrGrow        65536        // record pointers added at a time
+
+struct SpillRun                           // sorted run of a side
+{
+   __int64                   offNext;     // next to be read of the run in the file
+   __int64                   offEnd;
+   BYTE                    * buffer;      // read buffer, NULL for the run in memory
+   size_t                    pos;         // next record in the buffer
+   size_t                    len;
+   DirEntry               ** memNext;     // next record of the run in memory
+   DirEntry               ** memEnd;
+   DirEntry                * curr;        // run's current record, NULL once done
+};
+
+struct SpillSide                          // source or target being spilled
+{
+   DirOptions              * dir;
+   StatsCommon             * stats;
+   HANDLE                    hFile;       // temporary file of runs
+   __int64                   cbFile;
+   BYTE                    * records;     // records being gathered, the last run at the end
+   size_t                    cbRecords;
+   DirEntry               ** ptr;         // the records, to be sorted
+   DWORD                     nPtr;
+   DWORD                     nPtrAlloc;
+   SpillRun                * run;
+   int                       nRun;
+   int                       nRunAlloc;
+   int                       min;         // run with the lowest record, -1 if to be found
+};
+
+static SpillSide             side[2];     // source and target
+static BYTE                * ioBuffer;    // run write buffer
+
+
+// Frees what a side holds and closes, so deletes, its temporary file
+static void
+   SpillSideFree(
+      SpillSide            * s            // i/o-side
+   )
+{
+   int                       n;
+
+   for ( n = 0;  n < s->nRun;  n++ )
+      free(s->run[n].buffer);
+   free(s->run);
+   free(s->ptr);
+   free(s->records);
+   if ( s->hFile != INVALID_HANDLE_VALUE )
+      CloseHandle(s->hFile);
+   memset(s, 0, sizeof *s);
+   s->hFile = INVALID_HANDLE_VALUE;
+}
+
+
+// Adds a run to a side.  Returns false if there is no memory for it.
+static bool
+   SpillRunAdd(
+      SpillSide            * s           ,// i/o-side
+      SpillRun            ** run          // out-run added
+   )
+{
+   SpillRun                * grown;
+
+   if ( s->nRun == s->nRunAlloc )
+   {
+      if ( !(grown = (SpillRun *)realloc(s->run, (s->nRunAlloc + 16) * sizeof *grown)) )
+         return false;
+      s->run = grown;
+      s->nRunAlloc += 16;
+   }
+   *run = &s->run[s->nRun++];
+   memset(*run, 0, sizeof **run);
+   return true;
+}
+
+
+// Sorts the records gathered and writes them out as a run
+static DWORD
+   SpillRunWrite(
+      SpillSide            * s            // i/o-side
+   )
+{
+   WCHAR                     tempDir[MAX_PATH],
+                             tempName[MAX_PATH];
+   SpillRun                * run;
+   size_t                    cbBuffered = 0,
+                             cbEntry;
+   DWORD                     n,
+                             cbWritten,
+                             rc;
+
+   if ( s->hFile == INVALID_HANDLE_VALUE )
+   {
+      if ( !GetTempPath(DIM(tempDir), tempDir)  ||  !GetTempFileName(tempDir, L"ndx", 0, tempName) )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(22101, rc, L"Spill GetTempFileName=%ld ", rc);
+         return rc;
+      }
+      s->hFile = CreateFile(tempName, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE
+                          | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+      if ( s->hFile == INVALID_HANDLE_VALUE )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(22101, rc, L"Spill CreateFile(%s)=%ld ", tempName, rc);
+         DeleteFile(tempName);
+         return rc;
+      }
+   }
+   if ( !SpillRunAdd(s, &run) )
+      return ERROR_NOT_ENOUGH_MEMORY;
+   run->offNext = s->cbFile;
+
+   DirSort(s->ptr, s->nPtr);
+   for ( n = 0;  n <= s->nPtr;  n++ )
+   {
+      cbEntry = n < s->nPtr ? CB_DirEntry(wcslen(s->ptr[n]->cFileName)) : 0;
+      if ( cbBuffered + cbEntry > SPILL_IoBuffer  ||  (n == s->nPtr  &&  cbBuffered) )
+      {
+         if ( !WriteFile(s->hFile, ioBuffer, (DWORD)cbBuffered, &cbWritten, NULL)
+           || cbWritten != cbBuffered )
+         {
+            rc = GetLastError();
+            err.SysMsgWrite(22103, rc, L"Spill WriteFile=%ld ", rc);
+            return rc ? rc : ERROR_DISK_FULL;
+         }
+         s->cbFile += cbBuffered;
+         cbBuffered = 0;
+      }
+      if ( n < s->nPtr )
+      {
+         memcpy(ioBuffer + cbBuffered, s->ptr[n], cbEntry);
+         cbBuffered += cbEntry;
+      }
+   }
+   run->offEnd = s->cbFile;
+   s->cbRecords = 0;
+   s->nPtr = 0;
+   return 0;
+}
+
+
+// Reads a side's directory into sorted runs, counting its entries as DirGet
+// does
+static DWORD
+   SpillSideRead(
+      SpillSide            * s            // i/o-side, dir and stats set
+   )
+{
+   WIN32_FIND_DATA           fd;
+   HANDLE                    hFind;
+   WCHAR                   * appendPath = s->dir->path + wcslen(s->dir->path);
+   DirEntry                * entry;
+   DirEntry               ** grown;
+   SpillRun                * run;
+   size_t                    cbEntry;
+   DWORD                     rc = 0;
+
+   if ( !(s->records = (BYTE *)malloc((size_t)gOptions.cbSpillMin)) )
+      return ERROR_NOT_ENOUGH_MEMORY;
+   s->stats->dirFiltered++;
+   s->stats->dirFound++;
+
+   wcscpy(appendPath, L"\\*");
+   hFind = FindFirstFileEx(s->dir->apipath, FindExInfoBasic, &fd, FindExSearchNameMatch,
+                           NULL, FIND_FIRST_EX_LARGE_FETCH);
+   *appendPath = L'\0';
+   if ( hFind == INVALID_HANDLE_VALUE )
+      return GetLastError();
+   do
+   {
+      if ( fd.cFileName[0] == L'.'
+        && (!fd.cFileName[1]  ||  (fd.cFileName[1] == L'.'  &&  !fd.cFileName[2])) )
+         continue;
+      if ( !(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) )
+      {
+         s->stats->fileFound.count++;
+         s->stats->fileFound.bytes += INT64R(fd.nFileSizeLow, fd.nFileSizeHigh);
+         if ( FilterReject(fd.cFileName, gOptions.include, gOptions.exclude) )
+            continue;
+         s->stats->fileFiltered.count++;
+         s->stats->fileFiltered.bytes += INT64R(fd.nFileSizeLow, fd.nFileSizeHigh);
+      }
+
+      // records and their pointers, DirSort's doubled, are held to /spill=
+      cbEntry = CB_DirEntry(wcslen(fd.cFileName));
+      if ( s->cbRecords + cbEntry + (s->nPtr + 1) * 2 * sizeof (DirEntry *) > gOptions.cbSpillMin
+        && s->nPtr )
+         if ( rc = SpillRunWrite(s) )
+            break;
+      if ( s->nPtr == s->nPtrAlloc )
+      {
+         if ( !(grown = (DirEntry **)realloc(s->ptr, (s->nPtrAlloc + SPILL_PtrGrow) * sizeof *grown)) )
+         {
+            rc = ERROR_NOT_ENOUGH_MEMORY;
+            break;
+         }
+         s->ptr = grown;
+         s->nPtrAlloc += SPILL_PtrGrow;
+      }
+      entry = (DirEntry *)(s->records + s->cbRecords);
+      entry->ftimeLastWrite = fd.ftLastWriteTime;
+      entry->cbFile         = INT64R(fd.nFileSizeLow, fd.nFileSizeHigh);
+      entry->attrFile       = fd.dwFileAttributes;
+      wcscpy(entry->cFileName, fd.cFileName);
+      s->ptr[s->nPtr++] = entry;
+      s->cbRecords += cbEntry;
+   } while ( FindNextFile(hFind, &fd) );
+   if ( !rc  &&  (rc = GetLastError()) == ERROR_NO_MORE_FILES )
+      rc = 0;
+   FindClose(hFind);
+   if ( rc )
+      return rc;
+
+   // the last run is kept in memory and the file runs given read buffers
+   DirSort(s->ptr, s->nPtr);
+   if ( !SpillRunAdd(s, &run) )
+      return ERROR_NOT_ENOUGH_MEMORY;
+   run->memNext = s->ptr;
+   run->memEnd  = s->ptr + s->nPtr;
+   for ( run = s->run;  run < s->run + s->nRun - 1;  run++ )
+      if ( !(run->buffer = (BYTE *)malloc(SPILL_IoBuffer)) )
+         return ERROR_NOT_ENOUGH_MEMORY;
+   s->min = -1;
+   return 0;
+}
+
+
+// Moves a run on to its next record.  Returns nonzero on a read error.
+static DWORD
+   SpillRunNext(
+      SpillSide            * s           ,// in -side
+      SpillRun             * run          // i/o-run
+   )
+{
+   OVERLAPPED                ov;
+   DWORD                     cbRead,
+                             cbWant,
+                             rc;
+
+   if ( !run->buffer )
+   {
+      run->curr = run->memNext < run->memEnd ? *run->memNext++ : NULL;
+      return 0;
+   }
+
+   // a whole record is always in the buffer, however long its name
+   if ( run->len - run->pos < CB_DirEntry(MAX_PATH)  &&  run->offNext < run->offEnd )
+   {
+      memmove(run->buffer, run->buffer + run->pos, run->len - run->pos);
+      run->len -= run->pos;
+      run->pos  = 0;
+      cbWant = (DWORD)min((__int64)(SPILL_IoBuffer - run->len), run->offEnd - run->offNext);
+      memset(&ov, 0, sizeof ov);
+      ov.Offset     = (DWORD)run->offNext;
+      ov.OffsetHigh = (DWORD)(run->offNext >> 32);
+      if ( !ReadFile(s->hFile, run->buffer + run->len, cbWant, &cbRead, &ov)  ||  cbRead != cbWant )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(32102, rc, L"Spill ReadFile=%ld ", rc);
+         run->curr = NULL;
+         return rc ? rc : ERROR_HANDLE_EOF;
+      }
+      run->len     += cbRead;
+      run->offNext += cbRead;
+   }
+   if ( run->pos >= run->len )
+   {
+      run->curr = NULL;
+      return 0;
+   }
+   run->curr = (DirEntry *)(run->buffer + run->pos);
+   run->pos += CB_DirEntry(wcslen(run->curr->cFileName));
+   return 0;
+}
+
+
+// Returns a side's lowest record not yet taken, NULL once all are
+static DirEntry *
+   SpillPeek(
+      SpillSide            * s            // i/o-side
+   )
+{
+   int                       n;
+
+   if ( s->min < 0 )
+      for ( n = 0;  n < s->nRun;  n++ )
+         if ( s->run[n].curr
+           && (s->min < 0  ||  _wcsicmp(s->run[n].curr->cFileName,
+                                        s->run[s->min].curr->cFileName) < 0) )
+            s->min = n;
+   return s->min < 0 ? NULL : s->run[s->min].curr;
+}
+
+
+// Takes a side's lowest record
+static DWORD
+   SpillSkip(
+      SpillSide            * s            // i/o-side
+   )
+{
+   DWORD                     rc = SpillRunNext(s, &s->run[s->min]);
+
+   s->min = -1;
+   return rc;
+}
+
+
+// Reads the source and target, those that are directories, of the walk's
+// current directory into sorted runs.  Returns nonzero if it can't, with
+// spilling turned off so DirGet reads it whole.
+DWORD _stdcall
+   SpillRead(
+      BOOL                   src         ,// in -source is to be read
+      BOOL                   tgt          // in -target is to be read
+   )
+{
+   DWORD                     rc = 0;
+   int                       n,
+                             r;
+   StatsCommon               orgStats[2] = {gOptions.stats.source, gOptions.stats.target};
+
+   side[0].hFile = side[1].hFile = INVALID_HANDLE_VALUE;
+   side[0].dir   = &gOptions.source;
+   side[0].stats = &gOptions.stats.source;
+   side[1].dir   = &gOptions.target;
+   side[1].stats = &gOptions.stats.target;
+   if ( !ioBuffer  &&  !(ioBuffer = (BYTE *)malloc(SPILL_IoBuffer)) )
+      rc = ERROR_NOT_ENOUGH_MEMORY;
+   for ( n = 0;  n < 2  &&  !rc;  n++ )
+      if ( n ? tgt : src )
+      {
+         rc = SpillSideRead(&side[n]);
+         for ( r = 0;  r < side[n].nRun  &&  !rc;  r++ )
+            rc = SpillRunNext(&side[n], &side[n].run[r]);
+      }
+   if ( rc )
+   {
+      err.SysMsgWrite(22102, rc, L"Spill of %s failed, directories held in memory from now on, rc=%ld ",
+                                 gOptions.target.path, rc);
+      gOptions.cbSpillMin = 0;
+      gOptions.stats.source = orgStats[0]; // counted again by DirGet
+      gOptions.stats.target = orgStats[1];
+      SpillSideFree(&side[0]);
+      SpillSideFree(&side[1]);
+   }
+   return rc;
+}
+
+
+// Merge joins the source and target runs SpillRead made, processing the
+// file pairs as the walk would and adding subdirectories to the DirBuffers,
+// whose indexes it returns for the walk to enter them
+void _stdcall
+   SpillJoin(
+      DirEntry           *** srcIndex    ,// out-source subdirectories, NULL if not read
+      DirEntry           *** tgtIndex    ,// out-target subdirectories, NULL if not read
+      LONG volatile        * pending      // i/o-directory's pending actions
+   )
+{
+   WCHAR                   * srcAppend = gOptions.source.path + wcslen(gOptions.source.path),
+                           * tgtAppend = gOptions.target.path + wcslen(gOptions.target.path);
+   DirBlock                * srcBlock  = gOptions.source.dirBuffer.currBlock,
+                           * tgtBlock  = gOptions.target.dirBuffer.currBlock;
+   DirEntry                * srcHwm    = srcBlock->hwmEntry,
+                           * tgtHwm    = tgtBlock->hwmEntry,
+                           * srcEntry,
+                           * tgtEntry,
+                           * s,
+                           * t;
+   DWORD                     nSrcDir = 0,
+                             nTgtDir = 0,
+                             rc = 0;
+   size_t                    cbEntry;
+   int                       comp,
+                             nRun = side[0].nRun + side[1].nRun;
+   BOOL                      srcRead = side[0].records != NULL,
+                             tgtRead = side[1].records != NULL;
+   DWORD                     tStart = GetTickCount();
+
+   *srcAppend = *tgtAppend = L'\\';
+   while ( !rc )
+   {
+      srcEntry = SpillPeek(&side[0]);
+      tgtEntry = SpillPeek(&side[1]);
+      if ( srcEntry  &&  tgtEntry )
+      {
+         if ( (comp = _wcsicmp(srcEntry->cFileName, tgtEntry->cFileName)) < 0 )
+            tgtEntry = NULL;
+         else if ( comp > 0 )
+            srcEntry = NULL;
+      }
+      if ( !srcEntry  &&  !tgtEntry )
+         break;
+
+      if ( (srcEntry  &&  srcEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY)
+        || (tgtEntry  &&  tgtEntry->attrFile & FILE_ATTRIBUTE_DIRECTORY) )
+      {
+         // left for the walk to enter, or match as mismatched, as usual
+         if ( srcEntry )
+         {
+            cbEntry = CB_DirEntry(wcslen(srcEntry->cFileName));
+            memcpy(DirBufferAdd(&gOptions.source, cbEntry), srcEntry, cbEntry);
+            nSrcDir++;
+         }
+         if ( tgtEntry )
+         {
+            cbEntry = CB_DirEntry(wcslen(tgtEntry->cFileName));
+            memcpy(DirBufferAdd(&gOptions.target, cbEntry), tgtEntry, cbEntry);
+            nTgtDir++;
+         }
+      }
+      else
+      {
+         if ( tgtEntry )
+         {
+            if ( !srcEntry )
+               wcscpy(srcAppend+1, tgtEntry->cFileName);
+            wcscpy(tgtAppend+1, tgtEntry->cFileName);
+         }
+         if ( srcEntry )
+         {
+            wcscpy(srcAppend+1, srcEntry->cFileName);
+            if ( !tgtEntry )
+               wcscpy(tgtAppend+1, srcEntry->cFileName);
+         }
+
+         // as the walk's loop decides it
+         s = srcEntry;
+         t = tgtEntry;
+         if ( !(gOptions.global & OPT_GlobalHidden) )
+            HiddenSemanticsSet(&s, &t);
+         if ( !s  &&  t  &&  gOptions.global & OPT_GlobalResume  &&  ResumeFileIs(t->cFileName) )
+            t = NULL;
+         if ( s  ||  t )
+            MatchedFileProcess(s, t, pending);
+      }
+
+      if ( srcEntry )
+         rc = SpillSkip(&side[0]);
+      if ( tgtEntry  &&  !rc )
+         rc = SpillSkip(&side[1]);
+   }
+   *srcAppend = *tgtAppend = L'\0';
+
+   *srcIndex = srcRead ? DirIndexBuild(&gOptions.source, srcBlock, srcHwm, nSrcDir) : NULL;
+   *tgtIndex = tgtRead ? DirIndexBuild(&gOptions.target, tgtBlock, tgtHwm, nTgtDir) : NULL;
+   SpillSideFree(&side[0]);
+   SpillSideFree(&side[1]);
+   err.MsgWrite(0, L"Spilled %s runs=%d in %ldms", gOptions.target.path, nRun,
+                   GetTickCount() - tStart);
+}
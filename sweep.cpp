@@ -0,0 +1,281 @@
+/*
+===============================================================================
+
+  Module     - Sweep
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Incremental sweeps of trees too large to finish in one window.
+               With /maxtime= or /maxbytes= the walk stops cleanly once the
+               time or the bytes written reach the budget, letting the file
+               actions in flight finish and each directory level exit as
+               usual.  With /cursor= the position it stopped at, the path of
+               the next entry relative to the source root, is saved.
+
+               The next run skips everything before the cursor without
+               copying or comparing it, entering only the cursor's parent
+               directories, and carries on from there.  On reaching the end
+               of the tree it wraps around to the top and goes on until the
+               budget runs out again or it is back at the cursor, so over
+               several runs the whole tree is covered.  Positions are
+               compared a path component at a time with _wcsicmp's case
+               folding, which is the walk's own sorted order.
+
+               The cursor file also keeps the part of the tree each of the
+               last SWEEP_History runs covered and when, which is logged at
+               the end with how long ago it was.
+  Updates -
+
+===============================================================================
+*/
+
+#include <time.h>
+
+#include "netditto.hpp"
+
+#define SWEEP_History        16           // runs remembered in the cursor file
+#define SWEEP_Ancestor       2            // SweepCompare: first is a parent directory
+
+struct SweepRun                           // part of the tree a run covered
+{
+   time_t                    tEnd;        // when the run ended
+   WCHAR                   * from;        // first position, "" for the top
+   WCHAR                   * to;          // next position, "" for the top
+   bool                      wrapped;     // went past the end of the tree
+};
+
+static WCHAR               * cursor;      // position this run starts from, "" for the top
+static WCHAR               * stopAt;      // position this run stopped at, NULL if none
+static size_t                cchRoot;     // source root path length
+static SweepRun              runs[SWEEP_History]; // earlier runs, oldest first
+static int                   nRun;
+static bool                  seeking,     // skipping to the cursor
+                             wrapping;    // second pass from the top up to the cursor
+static DWORD                 tStart;      // tick count at the start
+static long                  nEntry;      // entries processed this run
+
+
+// Compares two positions in walk order, a path component at a time.
+// Returns SWEEP_Ancestor if p1 is a parent directory of p2.
+static int
+   SweepCompare(
+      WCHAR const          * p1          ,// in -position relative to the root
+      WCHAR const          * p2           // in -position relative to the root
+   )
+{
+   WCHAR                     c1,
+                             c2;
+
+   for ( ;  ;  p1++, p2++ )
+   {
+      c1 = towlower(*p1);
+      c2 = towlower(*p2);
+      if ( c1 != c2 )
+         break;
+      if ( !c1 )
+         return 0;
+   }
+   if ( !c1  &&  c2 == L'\\' )
+      return SWEEP_Ancestor;
+   // a component's end sorts before any name character
+   if ( !c1  ||  c1 == L'\\' )
+      return -1;
+   if ( !c2  ||  c2 == L'\\' )
+      return 1;
+   return c1 < c2 ? -1 : 1;
+}
+
+
+// Returns a copy of the next tab or line delimited field of the cursor file,
+// advancing past it
+static WCHAR *
+   SweepField(
+      WCHAR               ** text         // i/o-cursor file text
+   )
+{
+   WCHAR                   * field = *text;
+   size_t                    cch = wcscspn(field, L"\t\n");
+
+   *text = field + cch + (field[cch] ? 1 : 0);
+   field[cch] = L'\0';
+   return _wcsdup(field);
+}
+
+
+// Reads the cursor and run history from the cursor file, if any
+static void
+   SweepLoad(
+   )
+{
+   FILE                    * file;
+   WCHAR                     line[32800],
+                           * text;
+   SweepRun                * run;
+
+   if ( !(file = _wfopen(gOptions.cursor, L"r, ccs=UTF-8")) )
+      return;
+   if ( fgetws(line, DIM(line), file) )
+   {
+      text = line;
+      free(cursor);
+      cursor = SweepField(&text);
+   }
+   while ( fgetws(line, DIM(line), file)  &&  nRun < SWEEP_History )
+   {
+      run = &runs[nRun++];
+      run->tEnd    = (time_t)_wcstoi64(line, &text, 10);
+      run->wrapped = *++text == L'w';
+      text += 2;
+      run->from    = SweepField(&text);
+      run->to      = SweepField(&text);
+   }
+   fclose(file);
+}
+
+
+// Loads the cursor if one is kept and starts the budget
+void _stdcall
+   SweepStart(
+   )
+{
+   if ( !gOptions.cursor  &&  !gOptions.sweepMinutes  &&  !gOptions.sweepBytes )
+      return;
+
+   cchRoot = wcslen(gOptions.source.path);
+   cursor = _wcsdup(L"");
+   if ( gOptions.cursor )
+      SweepLoad();
+   seeking = *cursor != L'\0';
+   if ( seeking )
+      err.MsgWrite(0, L"Sweep continues from %s", cursor);
+   tStart = GetTickCount();
+   gOptions.fState |= FLAG_Sweep;
+}
+
+
+// Decides what the walk does with an entry whose path has just been formed:
+// skip it while seeking the cursor, process it, or stop here
+int _stdcall                              // ret-SWEEP_Skip, SWEEP_Process or SWEEP_Stop
+   SweepEntry(
+      WCHAR const          * srcPath      // in -source entry path
+   )
+{
+   WCHAR const             * pos = srcPath + cchRoot;
+   int                       cmp;
+
+   if ( stopAt )
+      return SWEEP_Stop;
+   cmp = *cursor ? SweepCompare(pos, cursor) : 1;
+   if ( cmp == SWEEP_Ancestor )
+      return SWEEP_Process;               // on the way to or from the cursor
+   if ( seeking )
+   {
+      if ( cmp < 0 )
+         return SWEEP_Skip;
+      seeking = false;
+   }
+   else if ( wrapping  &&  cmp >= 0 )
+   {
+      stopAt = _wcsdup(cursor);           // all the way around
+      return SWEEP_Stop;
+   }
+
+   if ( (gOptions.sweepMinutes
+         && GetTickCount() - tStart >= (DWORD)gOptions.sweepMinutes * 60000)
+     || (gOptions.sweepBytes  &&  gOptions.bWritten >= gOptions.sweepBytes) )
+   {
+      stopAt = _wcsdup(pos);
+      err.MsgWrite(0, L"Sweep budget reached at %s", pos);
+      return SWEEP_Stop;
+   }
+   nEntry++;
+   return SWEEP_Process;
+}
+
+
+// Returns whether the walk should go round again from the top, having
+// reached the end of the tree after starting part way
+BOOL _stdcall
+   SweepWrap(
+   )
+{
+   if ( !(gOptions.fState & FLAG_Sweep)  ||  stopAt  ||  !*cursor  ||  wrapping )
+      return FALSE;
+   wrapping = true;
+   seeking  = false;
+   return TRUE;
+}
+
+
+// Formats how long ago a time was
+static WCHAR *
+   SweepAge(
+      time_t                 t           ,// in -time
+      time_t                 now         ,// in -current time
+      WCHAR                * str          // out-age, at least 32 chars
+   )
+{
+   __int64                   secs = max(now - t, 0);
+
+   if ( secs >= 86400 )
+      _snwprintf(str, 32, L"%I64dd%02I64dh", secs / 86400, secs % 86400 / 3600);
+   else
+      _snwprintf(str, 32, L"%I64dh%02I64dm", secs / 3600, secs % 3600 / 60);
+   return str;
+}
+
+
+// Saves the cursor and this run with the earlier ones, and logs what each
+// of them covered and how long ago
+void _stdcall
+   SweepTerminate(
+   )
+{
+   FILE                    * file;
+   SweepRun                * run;
+   time_t                    now;
+   WCHAR                     age[32];
+   int                       n;
+
+   if ( !(gOptions.fState & FLAG_Sweep) )
+      return;
+   gOptions.fState &= ~FLAG_Sweep;
+
+   time(&now);
+   if ( nRun == SWEEP_History )
+   {
+      free(runs[0].from);
+      free(runs[0].to);
+      memmove(runs, runs + 1, --nRun * sizeof *runs);
+   }
+   run = &runs[nRun++];
+   run->tEnd    = now;
+   run->wrapped = wrapping;
+   run->from    = _wcsdup(cursor);
+   run->to      = _wcsdup(stopAt ? stopAt : L"");
+
+   err.MsgWrite(0, L"Sweep covered %s to %s%s, %ld entries in %lds",
+                   *run->from ? run->from : L"(top)", *run->to ? run->to : L"(end)",
+                   run->wrapped ? L" wrapping around" : L"", nEntry,
+                   (GetTickCount() - tStart) / 1000);
+   for ( n = nRun - 1;  n >= 0;  n-- )
+      err.MsgWrite(0, L"Sweep part %s to %s%s synced %s ago",
+                      *runs[n].from ? runs[n].from : L"(top)",
+                      *runs[n].to ? runs[n].to : L"(end)",
+                      runs[n].wrapped ? L" wrapping around" : L"",
+                      SweepAge(runs[n].tEnd, now, age));
+
+   if ( !gOptions.cursor )
+      return;
+   if ( !(file = _wfopen(gOptions.cursor, L"w, ccs=UTF-8")) )
+   {
+      err.SysMsgWrite(21301, GetLastError(), L"Cursor write(%s)=%ld ",
+                             gOptions.cursor, GetLastError());
+      return;
+   }
+   fwprintf(file, L"%s\n", run->to);
+   for ( n = 0;  n < nRun;  n++ )
+      fwprintf(file, L"%I64d %c %s\t%s\n", (__int64)runs[n].tEnd,
+                     runs[n].wrapped ? L'w' : L'-', runs[n].from, runs[n].to);
+   fclose(file);
+}
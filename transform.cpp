@@ -0,0 +1,256 @@
+/*
+===============================================================================
+
+  Module     - Transform
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Transforms applied to file data between its read and its
+               write: the /xor complement and the /crc CRC-32C checksum of
+               each file copied.  XformApply runs all that are on over a
+               block; the XOR is done 16 bytes at a time with SSE2 and the
+               CRC with the SSE4.2 crc32 instruction where the processor has
+               it.
+
+               So a transform doesn't hold up the I/O, the sequential copy
+               hands each block to a transform worker thread and reads the
+               next one into the other half of its buffer meanwhile (see
+               FileCopyContents).  Small files are transformed inline since
+               their single block has nothing to overlap with.
+
+               The XOR doesn't depend on a block's position and is applied
+               by the overlapped and striped engines as blocks complete.
+               The CRC does, so with /crc files go to the sequential one.
+  Updates -
+  26/10/19 TPB CRC also computed for /verify.
+
+===============================================================================
+*/
+
+#include <process.h>
+#include <intrin.h>
+#include <emmintrin.h>
+#include <nmmintrin.h>
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+#define XFORM_MaxWorkers     8            // most transform worker threads
+
+static XformJob            * head,        // queued blocks
+                           * tail;
+static int                   nWorker;
+static HANDLE                hThread[XFORM_MaxWorkers];
+static TSemaphore          * semQueued;   // blocks queued, NULL per worker to end
+static TCriticalSection      csXform;     // serializes the queue
+static DWORD                 crcTable[256];// CRC-32C byte table
+static bool                  crcHw;       // SSE4.2 crc32 instruction available
+
+
+// One's complements a block
+static void
+   XformXor(
+      BYTE                 * buffer      ,// i/o-block
+      DWORD                  cb           // in -block size
+   )
+{
+   __m128i                   ones = _mm_set1_epi32(-1);
+   BYTE                    * p = buffer,
+                           * end = buffer + cb;
+
+   for ( ;  p < end  &&  (ULONG_PTR)p & 15;  p++ )
+      *p = ~*p;
+   for ( ;  p + 64 <= end;  p += 64 )
+   {
+      _mm_store_si128((__m128i *)p     , _mm_xor_si128(_mm_load_si128((__m128i *)p     ), ones));
+      _mm_store_si128((__m128i *)p + 1 , _mm_xor_si128(_mm_load_si128((__m128i *)p + 1 ), ones));
+      _mm_store_si128((__m128i *)p + 2 , _mm_xor_si128(_mm_load_si128((__m128i *)p + 2 ), ones));
+      _mm_store_si128((__m128i *)p + 3 , _mm_xor_si128(_mm_load_si128((__m128i *)p + 3 ), ones));
+   }
+   for ( ;  p + 16 <= end;  p += 16 )
+      _mm_store_si128((__m128i *)p, _mm_xor_si128(_mm_load_si128((__m128i *)p), ones));
+   for ( ;  p < end;  p++ )
+      *p = ~*p;
+}
+
+
+// Continues a CRC-32C (Castagnoli) over a block
+DWORD _stdcall
+   XformCrc(
+      DWORD                  crc         ,// in -CRC so far, inverted
+      BYTE const           * p           ,// in -block
+      DWORD                  cb           // in -block size
+   )
+{
+   BYTE const              * end = p + cb;
+
+   if ( crcHw )
+   {
+      for ( ;  p < end  &&  (ULONG_PTR)p & 7;  p++ )
+         crc = _mm_crc32_u8(crc, *p);
+#ifdef _M_X64
+      for ( ;  p + 8 <= end;  p += 8 )
+         crc = (DWORD)_mm_crc32_u64(crc, *(unsigned __int64 const *)p);
+#else
+      for ( ;  p + 4 <= end;  p += 4 )
+         crc = _mm_crc32_u32(crc, *(unsigned int const *)p);
+#endif
+      for ( ;  p < end;  p++ )
+         crc = _mm_crc32_u8(crc, *p);
+   }
+   else
+      for ( ;  p < end;  p++ )
+         crc = crcTable[(crc ^ *p) & 0xff] ^ (crc >> 8);
+   return crc;
+}
+
+
+// Applies the transforms that are on to a block, in file order for the CRC
+void _stdcall
+   XformApply(
+      BYTE                 * buffer      ,// i/o-block
+      DWORD                  cb          ,// in -block size
+      XformState           * state        // i/o-file's transform state, NULL for XOR only
+   )
+{
+   // the CRC is of the source data, before it's changed
+   if ( state  &&  gOptions.global & OPT_GlobalDigest )
+   {
+      state->crc = XformCrc(state->crc, buffer, cb);
+      state->cbFile += cb;
+   }
+   if ( gOptions.global & OPT_GlobalCopyXOR )
+      XformXor(buffer, cb);
+}
+
+
+// Worker thread that transforms queued blocks until it takes a NULL one
+static unsigned __stdcall
+   XformThread(
+      void                 * arg          // in -not used
+   )
+{
+   XformJob                * job;
+
+   for ( ;; )
+   {
+      semQueued->WaitSingle();
+      csXform.Enter();
+      if ( job = head )
+         if ( !(head = job->next) )
+            tail = NULL;
+      csXform.Leave();
+      if ( !job )
+         break;                           // terminate request
+
+      XformApply(job->buffer, job->cb, job->state);
+      SetEvent(job->evDone);
+   }
+   return 0;
+}
+
+
+// Builds the CRC table and, if any transform is on, starts the workers
+void _stdcall
+   XformStart(
+   )
+{
+   SYSTEM_INFO               sysInfo;
+   int                       cpuInfo[4];
+   DWORD                     crc;
+   int                       n,
+                             bit;
+
+   for ( n = 0;  n < 256;  n++ )
+   {
+      for ( crc = n, bit = 0;  bit < 8;  bit++ )
+         crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+      crcTable[n] = crc;
+   }
+   __cpuid(cpuInfo, 1);
+   crcHw = (cpuInfo[2] & (1 << 20)) != 0;  // SSE4.2
+
+   if ( !(gOptions.global & (OPT_GlobalCopyXOR | OPT_GlobalDigest))
+     || !(gOptions.global & OPT_GlobalChange) )
+      return;
+
+   GetSystemInfo(&sysInfo);
+   nWorker = min((int)sysInfo.dwNumberOfProcessors, XFORM_MaxWorkers);
+   semQueued = new TSemaphore(0, MAXLONG);
+   for ( n = 0;  n < nWorker;  n++ )
+   {
+      hThread[n] = (HANDLE)_beginthreadex(NULL, 0, XformThread, NULL, 0, NULL);
+      if ( !hThread[n] )
+         err.SysMsgWrite(50721, GetLastError(), L"_beginthreadex(XformThread)=%ld ",
+                                GetLastError());
+   }
+   gOptions.fState |= FLAG_Xform;
+}
+
+
+// Stops the transform workers
+void _stdcall
+   XformTerminate(
+   )
+{
+   int                       n;
+
+   if ( !(gOptions.fState & FLAG_Xform) )
+      return;
+
+   gOptions.fState &= ~FLAG_Xform;
+   semQueued->Release(nWorker);           // queue is empty, so each takes NULL
+   WaitForMultipleObjects(nWorker, hThread, TRUE, INFINITE);
+   for ( n = 0;  n < nWorker;  n++ )
+      CloseHandle(hThread[n]);
+   delete semQueued;
+}
+
+
+// Queues a block for a transform worker.  job->evDone is set when done.
+void _stdcall
+   XformSubmit(
+      XformJob             * job         ,// out-job, kept until evDone is set
+      BYTE                 * buffer      ,// i/o-block
+      DWORD                  cb          ,// in -block size
+      XformState           * state       ,// i/o-file's transform state
+      HANDLE                 evDone       // in -auto-reset event to set when done
+   )
+{
+   job->next   = NULL;
+   job->buffer = buffer;
+   job->cb     = cb;
+   job->state  = state;
+   job->evDone = evDone;
+   csXform.Enter();
+   if ( tail )
+      tail->next = job;
+   else
+      head = job;
+   tail = job;
+   csXform.Leave();
+   semQueued->Release();
+}
+
+
+// Starts a file's transform state
+void _stdcall
+   XformInit(
+      XformState           * state        // out-file's transform state
+   )
+{
+   state->crc    = 0xFFFFFFFF;
+   state->cbFile = 0;
+}
+
+
+// Logs a copied file's checksum with /crc
+void _stdcall
+   XformReport(
+      FileAction const     * action      ,// in -file action
+      XformState const     * state        // in -file's transform state
+   )
+{
+   if ( gOptions.global & OPT_GlobalCrc )
+      err.MsgWrite(0, L"Crc=%08lX %s", ~state->crc, action->tgtPath);
+}
@@ -0,0 +1,360 @@
+/*
+===============================================================================
+
+  Module     - Trash
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- The /trash removal mode.  A target subtree with no source is
+               renamed into a hidden trash directory at the top of the target
+               in one operation rather than emptied and removed while the
+               walk waits, so the target matches the source as soon as the
+               walk has passed it however large the subtree.
+
+               A reaper thread deletes what is in the trash in the background
+               at background CPU and I/O priority.  Once the walk is done it
+               is waited for, for at most /reaptime= minutes, and whatever it
+               hasn't got to is left in the trash for the next /trash run to
+               reap.  The files and directories it removes are counted in the
+               removal statistics, except the tops of the subtrees moved,
+               which are counted and logged as removed when moved.
+
+               The trash is only used when the walk itself would remove all
+               of the subtree: no filters or level limit, /r and /h on, no
+               /resume and no /backup.  If the rename fails, as it will when the
+               subtree is on another volume mounted into the target, the
+               subtree is removed as usual.
+  Updates -
+
+===============================================================================
+*/
+
+#include <process.h>
+
+#include "netditto.hpp"
+
+#define TRASH_Name           L"$NetDittoTrash" // trash directory in the target root
+
+struct ReapFrame                          // directory of the trash being reaped
+{
+   HANDLE                    hFind;
+   size_t                    cch;         // length of its path in reapPath
+   DWORD                     attr;        // its attributes, to remove it once empty
+};
+
+static WCHAR                 trashPath[DIM(gOptions.target.apipath)
+                                     + DIM(gOptions.target.path)]; // \\?\ trash path
+static size_t                cchTrash;
+static WCHAR                 reapPath[DIM(trashPath)]; // reaper's entry path being formed
+static ReapFrame           * reapFrame;   // one per level, each adds 2 characters at least
+static TEvent                evQueued(FALSE, FALSE); // a subtree was moved into the trash
+static TEvent                evWalkDone;  // no more will be
+static HANDLE                hReaper;
+static bool                  created;     // trash directory made or found this run
+static bool volatile         reapStop;    // out of /reaptime=, leave the rest
+static long                  nMoved;      // subtrees moved into the trash
+static StatCount             nDirReaped;  // counted by the reaper alone
+static StatBoth              fileReaped;
+static DWORD                 tStart;
+
+
+// Removes an entry of the trash whose subdirectories are already gone
+static void
+   TrashRemove(
+      WCHAR const          * path        ,// in -\\?\ path
+      DWORD                  attr        ,// in -attributes
+      __int64                bytes       ,// in -file size
+      bool                   moved        // in -subtree moved in, counted when moved
+   )
+{
+   DWORD                     rc;
+
+   if ( attr & FILE_ATTRIBUTE_READONLY
+     && !SetFileAttributes(path, FILE_ATTRIBUTE_NORMAL) )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(31702, rc, L"Trash SetFileAttributes(%s)=%ld ",
+                             path + DIM(gOptions.target.apipath), rc);
+      return;
+   }
+   if ( attr & FILE_ATTRIBUTE_DIRECTORY )
+   {
+      if ( !RemoveDirectory(path) )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(31702, rc, L"Trash RemoveDirectory(%s)=%ld ",
+                             path + DIM(gOptions.target.apipath), rc);
+         return;
+      }
+      if ( !moved )
+         nDirReaped++;
+   }
+   else
+   {
+      if ( !DeleteFile(path) )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(31702, rc, L"Trash DeleteFile(%s)=%ld ",
+                             path + DIM(gOptions.target.apipath), rc);
+         return;
+      }
+      fileReaped.count++;
+      fileReaped.bytes += bytes;
+   }
+}
+
+
+// Starts listing a directory of the trash.  Returns INVALID_HANDLE_VALUE if
+// it can't.
+static HANDLE
+   TrashFindFirst(
+      size_t                 cch         ,// in -length of the directory's path in reapPath
+      WIN32_FIND_DATA      * fd           // out-first entry
+   )
+{
+   HANDLE                    hFind;
+   DWORD                     rc;
+
+   wcscpy(reapPath + cch, L"\\*");
+   hFind = FindFirstFileEx(reapPath, FindExInfoBasic, fd, FindExSearchNameMatch,
+                           NULL, FIND_FIRST_EX_LARGE_FETCH);
+   reapPath[cch] = L'\0';
+   if ( hFind == INVALID_HANDLE_VALUE )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(31701, rc, L"Trash FindFirstFile(%s)=%ld ",
+                             reapPath + DIM(gOptions.target.apipath), rc);
+   }
+   return hFind;
+}
+
+
+// Removes everything in the trash, depth first.  Directory symbolic links
+// and junctions are removed without going into them.  The directories being
+// listed are kept in reapFrame rather than recursed into, so the depth of the
+// tree costs no thread stack.
+static void
+   TrashReapAll(
+   )
+{
+   WIN32_FIND_DATA           fd;
+   ReapFrame               * f = reapFrame;
+   int                       depth = 0;
+   size_t                    cchName;
+
+   f->cch = cchTrash;
+   if ( (f->hFind = TrashFindFirst(f->cch, &fd)) == INVALID_HANDLE_VALUE )
+      return;
+   for ( ;; )
+   {
+      // fd is the current directory's next entry
+      cchName = wcslen(fd.cFileName);
+      if ( !(fd.cFileName[0] == L'.'
+          && (!fd.cFileName[1]  ||  (fd.cFileName[1] == L'.'  &&  !fd.cFileName[2])))
+        && f->cch + 1 + cchName < DIM(reapPath) )
+      {
+         reapPath[f->cch] = L'\\';
+         wcscpy(reapPath + f->cch + 1, fd.cFileName);
+         if ( (fd.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT))
+                                  == FILE_ATTRIBUTE_DIRECTORY )
+         {
+            f[1].cch  = f->cch + 1 + cchName;
+            f[1].attr = fd.dwFileAttributes;
+            if ( (f[1].hFind = TrashFindFirst(f[1].cch, &fd)) != INVALID_HANDLE_VALUE )
+            {
+               f = &reapFrame[++depth];    // removed once its entries are
+               continue;
+            }
+            fd.dwFileAttributes = f[1].attr;
+         }
+         if ( !reapStop )
+            TrashRemove(reapPath, fd.dwFileAttributes,
+                        (__int64)fd.nFileSizeHigh << 32 | fd.nFileSizeLow, f->cch == cchTrash);
+         reapPath[f->cch] = L'\0';
+      }
+
+      // back up out of the directories done, removing each
+      while ( reapStop  ||  !FindNextFile(f->hFind, &fd) )
+      {
+         FindClose(f->hFind);
+         if ( !depth )
+            return;
+         f = &reapFrame[--depth];
+         if ( !reapStop )
+            TrashRemove(reapPath, f[1].attr, 0, f->cch == cchTrash);
+         reapPath[f->cch] = L'\0';
+      }
+   }
+}
+
+
+// Reaps the trash, again each time a subtree is moved in, until the walk is
+// done and the trash empty or /reaptime= runs out
+static unsigned __stdcall
+   TrashReaper(
+      void                 * arg          // in -not used
+   )
+{
+   HANDLE                    handles[2] = { evQueued.Handle(), evWalkDone.Handle() };
+   bool                      done;
+
+   if ( !(reapFrame = (ReapFrame *)malloc((DIM(reapPath) / 2 + 1) * sizeof *reapFrame)) )
+   {
+      err.MsgWrite(21704, L"Trash reaper frame allocation failed, trash left");
+      return 0;
+   }
+   SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+   wcscpy(reapPath, trashPath);
+   for ( ;; )
+   {
+      // looked at before the pass, so a subtree moved in after it isn't missed
+      done = WaitForSingleObject(evWalkDone.Handle(), 0) == WAIT_OBJECT_0;
+      TrashReapAll();
+      if ( done  ||  reapStop )
+         break;
+      WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+   }
+   SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+   free(reapFrame);
+   return 0;
+}
+
+
+static void
+   TrashReaperStart(
+   )
+{
+   hReaper = (HANDLE)_beginthreadex(NULL, 0, TrashReaper, NULL, 0, NULL);
+   if ( !hReaper )
+      err.SysMsgWrite(21703, GetLastError(), L"_beginthreadex(TrashReaper)=%ld ",
+                             GetLastError());
+}
+
+
+// Starts reaping what earlier runs left in the trash
+void _stdcall
+   TrashStart(
+   )
+{
+   if ( !(gOptions.global & OPT_GlobalTrash) )
+      return;
+   _snwprintf(trashPath, DIM(trashPath) - 1, L"%s\\%s", gOptions.target.apipath, TRASH_Name);
+   cchTrash = wcslen(trashPath);
+   tStart = GetTickCount();
+   if ( GetFileAttributes(trashPath) != INVALID_FILE_ATTRIBUTES )
+   {
+      created = true;
+      err.MsgWrite(0, L"Trash left by earlier runs is being reaped");
+      TrashReaperStart();
+   }
+}
+
+
+// Returns whether a name in the target root is the trash directory, which
+// is not part of the mirror
+BOOL _stdcall
+   TrashIs(
+      WCHAR const          * name         // in -target root entry name
+   )
+{
+   return gOptions.global & OPT_GlobalTrash  &&  !_wcsicmp(name, TRASH_Name);
+}
+
+
+// Moves the walk's current target directory, which has no source, into the
+// trash.  Returns FALSE if it is to be removed as usual instead.
+BOOL _stdcall
+   TrashMove(
+      short                  level       ,// in -recursion level of the directory
+      DirEntry const       * tgtDirEntry  // in -target directory entry
+   )
+{
+   WCHAR                     name[40];
+   FILETIME                  ft;
+   DWORD                     rc;
+
+   if ( !(gOptions.global & OPT_GlobalTrash)  ||  !level
+     || !(gOptions.global & OPT_GlobalChange)
+     || !(gOptions.dir.contents  & OPT_PropActionRemove)
+     || !(gOptions.file.contents & OPT_PropActionRemove)
+     || (gOptions.global & (OPT_GlobalReadOnly | OPT_GlobalHidden))
+                        != (OPT_GlobalReadOnly | OPT_GlobalHidden)
+     || gOptions.global & (OPT_GlobalResume | OPT_GlobalBackup | OPT_GlobalBackupForce)
+     || gOptions.include  ||  gOptions.exclude  ||  gOptions.maxLevel < 255 )
+      return FALSE;
+
+   if ( !created )
+   {
+      // making it changes the root, so the root's time is fixed up after
+      if ( CreateDirectory(trashPath, NULL) )
+         gOptions.stats.change.dirCreated++;
+      else if ( GetLastError() != ERROR_ALREADY_EXISTS )
+      {
+         rc = GetLastError();
+         err.SysMsgWrite(21701, rc, L"Trash CreateDirectory(%s)=%ld, not used ",
+                                    trashPath + DIM(gOptions.target.apipath), rc);
+         gOptions.global &= ~OPT_GlobalTrash;
+         return FALSE;
+      }
+      SetFileAttributes(trashPath, FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM);
+      created = true;
+   }
+
+   // a name no earlier run's leftovers can have
+   GetSystemTimeAsFileTime(&ft);
+   _snwprintf(name, DIM(name), L"\\%08lX%08lX.%lX", ft.dwHighDateTime, ft.dwLowDateTime, nMoved);
+   if ( cchTrash + wcslen(name) >= DIM(trashPath) )
+      return FALSE;
+   wcscpy(trashPath + cchTrash, name);
+   if ( !MoveFileEx(gOptions.target.apipath, trashPath, 0) )
+   {
+      rc = GetLastError();
+      trashPath[cchTrash] = L'\0';
+      err.SysMsgWrite(21702, rc, L"Trash MoveFile(%s)=%ld, removed instead ",
+                                 gOptions.target.path, rc);
+      return FALSE;
+   }
+   trashPath[cchTrash] = L'\0';
+
+   // counted now, as the rename changes the parent, and not again when reaped
+   gOptions.stats.change.dirRemoved++;
+   nMoved++;
+   if ( !hReaper )
+      TrashReaperStart();
+   evQueued.Set();
+   if ( gOptions.global & OPT_GlobalDispDetail )
+      err.MsgWrite(0, L" R   %s", gOptions.target.path);
+   return TRUE;
+}
+
+
+// Waits up to /reaptime= for the reaper once the walk is done and counts
+// what it removed
+void _stdcall
+   TrashTerminate(
+   )
+{
+   DWORD                     wait;
+
+   if ( !hReaper )
+      return;
+   evWalkDone.Set();
+   wait = gOptions.reapMinutes < 0 ? INFINITE : (DWORD)gOptions.reapMinutes * 60000;
+   if ( WaitForSingleObject(hReaper, wait) == WAIT_TIMEOUT )
+   {
+      reapStop = true;
+      WaitForSingleObject(hReaper, INFINITE);
+   }
+   CloseHandle(hReaper);
+   hReaper = NULL;
+
+   gOptions.stats.change.dirRemoved        += nDirReaped;
+   gOptions.stats.change.fileRemoved.count += fileReaped.count;
+   gOptions.stats.change.fileRemoved.bytes += fileReaped.bytes;
+   err.MsgWrite(0, L"Trash moved=%ld reaped dirs=%ld files=%ld bytes=%I64d in %lds%s",
+                   nMoved, nDirReaped, fileReaped.count, fileReaped.bytes,
+                   (GetTickCount() - tStart) / 1000,
+                   reapStop ? L", the rest is left for the next run" : L"");
+   if ( !reapStop )
+      RemoveDirectory(trashPath);         // empty now, made again when needed
+}
@@ -5,8 +5,10 @@ System      -  Common
 Author      -  Rich Denham
 Created     -  96/11/08
 Description -  Common synchronization classes
-               This includes TCriticalSection, TEvent, TMutex, and TSharedSync.
+               This includes TCriticalSection, TEvent, TMutex, TSemaphore and
+               TSharedSync.
 Updates     -
+26/10/19 TPB Added TSemaphore.
 ===============================================================================
 */
 
@@ -42,6 +44,21 @@ TMutex::TMutex(
    }
 }
 
+// constructor for simple unnamed and unsecured semaphore
+TSemaphore::TSemaphore(
+      LONG                   initialCount,
+      LONG                   maxCount
+   )
+{
+   handle = CreateSemaphore(NULL, initialCount, maxCount, NULL);
+   if ( handle == NULL )
+   {
+      DWORD                  rc = GetLastError();
+
+      errCommon.SysMsgWrite(ErrU, rc, L"CreateSemaphore()=%ld, ", rc );
+   }
+}
+
 // TSync.cpp - end of file
 
 
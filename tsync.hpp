@@ -5,8 +5,10 @@ System      -  Common
 Author      -  Rich Denham
 Created     -  96/11/08
 Description -  Common synchronization classes header file
-               This includes TCriticalSection, TEvent, TMutex, and TSharedSync.
+               This includes TCriticalSection, TEvent, TMutex, TSemaphore and
+               TSharedSync.
 Updates     -
+26/10/19 TPB Added TSemaphore.
 ===============================================================================
 */
 
@@ -53,6 +55,13 @@ public:
    BOOL                 Release()   const { return ReleaseMutex(handle); }
 };
 
+class TSemaphore : public TSynchObject
+{
+public:
+                        TSemaphore(LONG initialCount, LONG maxCount);
+   BOOL                 Release(LONG n = 1) const { return ReleaseSemaphore(handle, n, NULL); }
+};
+
 // TSharedSync class
 
 // An instantiation of this class represents a resource object that can
@@ -0,0 +1,258 @@
+/*
+===============================================================================
+
+  Module     - Verify
+  Class      - NetDitto Utility
+  Author     - Tom Bernhardt
+  Created    - 10/19/26
+  Description- Verification of copied files with /verify.  Checking a copy
+               otherwise takes a second run with /-o that reads both trees
+               all over again.  Instead the CRC-32C of the source data is
+               computed by XformApply as each block passes through the copy
+               buffer, costing no source I/O at all, and the copied file is
+               queued to a verifier thread.  It reads the target back
+               unbuffered, so it comes from the volume and not the cache the
+               copy just filled, and compares its CRC with the source's.
+               The copy goes on meanwhile, waiting only when too many files
+               are queued.
+
+               With /manifest= the CRC, size and path of each file verified
+               are written to the manifest, a record of the target's
+               integrity that can be checked later.
+  Updates -
+
+===============================================================================
+*/
+
+#include <process.h>
+#include <share.h>
+
+#include "netditto.hpp"
+#include "util32.hpp"
+
+#define VERIFY_QueueMax      256          // files queued for the verifier at most
+#define VERIFY_Buffer        (1024*1024)  // read-back size
+
+struct VerifyJob                          // copied file to verify
+{
+   VerifyJob               * next;
+   DWORD                     crc;         // source CRC-32C
+   __int64                   cbFile;      // source bytes in the CRC
+   size_t                    cchPrefix;   // \\?\ prefix length for messages
+   WCHAR                     path[1];     // target \\?\ path
+};
+
+static VerifyJob           * head,        // files queued
+                           * tail;
+static FILE                * manifest;    // /manifest= file, NULL if none
+static HANDLE                hThread;
+static TSemaphore          * semQueued;   // files queued for the verifier
+static TSemaphore          * semSlots;    // files that may still be queued
+static TCriticalSection      csVerify;    // serializes the queue
+static long volatile         nVerified,   // files verified the same
+                             nMismatch,   // files with a different CRC
+                             nUnverified; // files that couldn't be read back
+static __int64               cbVerified;  // bytes verified
+
+
+// Reads a target file back and returns its CRC-32C as the source's would be,
+// undoing any /xor
+static DWORD
+   VerifyRead(
+      VerifyJob const      * job         ,// in -file to read
+      BYTE                 * buffer      ,// i/o-read buffer
+      DWORD                * crc         ,// out-target CRC-32C
+      __int64              * cbFile       // out-target size
+   )
+{
+   HANDLE                    hTgt;
+   DWORD                     rc = 0,
+                             nRead;
+   BOOL                      b;
+
+   hTgt = CreateFile(job->path,
+                     GENERIC_READ,
+                     FILE_SHARE_READ | FILE_SHARE_WRITE,
+                     NULL, OPEN_EXISTING,
+                     FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_NO_BUFFERING,
+                     0);
+   if ( hTgt == INVALID_HANDLE_VALUE )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(20601, rc, L"Verify OpenR(%s)=%ld, not verified ",
+                             job->path + job->cchPrefix, rc);
+      return rc;
+   }
+
+   *crc = 0xFFFFFFFF;
+   *cbFile = 0;
+   while ( b = ReadFile(hTgt, buffer, VERIFY_Buffer, &nRead, NULL) )
+   {
+      if ( nRead == 0 )
+         break;
+      XformApply(buffer, nRead, NULL);    // /xor back to the source's data
+      *crc = XformCrc(*crc, buffer, nRead);
+      *cbFile += nRead;
+      if ( nRead < VERIFY_Buffer )
+         break;
+      if ( gOptions.fState & FLAG_Shutdown )
+      {
+         rc = ERROR_OPERATION_ABORTED;    // partial CRC, not a mismatch
+         break;
+      }
+   }
+   if ( !b )
+   {
+      rc = GetLastError();
+      err.SysMsgWrite(20602, rc, L"Verify ReadFile(%s)=%ld, not verified ",
+                             job->path + job->cchPrefix, rc);
+   }
+   CloseHandle(hTgt);
+   return rc;
+}
+
+
+// Verifier thread that reads back queued files until it takes a NULL one
+static unsigned __stdcall
+   VerifyThread(
+      void                 * arg          // in -not used
+   )
+{
+   VerifyJob               * job;
+   BYTE                    * buffer = BufLease(VERIFY_Buffer);
+   DWORD                     crc;
+   __int64                   cbFile;
+
+   for ( ;; )
+   {
+      semQueued->WaitSingle();
+      csVerify.Enter();
+      if ( job = head )
+         if ( !(head = job->next) )
+            tail = NULL;
+      csVerify.Leave();
+      if ( !job )
+         break;                           // terminate request
+      semSlots->Release();
+
+      if ( !buffer  ||  gOptions.fState & FLAG_Shutdown
+        || VerifyRead(job, buffer, &crc, &cbFile) )
+         InterlockedIncrement(&nUnverified);
+      else if ( crc != job->crc  ||  cbFile != job->cbFile )
+      {
+         nMismatch++;
+         err.MsgWrite(30601, L"Verify failed %s CRC source=%08lX target=%08lX"
+                             L" size source=%I64d target=%I64d",
+                             job->path + job->cchPrefix, ~job->crc, ~crc, job->cbFile, cbFile);
+      }
+      else
+      {
+         nVerified++;
+         cbVerified += cbFile;
+         if ( manifest )
+            fwprintf(manifest, L"%08lX %14I64d %s\n", ~crc, cbFile, job->path + job->cchPrefix);
+      }
+      free(job);
+   }
+   BufReturn(buffer);
+   return 0;
+}
+
+
+// Starts the verifier thread and opens the manifest if /verify was specified
+// and files are changed
+void _stdcall
+   VerifyStart(
+   )
+{
+   if ( !(gOptions.global & OPT_GlobalVerify)
+     || !(gOptions.global & OPT_GlobalChange) )
+      return;
+
+   if ( gOptions.manifest )
+   {
+      manifest = _wfsopen(gOptions.manifest, L"w, ccs=UTF-8", _SH_DENYWR);
+      if ( !manifest )
+         err.SysMsgWrite(50601, GetLastError(), L"Manifest open(%s)=%ld ",
+                                gOptions.manifest, GetLastError());
+   }
+   semQueued = new TSemaphore(0, MAXLONG);
+   semSlots  = new TSemaphore(VERIFY_QueueMax, VERIFY_QueueMax);
+   hThread = (HANDLE)_beginthreadex(NULL, 0, VerifyThread, NULL, 0, NULL);
+   if ( !hThread )
+      err.SysMsgWrite(50602, GetLastError(), L"_beginthreadex(VerifyThread)=%ld ",
+                             GetLastError());
+   gOptions.fState |= FLAG_Verify;
+}
+
+
+// Waits for the verifier to finish what is queued and closes the manifest
+void _stdcall
+   VerifyTerminate(
+   )
+{
+   if ( !(gOptions.fState & FLAG_Verify) )
+      return;
+
+   gOptions.fState &= ~FLAG_Verify;
+   semQueued->Release();                  // behind everything queued
+   WaitForSingleObject(hThread, INFINITE);
+   CloseHandle(hThread);
+   delete semQueued;
+   delete semSlots;
+   if ( manifest )
+      fclose(manifest);
+}
+
+
+// Queues a copied file to be read back and compared with its source CRC
+void _stdcall
+   VerifyQueue(
+      FileAction const     * action      ,// in -file action
+      XformState const     * state        // in -file's transform state
+   )
+{
+   VerifyJob               * job;
+   size_t                    cchPath;
+
+   if ( !(gOptions.fState & FLAG_Verify) )
+      return;
+
+   cchPath = wcslen(action->tgtApiPath);
+   job = (VerifyJob *)malloc(offsetof(VerifyJob, path) + (cchPath + 1) * sizeof (WCHAR));
+   if ( !job )
+   {
+      err.MsgWrite(20603, L"Verify item allocation failed, not verified (%s)", action->tgtPath);
+      InterlockedIncrement(&nUnverified);
+      return;
+   }
+   job->next      = NULL;
+   job->crc       = state->crc;
+   job->cbFile    = state->cbFile;
+   job->cchPrefix = action->tgtPath - action->tgtApiPath;
+   wcscpy(job->path, action->tgtApiPath);
+
+   semSlots->WaitSingle();                // the verifier is too far behind
+   csVerify.Enter();
+   if ( tail )
+      tail->next = job;
+   else
+      head = job;
+   tail = job;
+   csVerify.Leave();
+   semQueued->Release();
+}
+
+
+// Logs what was verified
+void _stdcall
+   VerifyReport(
+   )
+{
+   if ( !(gOptions.global & OPT_GlobalVerify)
+     || !(gOptions.global & OPT_GlobalChange) )
+      return;
+
+   err.MsgWrite(0, L"Verify files=%ld bytes=%I64d mismatched=%ld unverified=%ld",
+                   nVerified, cbVerified, nMismatch, nUnverified);
+}